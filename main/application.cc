@@ -5,17 +5,24 @@
 #include "audio_codec.h"
 #include "mqtt_protocol.h"
 #include "websocket_protocol.h"
+#include "loopback_protocol.h"
+#include "codecs/wav_audio_codec.h"
 #include "assets/lang_config.h"
 #include "mcp_server.h"
 #include "assets.h"
 #include "settings.h"
 
 #include <cstring>
+#include <array>
+#include <algorithm>
 #include <esp_log.h>
 #include <cJSON.h>
 #include <driver/gpio.h>
 #include <arpa/inet.h>
 #include <font_awesome.h>
+#if CONFIG_USE_WAV_AUDIO_CODEC
+#include <esp_spiffs.h>
+#endif
 
 #define TAG "Application"
 
@@ -35,6 +42,36 @@ static const char* const STATE_STRINGS[] = {
     "invalid_state"
 };
 
+#if CONFIG_USE_WAV_AUDIO_CODEC
+#define WAV_AUDIO_CODEC_BASE_PATH "/storage"
+
+// Audio benchmark: the WAV files on the storage partition replace the microphone and the speaker
+static AudioCodec* CreateWavAudioCodec() {
+    esp_vfs_spiffs_conf_t conf = {
+        .base_path = WAV_AUDIO_CODEC_BASE_PATH,
+        .partition_label = "storage",
+        .max_files = 4,
+        .format_if_mount_failed = true,
+    };
+    esp_err_t err = esp_vfs_spiffs_register(&conf);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(TAG, "Failed to mount the storage partition: %s", esp_err_to_name(err));
+    }
+
+    std::string input = CONFIG_WAV_AUDIO_CODEC_INPUT;
+    std::string output = CONFIG_WAV_AUDIO_CODEC_OUTPUT;
+    if (!input.empty()) {
+        input = WAV_AUDIO_CODEC_BASE_PATH "/" + input;
+    }
+    if (!output.empty()) {
+        output = WAV_AUDIO_CODEC_BASE_PATH "/" + output;
+    }
+    ESP_LOGW(TAG, "Using WAV files as the audio codec, clock speed %d%%", CONFIG_WAV_AUDIO_CODEC_SPEED);
+    static WavAudioCodec codec(input, output, CONFIG_WAV_AUDIO_CODEC_OUTPUT_SAMPLE_RATE, CONFIG_WAV_AUDIO_CODEC_SPEED / 100.0f);
+    return &codec;
+}
+#endif
+
 Application::Application() {
     event_group_ = xEventGroupCreate();
 
@@ -361,7 +398,11 @@ void Application::Start() {
     auto display = board.GetDisplay();
 
     /* Setup the audio service */
+#if CONFIG_USE_WAV_AUDIO_CODEC
+    auto codec = CreateWavAudioCodec();
+#else
     auto codec = board.GetAudioCodec();
+#endif
     audio_service_.Initialize(codec);
     audio_service_.Start();
 
@@ -370,6 +411,7 @@ void Application::Start() {
         xEventGroupSetBits(event_group_, MAIN_EVENT_SEND_AUDIO);
     };
     callbacks.on_wake_word_detected = [this](const std::string& wake_word) {
+        AudioLatencyTracer::GetInstance().StartSpan(kAudioLatencyWakeToSend);
         xEventGroupSetBits(event_group_, MAIN_EVENT_WAKE_WORD_DETECTED);
     };
     callbacks.on_vad_change = [this](bool speaking) {
@@ -401,6 +443,10 @@ void Application::Start() {
     mcp_server.AddCommonTools();
     mcp_server.AddUserOnlyTools();
 
+#if CONFIG_USE_LOOPBACK_PROTOCOL
+    ESP_LOGW(TAG, "Using the loopback protocol, the recorded audio is played back as the reply");
+    protocol_ = std::make_unique<LoopbackProtocol>();
+#else
     if (ota.HasMqttConfig()) {
         protocol_ = std::make_unique<MqttProtocol>();
     } else if (ota.HasWebsocketConfig()) {
@@ -409,6 +455,7 @@ void Application::Start() {
         ESP_LOGW(TAG, "No protocol specified in the OTA config, using MQTT");
         protocol_ = std::make_unique<MqttProtocol>();
     }
+#endif
 
     protocol_->OnConnected([this]() {
         DismissAlert();
@@ -429,6 +476,10 @@ void Application::Start() {
             ESP_LOGW(TAG, "Server sample rate %d does not match device output sample rate %d, resampling may cause distortion",
                 protocol_->server_sample_rate(), codec->output_sample_rate());
         }
+        // Without an uplink frame duration from the server, the configured one is kept
+        if (protocol_->server_uplink_frame_duration() > 0) {
+            audio_service_.SetEncodeFrameDuration(protocol_->server_uplink_frame_duration());
+        }
     });
     protocol_->OnAudioChannelClosed([this, &board]() {
         board.SetPowerSaveMode(true);
@@ -444,6 +495,7 @@ void Application::Start() {
         if (strcmp(type->valuestring, "tts") == 0) {
             auto state = cJSON_GetObjectItem(root, "state");
             if (strcmp(state->valuestring, "start") == 0) {
+                AudioLatencyTracer::GetInstance().StartSpan(kAudioLatencyReplyToSound);
                 Schedule([this]() {
                     aborted_ = false;
                     if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
@@ -572,10 +624,36 @@ void Application::MainEventLoop() {
         }
 
         if (bits & MAIN_EVENT_SEND_AUDIO) {
-            while (auto packet = audio_service_.PopPacketFromSendQueue()) {
-                if (protocol_ && !protocol_->SendAudio(std::move(packet))) {
+            auto& tracer = AudioLatencyTracer::GetInstance();
+            // What queued up while the last message was sent goes in one message, if the protocol can batch.
+            // Each frame goes alone while the network keeps up, so batching adds no latency
+            size_t max_batch = protocol_ ? protocol_->max_audio_batch() : 1;
+            std::array<std::pair<int64_t, int64_t>, BINARY_PROTOCOL4_MAX_FRAMES> times;
+            max_batch = std::min(max_batch, times.size());
+            while (true) {
+                while (send_batch_.size() < max_batch) {
+                    auto packet = audio_service_.PopPacketFromSendQueue();
+                    if (packet == nullptr) {
+                        break;
+                    }
+                    times[send_batch_.size()] = { packet->origin_time, packet->stage_time };
+                    send_batch_.push_back(std::move(packet));
+                }
+                if (send_batch_.empty()) {
                     break;
                 }
+                bool sent = protocol_ == nullptr || protocol_->SendAudioBatch(send_batch_);
+                size_t count = send_batch_.size();
+                send_batch_.clear();
+                if (!sent) {
+                    break;
+                }
+                int64_t now = esp_timer_get_time();
+                for (size_t i = 0; i < count; i++) {
+                    tracer.Record(kAudioLatencySend, times[i].second, now);
+                    tracer.Record(kAudioLatencyUplink, times[i].first, now);
+                }
+                tracer.EndSpan(kAudioLatencyWakeToSend, now);
             }
         }
 
@@ -609,6 +687,7 @@ void Application::MainEventLoop() {
                 // SystemInfo::PrintTaskCpuUsage(pdMS_TO_TICKS(1000));
                 // SystemInfo::PrintTaskList();
                 SystemInfo::PrintHeapStats();
+                audio_service_.PrintStatistics();
             }
         }
     }
@@ -634,8 +713,20 @@ void Application::OnWakeWordDetected() {
         ESP_LOGI(TAG, "Wake word detected: %s", wake_word.c_str());
 #if CONFIG_USE_AFE_WAKE_WORD || CONFIG_USE_CUSTOM_WAKE_WORD
         // Encode and send the wake word data to the server
+        // The pre-roll is a burst of packets, it goes in as few messages as the protocol allows
+        size_t max_batch = protocol_->max_audio_batch();
         while (auto packet = audio_service_.PopWakeWordPacket()) {
-            protocol_->SendAudio(std::move(packet));
+            send_batch_.push_back(std::move(packet));
+            if (send_batch_.size() >= max_batch) {
+                protocol_->SendAudioBatch(send_batch_);
+                send_batch_.clear();
+                AudioLatencyTracer::GetInstance().EndSpan(kAudioLatencyWakeToSend, esp_timer_get_time());
+            }
+        }
+        if (!send_batch_.empty()) {
+            protocol_->SendAudioBatch(send_batch_);
+            send_batch_.clear();
+            AudioLatencyTracer::GetInstance().EndSpan(kAudioLatencyWakeToSend, esp_timer_get_time());
         }
         // Set the chat state to wake word detected
         protocol_->SendWakeWordDetected(wake_word);
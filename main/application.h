@@ -78,6 +78,8 @@ private:
     AecMode aec_mode_ = kAecOff;
     std::string last_error_message_;
     AudioService audio_service_;
+    // Main loop only: the uplink packets sent in one message
+    std::vector<std::unique_ptr<AudioStreamPacket>> send_batch_;
 
     bool has_server_time_ = false;
     bool aborted_ = false;
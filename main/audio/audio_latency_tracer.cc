@@ -0,0 +1,158 @@
+#include "audio_latency_tracer.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#define TAG "AudioLatency"
+
+static const uint32_t kBucketBounds[] = AUDIO_LATENCY_BUCKET_BOUNDS_MS;
+static_assert(sizeof(kBucketBounds) / sizeof(kBucketBounds[0]) + 1 == AUDIO_LATENCY_BUCKET_COUNT,
+    "AUDIO_LATENCY_BUCKET_COUNT must be the number of bounds plus one");
+
+static const char* const kStageNames[kAudioLatencyStageCount] = {
+    "process",
+    "framing",
+    "encode",
+    "send",
+    "uplink",
+    "decode",
+    "playback",
+    "downlink",
+    "wake_to_send",
+    "reply_to_sound",
+    "round_trip",
+};
+
+void AudioLatencyTracer::Record(AudioLatencyStage stage, int64_t start_time, int64_t end_time) {
+    if (start_time <= 0 || end_time < start_time) {
+        return;
+    }
+    uint32_t ms = (end_time - start_time) / 1000;
+    auto& histogram = histograms_[stage];
+
+    size_t bucket = 0;
+    while (bucket < AUDIO_LATENCY_BUCKET_COUNT - 1 && ms > kBucketBounds[bucket]) {
+        bucket++;
+    }
+    histogram.buckets[bucket]++;
+    histogram.count++;
+    histogram.total_ms += ms;
+
+    uint32_t max_ms = histogram.max_ms.load();
+    while (ms > max_ms && !histogram.max_ms.compare_exchange_weak(max_ms, ms)) {
+    }
+}
+
+void AudioLatencyTracer::StartSpan(AudioLatencyStage stage) {
+    span_start_[stage] = esp_timer_get_time();
+}
+
+void AudioLatencyTracer::EndSpan(AudioLatencyStage stage, int64_t end_time) {
+    int64_t start_time = span_start_[stage].exchange(0);
+    Record(stage, start_time, end_time);
+}
+
+void AudioLatencyTracer::MarkCapture(size_t samples) {
+    std::lock_guard<std::mutex> lock(capture_mutex_);
+    captured_samples_ += samples;
+    auto& mark = capture_marks_[capture_mark_index_];
+    mark.end_sample = captured_samples_;
+    mark.time = esp_timer_get_time();
+    capture_mark_index_ = (capture_mark_index_ + 1) % AUDIO_LATENCY_CAPTURE_MARKS;
+}
+
+int64_t AudioLatencyTracer::TakeCaptureTime(size_t samples) {
+    std::lock_guard<std::mutex> lock(capture_mutex_);
+    uint64_t first_sample = processed_samples_;
+    processed_samples_ += samples;
+
+    // The processor keeps the sample order, so the first sample belongs to the oldest chunk ending after it
+    int64_t time = 0;
+    uint64_t best_end = UINT64_MAX;
+    for (auto& mark : capture_marks_) {
+        if (mark.time != 0 && mark.end_sample > first_sample && mark.end_sample < best_end) {
+            best_end = mark.end_sample;
+            time = mark.time;
+        }
+    }
+    return time;
+}
+
+void AudioLatencyTracer::ResetCapture() {
+    std::lock_guard<std::mutex> lock(capture_mutex_);
+    capture_marks_ = {};
+    capture_mark_index_ = 0;
+    captured_samples_ = 0;
+    processed_samples_ = 0;
+}
+
+void AudioLatencyTracer::Reset() {
+    for (auto& histogram : histograms_) {
+        histogram.count = 0;
+        histogram.total_ms = 0;
+        histogram.max_ms = 0;
+        for (auto& bucket : histogram.buckets) {
+            bucket = 0;
+        }
+    }
+}
+
+uint32_t AudioLatencyTracer::Percentile(const Histogram& histogram, uint32_t percent) const {
+    uint32_t count = histogram.count;
+    if (count == 0) {
+        return 0;
+    }
+    // Report the upper bound of the bucket, or the max for the last bucket
+    uint64_t threshold = ((uint64_t)count * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < AUDIO_LATENCY_BUCKET_COUNT - 1; i++) {
+        seen += histogram.buckets[i];
+        if (seen >= threshold) {
+            return kBucketBounds[i];
+        }
+    }
+    return histogram.max_ms;
+}
+
+cJSON* AudioLatencyTracer::GetReportJson() {
+    cJSON* root = cJSON_CreateObject();
+    cJSON* bounds = cJSON_CreateArray();
+    for (auto bound : kBucketBounds) {
+        cJSON_AddItemToArray(bounds, cJSON_CreateNumber(bound));
+    }
+    cJSON_AddItemToObject(root, "bucket_bounds_ms", bounds);
+
+    cJSON* stages = cJSON_CreateObject();
+    for (int i = 0; i < kAudioLatencyStageCount; i++) {
+        auto& histogram = histograms_[i];
+        uint32_t count = histogram.count;
+        cJSON* stage = cJSON_CreateObject();
+        cJSON_AddNumberToObject(stage, "count", count);
+        cJSON_AddNumberToObject(stage, "avg_ms", count > 0 ? histogram.total_ms / count : 0);
+        cJSON_AddNumberToObject(stage, "p50_ms", Percentile(histogram, 50));
+        cJSON_AddNumberToObject(stage, "p90_ms", Percentile(histogram, 90));
+        cJSON_AddNumberToObject(stage, "p99_ms", Percentile(histogram, 99));
+        cJSON_AddNumberToObject(stage, "max_ms", histogram.max_ms);
+        cJSON* buckets = cJSON_CreateArray();
+        for (auto& bucket : histogram.buckets) {
+            cJSON_AddItemToArray(buckets, cJSON_CreateNumber(bucket));
+        }
+        cJSON_AddItemToObject(stage, "buckets", buckets);
+        cJSON_AddItemToObject(stages, kStageNames[i], stage);
+    }
+    cJSON_AddItemToObject(root, "stages", stages);
+    return root;
+}
+
+void AudioLatencyTracer::PrintReport() {
+    for (int i = 0; i < kAudioLatencyStageCount; i++) {
+        auto& histogram = histograms_[i];
+        uint32_t count = histogram.count;
+        if (count == 0) {
+            continue;
+        }
+        ESP_LOGI(TAG, "%-14s n=%lu avg=%lu p50<=%lu p90<=%lu p99<=%lu max=%lu ms", kStageNames[i], count,
+            histogram.total_ms / count, Percentile(histogram, 50), Percentile(histogram, 90),
+            Percentile(histogram, 99), histogram.max_ms.load());
+    }
+}
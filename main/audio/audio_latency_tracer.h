@@ -0,0 +1,93 @@
+#ifndef AUDIO_LATENCY_TRACER_H
+#define AUDIO_LATENCY_TRACER_H
+
+#include <atomic>
+#include <array>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+#include <cJSON.h>
+
+// Upper bounds of the histogram buckets in ms, the last bucket holds everything above
+#define AUDIO_LATENCY_BUCKET_BOUNDS_MS { 5, 10, 20, 40, 80, 160, 320, 640, 1280, 2560 }
+#define AUDIO_LATENCY_BUCKET_COUNT 11
+// Input chunks remembered to map processor output back to its capture time
+#define AUDIO_LATENCY_CAPTURE_MARKS 32
+
+enum AudioLatencyStage {
+    kAudioLatencyProcess,       // Mic capture -> audio processor output
+    kAudioLatencyFraming,       // First sample fetched from the AFE -> its frame handed to the encoder
+    kAudioLatencyEncode,        // Processor output -> Opus packet encoded
+    kAudioLatencySend,          // Encoded -> handed to the transport
+    kAudioLatencyUplink,        // Mic capture -> handed to the transport
+    kAudioLatencyDecode,        // Network receive -> decoded (includes the jitter buffer)
+    kAudioLatencyPlayback,      // Decoded -> OutputData() returned
+    kAudioLatencyDownlink,      // Network receive -> OutputData() returned
+    kAudioLatencyWakeToSend,    // Wake word detected -> first packet sent
+    kAudioLatencyReplyToSound,  // TTS start -> first frame played
+    kAudioLatencyRoundTrip,     // Latency probe chirp passed to OutputData() -> captured by InputData()
+    kAudioLatencyStageCount,
+};
+
+/*
+ * Fixed-bucket latency histograms for each stage of the audio pipeline.
+ *
+ * Frames carry their timestamps (esp_timer_get_time(), 0 when unknown) through the queues, and the
+ * stage that finishes a hop records the difference. One-shot spans such as wake word to first packet
+ * are started and ended by the application. Recording only touches atomics, so every task may call it.
+ */
+class AudioLatencyTracer {
+public:
+    static AudioLatencyTracer& GetInstance() {
+        static AudioLatencyTracer instance;
+        return instance;
+    }
+    // Delete copy constructor and assignment operator
+    AudioLatencyTracer(const AudioLatencyTracer&) = delete;
+    AudioLatencyTracer& operator=(const AudioLatencyTracer&) = delete;
+
+    // Ignored if start_time is 0
+    void Record(AudioLatencyStage stage, int64_t start_time, int64_t end_time);
+    void StartSpan(AudioLatencyStage stage);
+    // Records the span if it was started, later calls are ignored until the next StartSpan()
+    void EndSpan(AudioLatencyStage stage, int64_t end_time);
+
+    // Input task: a chunk of samples (per channel) was captured now
+    void MarkCapture(size_t samples);
+    // Processor output: capture time of the first of the next samples, 0 if it is too old
+    int64_t TakeCaptureTime(size_t samples);
+    void ResetCapture();
+
+    void Reset();
+    // Caller owns the returned object
+    cJSON* GetReportJson();
+    void PrintReport();
+
+private:
+    struct Histogram {
+        std::atomic<uint32_t> count = 0;
+        std::atomic<uint32_t> total_ms = 0;
+        std::atomic<uint32_t> max_ms = 0;
+        std::array<std::atomic<uint32_t>, AUDIO_LATENCY_BUCKET_COUNT> buckets = {};
+    };
+
+    struct CaptureMark {
+        uint64_t end_sample = 0;
+        int64_t time = 0;
+    };
+
+    std::array<Histogram, kAudioLatencyStageCount> histograms_;
+    std::array<std::atomic<int64_t>, kAudioLatencyStageCount> span_start_ = {};
+
+    std::mutex capture_mutex_;
+    std::array<CaptureMark, AUDIO_LATENCY_CAPTURE_MARKS> capture_marks_;
+    size_t capture_mark_index_ = 0;
+    uint64_t captured_samples_ = 0;
+    uint64_t processed_samples_ = 0;
+
+    AudioLatencyTracer() = default;
+    uint32_t Percentile(const Histogram& histogram, uint32_t percent) const;
+};
+
+#endif // AUDIO_LATENCY_TRACER_H
@@ -0,0 +1,71 @@
+#include "audio_mixer.h"
+
+#include <algorithm>
+#include <climits>
+
+int AudioMixer::AddSource(int priority, int32_t gain, int32_t duck_gain) {
+    if (source_count_ >= AUDIO_MIXER_MAX_SOURCES) {
+        return -1;
+    }
+    sources_[source_count_] = { priority, gain, duck_gain };
+    return source_count_++;
+}
+
+void AudioMixer::SetGain(int source, int32_t gain) {
+    if (source >= 0 && source < source_count_) {
+        sources_[source].gain = gain;
+    }
+}
+
+void AudioMixer::SetDuckGain(int source, int32_t duck_gain) {
+    if (source >= 0 && source < source_count_) {
+        sources_[source].duck_gain = duck_gain;
+    }
+}
+
+int32_t AudioMixer::GetEffectiveGain(int source, uint32_t active_sources) const {
+    const auto& self = sources_[source];
+    for (int i = 0; i < source_count_; i++) {
+        if ((active_sources & (1u << i)) && sources_[i].priority > self.priority) {
+            return (int64_t)self.gain * self.duck_gain / AUDIO_MIXER_UNITY_GAIN;
+        }
+    }
+    return self.gain;
+}
+
+bool AudioMixer::IsPassThrough(int source, uint32_t active_sources) const {
+    return active_sources == (1u << source) && GetEffectiveGain(source, active_sources) == AUDIO_MIXER_UNITY_GAIN;
+}
+
+void AudioMixer::Begin(size_t samples, uint32_t active_sources) {
+    // assign() keeps the capacity, the accumulator is only allocated for the first frame
+    accumulator_.assign(samples, 0);
+    active_sources_ = active_sources;
+}
+
+void AudioMixer::Add(int source, const int16_t* pcm, size_t samples, size_t offset) {
+    if (offset >= accumulator_.size()) {
+        return;
+    }
+    samples = std::min(samples, accumulator_.size() - offset);
+    int32_t* acc = accumulator_.data() + offset;
+    int32_t gain = GetEffectiveGain(source, active_sources_);
+    if (gain == AUDIO_MIXER_UNITY_GAIN) {
+        for (size_t i = 0; i < samples; i++) {
+            acc[i] += pcm[i];
+        }
+    } else {
+        // Gains above unity are allowed, the sum is only saturated in End()
+        for (size_t i = 0; i < samples; i++) {
+            acc[i] += (int32_t)(((int64_t)pcm[i] * gain) >> 15);
+        }
+    }
+}
+
+void AudioMixer::End(std::vector<int16_t>& output) {
+    output.resize(accumulator_.size());
+    for (size_t i = 0; i < accumulator_.size(); i++) {
+        int32_t value = accumulator_[i];
+        output[i] = value > INT16_MAX ? INT16_MAX : (value < INT16_MIN ? INT16_MIN : (int16_t)value);
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef AUDIO_MIXER_H
+#define AUDIO_MIXER_H
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#define AUDIO_MIXER_MAX_SOURCES 4
+// Gains are Q15
+#define AUDIO_MIXER_UNITY_GAIN 32768
+
+/*
+ * Sums several mono PCM sources into the stream written to the codec.
+ *
+ * Each source has a gain, a priority and a duck gain: while a source with a higher priority is
+ * active, the duck gain is applied on top of the gain. A frame is mixed between Begin() and End(),
+ * with Add() for every active source. When a single source is active at unity gain, the caller
+ * can write its frame to the codec as it is (IsPassThrough()), so one source costs no more than
+ * without the mixer.
+ */
+class AudioMixer {
+public:
+    // Returns the source id, or -1 when all the sources are in use
+    int AddSource(int priority, int32_t gain = AUDIO_MIXER_UNITY_GAIN, int32_t duck_gain = AUDIO_MIXER_UNITY_GAIN);
+    void SetGain(int source, int32_t gain);
+    void SetDuckGain(int source, int32_t duck_gain);
+
+    // active_sources: bit mask of the source ids with audio in this frame
+    bool IsPassThrough(int source, uint32_t active_sources) const;
+
+    void Begin(size_t samples, uint32_t active_sources);
+    // Adds samples of the source at offset in the frame, beyond the frame size is ignored
+    void Add(int source, const int16_t* pcm, size_t samples, size_t offset = 0);
+    // Saturates the sum into output, which gets the frame size
+    void End(std::vector<int16_t>& output);
+
+private:
+    struct Source {
+        int priority = 0;
+        int32_t gain = AUDIO_MIXER_UNITY_GAIN;
+        int32_t duck_gain = AUDIO_MIXER_UNITY_GAIN;
+    };
+    std::array<Source, AUDIO_MIXER_MAX_SOURCES> sources_;
+    int source_count_ = 0;
+
+    std::vector<int32_t> accumulator_;
+    uint32_t active_sources_ = 0;
+
+    int32_t GetEffectiveGain(int source, uint32_t active_sources) const;
+};
+
+#endif // AUDIO_MIXER_H
@@ -0,0 +1,83 @@
+#ifndef AUDIO_POOL_H
+#define AUDIO_POOL_H
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Fixed-capacity recycling pool for objects that own audio buffers (packets, PCM frames).
+ *
+ * The objects are allocated once when the pool is created. Released objects are Reset() and kept
+ * with their buffer capacity, so after warm-up a frame no longer allocates on every hop.
+ * When the pool is empty a new object is allocated (a miss), and objects released to a full pool
+ * are deleted.
+ */
+template <typename T>
+class AudioPool {
+public:
+    explicit AudioPool(size_t capacity) : capacity_(capacity) {
+        free_.reserve(capacity);
+        for (size_t i = 0; i < capacity; i++) {
+            free_.push_back(new T());
+        }
+    }
+
+    ~AudioPool() {
+        for (auto object : free_) {
+            delete object;
+        }
+    }
+
+    AudioPool(const AudioPool&) = delete;
+    AudioPool& operator=(const AudioPool&) = delete;
+
+    T* Acquire() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!free_.empty()) {
+                T* object = free_.back();
+                free_.pop_back();
+                hits_++;
+                return object;
+            }
+        }
+        misses_++;
+        return new T();
+    }
+
+    void Release(T* object) {
+        if (object == nullptr) {
+            return;
+        }
+        object->Reset();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (free_.size() < capacity_) {
+                free_.push_back(object);
+                return;
+            }
+        }
+        delete object;
+    }
+
+    inline size_t capacity() const { return capacity_; }
+    inline uint32_t hits() const { return hits_; }
+    inline uint32_t misses() const { return misses_; }
+
+    size_t available() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return free_.size();
+    }
+
+private:
+    size_t capacity_;
+    std::mutex mutex_;
+    std::vector<T*> free_;
+    std::atomic<uint32_t> hits_ = 0;
+    std::atomic<uint32_t> misses_ = 0;
+};
+
+#endif // AUDIO_POOL_H
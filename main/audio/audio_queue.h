@@ -0,0 +1,179 @@
+#ifndef AUDIO_QUEUE_H
+#define AUDIO_QUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+/*
+ * Bounded single-producer / single-consumer ring queue for handing audio frames between tasks.
+ *
+ * Push() must only be called from the producer task and Pop() only from the consumer task, so the
+ * hot path needs no lock. Instead of a shared condition variable, each queue wakes exactly one task
+ * with a task notification:
+ *   - the data waiter is notified after a Push()
+ *   - the space waiter, or the producer blocked in WaitForSpace(), is notified after a Pop()
+ *
+ * A task has a single notification value for all the queues it waits on, so a wakeup only means
+ * "check again": waiters re-check their queues in a loop. Waiting takes the notification value, so a
+ * task that waits on a queue must not use task notifications for anything else. A queue with several
+ * producers needs them serialized by the caller for Push(), and they do not wait for space.
+ *
+ * Clear() may be called from any task. It marks everything pushed so far as dropped, and the consumer
+ * releases those items on its next Pop() or ReleaseDropped(), so the producer never races with the consumer on a slot.
+ */
+template <typename T>
+class AudioQueue {
+public:
+    explicit AudioQueue(size_t capacity) : capacity_(capacity), max_capacity_(capacity) {
+        size_t slots = 1;
+        while (slots < capacity) {
+            slots <<= 1;
+        }
+        mask_ = slots - 1;
+        slots_ = std::make_unique<T[]>(slots);
+    }
+
+    AudioQueue(const AudioQueue&) = delete;
+    AudioQueue& operator=(const AudioQueue&) = delete;
+
+    inline size_t capacity() const { return capacity_.load(std::memory_order_relaxed); }
+    inline size_t max_capacity() const { return max_capacity_; }
+    // Largest number of queued items seen by Push()
+    inline size_t high_water() const { return high_water_.load(std::memory_order_relaxed); }
+
+    // Any task. Lowers or raises the limit within the storage allocated by the constructor,
+    // items above a lowered limit stay queued but Push() fails until they are consumed.
+    void SetCapacity(size_t capacity) {
+        if (capacity > max_capacity_) {
+            capacity = max_capacity_;
+        }
+        capacity_.store(capacity > 0 ? capacity : 1, std::memory_order_relaxed);
+        NotifySpace();
+    }
+
+    // Producer side
+    bool Push(T&& item) {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) >= capacity()) {
+            return false;
+        }
+        slots_[tail & mask_] = std::move(item);
+        tail_.store(tail + 1, std::memory_order_release);
+        size_t size = tail + 1 - head_.load(std::memory_order_relaxed);
+        if (size > high_water_.load(std::memory_order_relaxed)) {
+            high_water_.store(size, std::memory_order_relaxed);
+        }
+        Notify(data_waiter_);
+        return true;
+    }
+
+    // Consumer side
+    bool Pop(T& item) {
+        ReleaseDropped();
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = std::move(slots_[head & mask_]);
+        slots_[head & mask_] = T();
+        head_.store(head + 1, std::memory_order_release);
+        NotifySpace();
+        return true;
+    }
+
+    // Consumer side, frees the slots of items dropped by Clear() without popping anything else
+    void ReleaseDropped() {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        uint32_t tail = tail_.load(std::memory_order_acquire);
+        uint32_t drop_until = drop_until_.load(std::memory_order_acquire);
+        if (head == tail || static_cast<int32_t>(drop_until - head) <= 0) {
+            return;
+        }
+        while (head != tail && static_cast<int32_t>(drop_until - head) > 0) {
+            slots_[head & mask_] = T();
+            head++;
+        }
+        head_.store(head, std::memory_order_release);
+        NotifySpace();
+    }
+
+    // Any task
+    void Clear() {
+        drop_until_.store(tail_.load(std::memory_order_acquire), std::memory_order_release);
+        Notify(data_waiter_);
+        NotifySpace();
+    }
+
+    size_t Size() const {
+        uint32_t head = head_.load(std::memory_order_acquire);
+        uint32_t tail = tail_.load(std::memory_order_acquire);
+        uint32_t drop_until = drop_until_.load(std::memory_order_acquire);
+        if (static_cast<int32_t>(drop_until - head) > 0) {
+            head = static_cast<int32_t>(drop_until - tail) > 0 ? tail : drop_until;
+        }
+        return tail - head;
+    }
+
+    inline bool Empty() const { return Size() == 0; }
+
+    // Producer side, how many items Push() accepts now. Only grows until the next Push()
+    size_t Space() const {
+        size_t used = tail_.load(std::memory_order_relaxed) - head_.load(std::memory_order_acquire);
+        return used < capacity() ? capacity() - used : 0;
+    }
+
+    // Full until the consumer has released the slots, including the ones dropped by Clear()
+    inline bool Full() const {
+        return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire) >= capacity();
+    }
+
+    void SetDataWaiter(TaskHandle_t task) { data_waiter_.store(task, std::memory_order_release); }
+    // For a task that waits for space in its own loop, e.g. a codec task producing into this queue
+    void SetSpaceWaiter(TaskHandle_t task) { space_waiter_.store(task, std::memory_order_release); }
+
+    // Producer side, for a producer that is not the space waiter of another queue. Blocks until
+    // there is space, returns false on timeout
+    bool WaitForSpace(TickType_t ticks_to_wait) {
+        space_waiter_.store(xTaskGetCurrentTaskHandle(), std::memory_order_release);
+        // Registered before checking, so a Pop() in between either is seen here or notifies us
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool has_space = !Full();
+        if (!has_space) {
+            ulTaskNotifyTake(pdTRUE, ticks_to_wait);
+            has_space = !Full();
+        }
+        space_waiter_.store(nullptr, std::memory_order_release);
+        return has_space;
+    }
+
+private:
+    std::atomic<size_t> capacity_;
+    size_t max_capacity_;
+    size_t mask_;
+    std::unique_ptr<T[]> slots_;
+    std::atomic<uint32_t> head_ = 0;
+    std::atomic<uint32_t> tail_ = 0;
+    std::atomic<uint32_t> drop_until_ = 0;
+    std::atomic<size_t> high_water_ = 0;
+    std::atomic<TaskHandle_t> data_waiter_ = nullptr;
+    std::atomic<TaskHandle_t> space_waiter_ = nullptr;
+
+    void NotifySpace() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        Notify(space_waiter_);
+    }
+
+    static void Notify(const std::atomic<TaskHandle_t>& waiter) {
+        TaskHandle_t task = waiter.load(std::memory_order_acquire);
+        if (task != nullptr) {
+            xTaskNotifyGive(task);
+        }
+    }
+};
+
+#endif // AUDIO_QUEUE_H
@@ -1,6 +1,9 @@
 #include "audio_service.h"
+#include "pcm_kernels.h"
+#include "system_info.h"
 #include <esp_log.h>
 #include <cstring>
+#include <algorithm>
 
 #if CONFIG_USE_AUDIO_PROCESSOR
 #include "processors/afe_audio_processor.h"
@@ -19,8 +22,37 @@
 #define TAG "AudioService"
 
 
-AudioService::AudioService() {
+static AudioPool<AudioStreamPacket>& GetPacketPool() {
+    static AudioPool<AudioStreamPacket> pool(AUDIO_PACKET_POOL_SIZE);
+    return pool;
+}
+
+static AudioPool<AudioTask>& GetTaskPool() {
+    static AudioPool<AudioTask> pool(AUDIO_TASK_POOL_SIZE);
+    return pool;
+}
+
+void std::default_delete<AudioStreamPacket>::operator()(AudioStreamPacket* packet) const {
+    GetPacketPool().Release(packet);
+}
+
+void std::default_delete<AudioTask>::operator()(AudioTask* task) const {
+    GetTaskPool().Release(task);
+}
+
+std::unique_ptr<AudioStreamPacket> NewAudioStreamPacket() {
+    return std::unique_ptr<AudioStreamPacket>(GetPacketPool().Acquire());
+}
+
+static std::unique_ptr<AudioTask> NewAudioTask(AudioTaskType type) {
+    auto task = std::unique_ptr<AudioTask>(GetTaskPool().Acquire());
+    task->type = type;
+    return task;
+}
+
+AudioService::AudioService() : encoder_governor_(SystemInfo::GetChipModelName()) {
     event_group_ = xEventGroupCreate();
+    encoder_governor_stats_ = encoder_governor_.stats();
 }
 
 AudioService::~AudioService() {
@@ -36,12 +68,28 @@ void AudioService::Initialize(AudioCodec* codec) {
 
     /* Setup the audio codec */
     opus_decoder_ = std::make_unique<OpusDecoderWrapper>(codec->output_sample_rate(), 1, OPUS_FRAME_DURATION_MS);
-    opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
-    opus_encoder_->SetComplexity(0);
+    opus_encoder_ = std::make_unique<OpusFrameEncoder>(16000, 1, encode_frame_duration_);
+    opus_encoder_->SetComplexity(encoder_governor_.complexity());
+    opus_encoder_->SetBitrate(encoder_governor_.bitrate());
+
+    /* The queues are allocated for the shortest frames, limit them to the initial frame durations */
+    audio_encode_queue_.SetCapacity(MAX_ENCODE_DURATION_MS / encode_frame_duration_);
+    audio_send_queue_.SetCapacity(MAX_SEND_DURATION_MS / encode_frame_duration_);
+    audio_testing_queue_.SetCapacity(AUDIO_TESTING_MAX_DURATION_MS / encode_frame_duration_);
+    audio_decode_queue_.SetCapacity(MAX_DECODE_DURATION_MS / OPUS_FRAME_DURATION_MS);
+    audio_playback_queue_.SetCapacity(MAX_PLAYBACK_DURATION_MS / OPUS_FRAME_DURATION_MS);
+    audio_overlay_queue_.SetCapacity(MAX_PLAYBACK_DURATION_MS / OPUS_FRAME_DURATION_MS);
+
+    /* Sounds have priority over the reply, which is ducked while they play */
+    voice_mix_source_ = mixer_.AddSource(0, AUDIO_MIXER_UNITY_GAIN, AUDIO_VOICE_DUCK_GAIN);
+    sound_mix_source_ = mixer_.AddSource(1);
 
     if (codec->input_sample_rate() != 16000) {
-        input_resampler_.Configure(codec->input_sample_rate(), 16000);
-        reference_resampler_.Configure(codec->input_sample_rate(), 16000);
+        /* The uplink goes to the AFE and ASR, the shorter filter is enough there */
+        if (!input_resampler_.Configure(codec->input_sample_rate(), 16000, kResamplerQualityFast) ||
+            !reference_resampler_.Configure(codec->input_sample_rate(), 16000, kResamplerQualityFast)) {
+            ESP_LOGE(TAG, "Cannot resample the input from %d Hz, the uplink is not resampled", codec->input_sample_rate());
+        }
     }
 
 #if CONFIG_USE_AUDIO_PROCESSOR
@@ -128,12 +176,18 @@ void AudioService::Start() {
     }, "audio_output", 2048, this, 4, &audio_output_task_handle_);
 #endif
 
-    /* Start the opus codec task */
-    xTaskCreate([](void* arg) {
+    /* Start the opus encoder and decoder tasks, uplink and downlink progress independently */
+    xTaskCreatePinnedToCore([](void* arg) {
         AudioService* audio_service = (AudioService*)arg;
-        audio_service->OpusCodecTask();
+        audio_service->OpusEncoderTask();
         vTaskDelete(NULL);
-    }, "opus_codec", 2048 * 13, this, 2, &opus_codec_task_handle_);
+    }, "opus_encoder", OPUS_ENCODER_TASK_STACK_SIZE, this, 2, &opus_encoder_task_handle_, OPUS_ENCODER_TASK_CORE);
+
+    xTaskCreatePinnedToCore([](void* arg) {
+        AudioService* audio_service = (AudioService*)arg;
+        audio_service->OpusDecoderTask();
+        vTaskDelete(NULL);
+    }, "opus_decoder", OPUS_DECODER_TASK_STACK_SIZE, this, 2, &opus_decoder_task_handle_, OPUS_DECODER_TASK_CORE);
 }
 
 void AudioService::Stop() {
@@ -143,12 +197,13 @@ void AudioService::Stop() {
         AS_EVENT_WAKE_WORD_RUNNING |
         AS_EVENT_AUDIO_PROCESSOR_RUNNING);
 
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    audio_encode_queue_.clear();
-    audio_decode_queue_.clear();
-    audio_playback_queue_.clear();
-    audio_testing_queue_.clear();
-    audio_queue_cv_.notify_all();
+    /* Clearing a queue also wakes up its consumer, so the tasks can see service_stopped_ */
+    audio_encode_queue_.Clear();
+    audio_decode_queue_.Clear();
+    audio_playback_queue_.Clear();
+    audio_testing_queue_.Clear();
+    audio_sound_queue_.Clear();
+    audio_overlay_queue_.Clear();
 }
 
 bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples) {
@@ -163,26 +218,26 @@ bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, in
         if (!codec_->InputData(data)) {
             return false;
         }
+        // ReadAudioData() is public (e.g. acoustic provisioning), so guard the shared buffers
+        std::lock_guard<std::mutex> lock(input_buffer_mutex_);
         if (codec_->input_channels() == 2) {
-            auto mic_channel = std::vector<int16_t>(data.size() / 2);
-            auto reference_channel = std::vector<int16_t>(data.size() / 2);
-            for (size_t i = 0, j = 0; i < mic_channel.size(); ++i, j += 2) {
-                mic_channel[i] = data[j];
-                reference_channel[i] = data[j + 1];
-            }
-            auto resampled_mic = std::vector<int16_t>(input_resampler_.GetOutputSamples(mic_channel.size()));
-            auto resampled_reference = std::vector<int16_t>(reference_resampler_.GetOutputSamples(reference_channel.size()));
-            input_resampler_.Process(mic_channel.data(), mic_channel.size(), resampled_mic.data());
-            reference_resampler_.Process(reference_channel.data(), reference_channel.size(), resampled_reference.data());
-            data.resize(resampled_mic.size() + resampled_reference.size());
-            for (size_t i = 0, j = 0; i < resampled_mic.size(); ++i, j += 2) {
-                data[j] = resampled_mic[i];
-                data[j + 1] = resampled_reference[i];
-            }
+            // Deinterleave, resample and interleave again through persistent buffers
+            size_t frames = data.size() / 2;
+            input_mic_buffer_.resize(frames);
+            input_reference_buffer_.resize(frames);
+            PcmDeinterleave(data.data(), input_mic_buffer_.data(), input_reference_buffer_.data(), frames);
+            size_t resampled_frames = input_resampler_.GetOutputSamples(frames);
+            resampled_mic_buffer_.resize(resampled_frames);
+            resampled_reference_buffer_.resize(reference_resampler_.GetOutputSamples(frames));
+            input_resampler_.Process(input_mic_buffer_.data(), frames, resampled_mic_buffer_.data());
+            reference_resampler_.Process(input_reference_buffer_.data(), frames, resampled_reference_buffer_.data());
+            data.resize(resampled_frames * 2);
+            PcmInterleave(resampled_mic_buffer_.data(), resampled_reference_buffer_.data(), data.data(), resampled_frames);
         } else {
-            auto resampled = std::vector<int16_t>(input_resampler_.GetOutputSamples(data.size()));
-            input_resampler_.Process(data.data(), data.size(), resampled.data());
-            data = std::move(resampled);
+            // Resample into the persistent buffer and swap storage with data, no allocation after warm-up
+            resampled_mic_buffer_.resize(input_resampler_.GetOutputSamples(data.size()));
+            input_resampler_.Process(data.data(), data.size(), resampled_mic_buffer_.data());
+            data.swap(resampled_mic_buffer_);
         }
     } else {
         data.resize(samples * codec_->input_channels());
@@ -200,17 +255,20 @@ bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, in
     if (audio_debugger_ == nullptr) {
         audio_debugger_ = std::make_unique<AudioDebugger>();
     }
-    audio_debugger_->Feed(data);
+    audio_debugger_->Feed(data, sample_rate, codec_->input_channels());
 #endif
 
     return true;
 }
 
 void AudioService::AudioInputTask() {
+    /* Reused for every frame, unless a consumer takes ownership of it */
+    std::vector<int16_t> data;
+
     while (true) {
         EventBits_t bits = xEventGroupWaitBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING |
-            AS_EVENT_WAKE_WORD_RUNNING | AS_EVENT_AUDIO_PROCESSOR_RUNNING,
-            pdFALSE, pdFALSE, portMAX_DELAY);
+            AS_EVENT_WAKE_WORD_RUNNING | AS_EVENT_AUDIO_PROCESSOR_RUNNING | AS_EVENT_LATENCY_PROBE_RUNNING |
+            AS_EVENT_LATENCY_PROBE_STOP, pdFALSE, pdFALSE, portMAX_DELAY);
 
         if (service_stopped_) {
             break;
@@ -221,23 +279,39 @@ void AudioService::AudioInputTask() {
             continue;
         }
 
+        /* The latency measurement timed out, no Capture() runs after this point */
+        if (bits & AS_EVENT_LATENCY_PROBE_STOP) {
+            xEventGroupClearBits(event_group_, AS_EVENT_LATENCY_PROBE_STOP);
+            xEventGroupSetBits(event_group_, AS_EVENT_LATENCY_PROBE_STOPPED);
+            continue;
+        }
+
+        /* Capture for the round-trip latency measurement, in 10ms frames so the read times are precise.
+         * The wake word is not fed meanwhile */
+        if (bits & AS_EVENT_LATENCY_PROBE_RUNNING) {
+            if (ReadAudioData(data, 16000, 160)) {
+                int channels = codec_->input_channels();
+                if (latency_probe_.Capture(data.data(), data.size() / channels, channels, esp_timer_get_time())) {
+                    xEventGroupClearBits(event_group_, AS_EVENT_LATENCY_PROBE_RUNNING);
+                    xEventGroupSetBits(event_group_, AS_EVENT_LATENCY_PROBE_DONE);
+                }
+                continue;
+            }
+        }
+
         /* Used for audio testing in NetworkConfiguring mode by clicking the BOOT button */
         if (bits & AS_EVENT_AUDIO_TESTING_RUNNING) {
-            if (audio_testing_queue_.size() >= AUDIO_TESTING_MAX_DURATION_MS / OPUS_FRAME_DURATION_MS) {
+            if (audio_testing_queue_.Size() >= audio_testing_queue_.capacity()) {
                 ESP_LOGW(TAG, "Audio testing queue is full, stopping audio testing");
                 EnableAudioTesting(false);
                 continue;
             }
-            std::vector<int16_t> data;
-            int samples = OPUS_FRAME_DURATION_MS * 16000 / 1000;
+            int samples = encode_frame_duration_ * 16000 / 1000;
             if (ReadAudioData(data, 16000, samples)) {
                 // If input channels is 2, we need to fetch the left channel data
                 if (codec_->input_channels() == 2) {
-                    auto mono_data = std::vector<int16_t>(data.size() / 2);
-                    for (size_t i = 0, j = 0; i < mono_data.size(); ++i, j += 2) {
-                        mono_data[i] = data[j];
-                    }
-                    data = std::move(mono_data);
+                    PcmExtractLeft(data.data(), data.data(), data.size() / 2);
+                    data.resize(data.size() / 2);
                 }
                 PushTaskToEncodeQueue(kAudioTaskTypeEncodeToTestingQueue, std::move(data));
                 continue;
@@ -246,7 +320,6 @@ void AudioService::AudioInputTask() {
 
         /* Feed the wake word */
         if (bits & AS_EVENT_WAKE_WORD_RUNNING) {
-            std::vector<int16_t> data;
             int samples = wake_word_->GetFeedSize();
             if (samples > 0) {
                 if (ReadAudioData(data, 16000, samples)) {
@@ -258,10 +331,10 @@ void AudioService::AudioInputTask() {
 
         /* Feed the audio processor */
         if (bits & AS_EVENT_AUDIO_PROCESSOR_RUNNING) {
-            std::vector<int16_t> data;
             int samples = audio_processor_->GetFeedSize();
             if (samples > 0) {
                 if (ReadAudioData(data, 16000, samples)) {
+                    AudioLatencyTracer::GetInstance().MarkCapture(samples);
                     audio_processor_->Feed(std::move(data));
                     continue;
                 }
@@ -276,118 +349,435 @@ void AudioService::AudioInputTask() {
 }
 
 void AudioService::AudioOutputTask() {
-    while (true) {
-        std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-        audio_queue_cv_.wait(lock, [this]() { return !audio_playback_queue_.empty() || service_stopped_; });
-        if (service_stopped_) {
-            break;
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    audio_playback_queue_.SetDataWaiter(self);
+    audio_overlay_queue_.SetDataWaiter(self);
+
+    /* The frame being played from each mixer source, and how much of it is played */
+    std::unique_ptr<AudioTask> voice;
+    std::unique_ptr<AudioTask> sound;
+    size_t voice_offset = 0;
+    size_t sound_offset = 0;
+
+    while (!service_stopped_) {
+        if (voice == nullptr && audio_playback_queue_.Pop(voice)) {
+            voice_offset = 0;
+        }
+        if (sound == nullptr && audio_overlay_queue_.Pop(sound)) {
+            sound_offset = 0;
+        }
+        if (voice == nullptr && sound == nullptr) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
         }
-
-        auto task = std::move(audio_playback_queue_.front());
-        audio_playback_queue_.pop_front();
-        audio_queue_cv_.notify_all();
-        lock.unlock();
 
         if (!codec_->output_enabled()) {
             esp_timer_stop(audio_power_timer_);
             esp_timer_start_periodic(audio_power_timer_, AUDIO_POWER_CHECK_INTERVAL_MS * 1000);
             codec_->EnableOutput(true);
         }
-        codec_->OutputData(task->pcm);
+
+        /* The probe chirp is timed as it is written, the lead silence before it keeps the DMA full */
+        if (voice != nullptr && voice_offset == 0 && voice->type == kAudioTaskTypeLatencyProbe) {
+            latency_probe_.MarkPlayback(esp_timer_get_time());
+        }
+
+        /* A single source at unity gain is written as it is, like without the mixer */
+        uint32_t active_sources = (voice != nullptr ? 1u << voice_mix_source_ : 0) |
+            (sound != nullptr ? 1u << sound_mix_source_ : 0);
+        if (voice != nullptr && voice_offset == 0 && mixer_.IsPassThrough(voice_mix_source_, active_sources)) {
+            codec_->OutputData(voice->pcm);
+            OnPlaybackTaskDone(*voice);
+            voice.reset();
+        } else if (sound != nullptr && sound_offset == 0 && mixer_.IsPassThrough(sound_mix_source_, active_sources)) {
+            codec_->OutputData(sound->pcm);
+            sound.reset();
+        } else {
+            /*
+             * Only the samples that every active source has are mixed, so a source that has not
+             * decoded its next frame yet is never padded with silence. The rest of a frame is mixed
+             * in the next round, or written alone once the other source has ended.
+             */
+            size_t samples = voice != nullptr ? voice->pcm.size() - voice_offset : sound->pcm.size() - sound_offset;
+            if (voice != nullptr && sound != nullptr) {
+                samples = std::min(samples, sound->pcm.size() - sound_offset);
+            }
+            mixer_.Begin(samples, active_sources);
+            MixSource(voice_mix_source_, voice, voice_offset, samples);
+            MixSource(sound_mix_source_, sound, sound_offset, samples);
+            mixer_.End(mix_buffer_);
+            if (samples > 0) {
+                codec_->OutputData(mix_buffer_);
+            }
+        }
 
         /* Update the last output time */
         last_output_time_ = std::chrono::steady_clock::now();
         debug_statistics_.playback_count++;
+    }
+
+    audio_playback_queue_.SetDataWaiter(nullptr);
+    audio_overlay_queue_.SetDataWaiter(nullptr);
+    ESP_LOGW(TAG, "Audio output task stopped");
+}
+
+void AudioService::MixSource(int source, std::unique_ptr<AudioTask>& task, size_t& offset, size_t samples) {
+    /* The next task of the source is taken by the output loop, which knows how much the others have */
+    if (task == nullptr) {
+        return;
+    }
+    mixer_.Add(source, task->pcm.data() + offset, samples);
+    offset += samples;
+    if (offset >= task->pcm.size()) {
+        OnPlaybackTaskDone(*task);
+        task.reset();
+        offset = 0;
+    }
+}
+
+void AudioService::OnPlaybackTaskDone(const AudioTask& task) {
+    /* Only frames received from the network carry an origin time */
+    if (task.origin_time != 0) {
+        auto& tracer = AudioLatencyTracer::GetInstance();
+        int64_t now = esp_timer_get_time();
+        tracer.Record(kAudioLatencyPlayback, task.stage_time, now);
+        tracer.Record(kAudioLatencyDownlink, task.origin_time, now);
+        tracer.EndSpan(kAudioLatencyReplyToSound, now);
+    }
 
 #if CONFIG_USE_SERVER_AEC
-        /* Record the timestamp for server AEC */
-        if (task->timestamp > 0) {
-            lock.lock();
-            timestamp_queue_.push_back(task->timestamp);
-        }
+    /* Record the timestamp for server AEC */
+    if (task.timestamp > 0) {
+        std::lock_guard<std::mutex> lock(timestamp_mutex_);
+        timestamp_queue_.push_back(task.timestamp);
+    }
 #endif
+}
+
+void AudioService::OpusEncoderTask() {
+    /* The encoder task consumes the encode queue and produces the send / testing queues */
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    audio_encode_queue_.SetDataWaiter(self);
+    audio_send_queue_.SetSpaceWaiter(self);
+
+    while (!service_stopped_) {
+        std::unique_ptr<AudioTask> task;
+        if (audio_send_queue_.Full() || !audio_encode_queue_.Pop(task)) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        /* Follow the frame size of the task, it changes after SetEncodeFrameDuration() */
+        int frame_duration = task->pcm.size() * 1000 / 16000;
+        if (frame_duration != opus_encoder_->duration_ms()) {
+            if (frame_duration != 20 && frame_duration != 40 && frame_duration != 60) {
+                ESP_LOGE(TAG, "Unsupported frame size: %u", task->pcm.size());
+                continue;
+            }
+            ESP_LOGI(TAG, "Opus encoder frame duration: %d ms", frame_duration);
+            opus_encoder_ = std::make_unique<OpusFrameEncoder>(16000, 1, frame_duration);
+            opus_encoder_->SetComplexity(encoder_governor_.complexity());
+            opus_encoder_->SetBitrate(encoder_governor_.bitrate());
+            encoder_governor_.ResetWindow();
+        }
+
+        int64_t start_time = esp_timer_get_time();
+        auto packet = NewAudioStreamPacket();
+        packet->frame_duration = frame_duration;
+        packet->sample_rate = 16000;
+        packet->timestamp = task->timestamp;
+        /* Sent packets get room in front for the transport header, so the protocol does not copy them */
+        if (task->type == kAudioTaskTypeEncodeToSendQueue) {
+            packet->headroom = AUDIO_PACKET_HEADROOM;
+        }
+        if (!opus_encoder_->Encode(task->pcm, packet->payload, packet->headroom)) {
+            ESP_LOGE(TAG, "Failed to encode audio");
+            continue;
+        }
+        int64_t end_time = esp_timer_get_time();
+        debug_statistics_.encode_timing.Add(end_time - start_time);
+        if (encoder_governor_.AddFrame(end_time - start_time, frame_duration, audio_encode_queue_.Size(),
+            audio_send_queue_.Size(), audio_send_queue_.capacity())) {
+            opus_encoder_->SetComplexity(encoder_governor_.complexity());
+            opus_encoder_->SetBitrate(encoder_governor_.bitrate());
+        }
+        if (encoder_governor_.window_frames() == 0) {
+            std::lock_guard<std::mutex> lock(encoder_governor_mutex_);
+            encoder_governor_stats_ = encoder_governor_.stats();
+        }
+        AudioLatencyTracer::GetInstance().Record(kAudioLatencyEncode, task->stage_time, end_time);
+        packet->origin_time = task->origin_time;
+        packet->stage_time = end_time;
+
+        if (task->type == kAudioTaskTypeEncodeToSendQueue) {
+            if (UPLINK_DTX_KEEPALIVE_MS > 0) {
+                auto& dtx = uplink_dtx_statistics_;
+                dtx.sent_frames++;
+                dtx.sent_bytes += packet->payload_size();
+                if (!voice_detected_) {
+                    dtx.silence_packets++;
+                    dtx.silence_bytes += packet->payload_size();
+                }
+            }
+            audio_send_queue_.Push(std::move(packet));
+            if (callbacks_.on_send_queue_available) {
+                callbacks_.on_send_queue_available();
+            }
+        } else if (task->type == kAudioTaskTypeEncodeToTestingQueue) {
+            /* The input task stops recording before the testing queue is full, so this is rare */
+            if (!audio_testing_queue_.Push(std::move(packet))) {
+                ESP_LOGW(TAG, "Audio testing queue is full, dropping packet");
+            }
+        }
+        debug_statistics_.encode_count++;
     }
 
-    ESP_LOGW(TAG, "Audio output task stopped");
+    audio_encode_queue_.SetDataWaiter(nullptr);
+    audio_send_queue_.SetSpaceWaiter(nullptr);
+    ESP_LOGW(TAG, "Opus encoder task stopped");
 }
 
-void AudioService::OpusCodecTask() {
-    while (true) {
-        std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-        audio_queue_cv_.wait(lock, [this]() {
-            return service_stopped_ ||
-                (!audio_encode_queue_.empty() && audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE) ||
-                (!audio_decode_queue_.empty() && audio_playback_queue_.size() < MAX_PLAYBACK_TASKS_IN_QUEUE);
-        });
-        if (service_stopped_) {
-            break;
+void AudioService::OpusDecoderTask() {
+    /* The decoder task consumes the decode / testing queues and produces the playback queue */
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    audio_decode_queue_.SetDataWaiter(self);
+    audio_testing_queue_.SetDataWaiter(self);
+    audio_sound_queue_.SetDataWaiter(self);
+    audio_playback_queue_.SetSpaceWaiter(self);
+    audio_overlay_queue_.SetSpaceWaiter(self);
+
+    while (!service_stopped_) {
+        int64_t now_ms = esp_timer_get_time() / 1000;
+
+        if (decoder_reset_pending_.exchange(false)) {
+            opus_decoder_->ResetState();
+            jitter_buffer_.Reset();
         }
 
-        /* Decode the audio from decode queue */
-        if (!audio_decode_queue_.empty() && audio_playback_queue_.size() < MAX_PLAYBACK_TASKS_IN_QUEUE) {
-            auto packet = std::move(audio_decode_queue_.front());
-            audio_decode_queue_.pop_front();
-            audio_queue_cv_.notify_all();
-            lock.unlock();
-
-            auto task = std::make_unique<AudioTask>();
-            task->type = kAudioTaskTypeDecodeToPlaybackQueue;
-            task->timestamp = packet->timestamp;
-
-            SetDecodeSampleRate(packet->sample_rate, packet->frame_duration);
-            if (opus_decoder_->Decode(std::move(packet->payload), task->pcm)) {
-                // Resample if the sample rate is different
-                if (opus_decoder_->sample_rate() != codec_->output_sample_rate()) {
-                    int target_size = output_resampler_.GetOutputSamples(task->pcm.size());
-                    std::vector<int16_t> resampled(target_size);
-                    output_resampler_.Process(task->pcm.data(), task->pcm.size(), resampled.data());
-                    task->pcm = std::move(resampled);
-                }
+        /* Queue the latency probe: silence to fill the output DMA like a reply does, then the chirp */
+        if (latency_probe_pending_ && audio_playback_queue_.Size() + 2 <= audio_playback_queue_.capacity()) {
+            latency_probe_pending_ = false;
+            auto lead = NewAudioTask(kAudioTaskTypeDecodeToPlaybackQueue);
+            lead->pcm.assign(latency_probe_.lead_samples(), 0);
+            audio_playback_queue_.Push(std::move(lead));
+            auto chirp = NewAudioTask(kAudioTaskTypeLatencyProbe);
+            chirp->pcm = latency_probe_.chirp();
+            audio_playback_queue_.Push(std::move(chirp));
+        }
 
-                lock.lock();
-                audio_playback_queue_.push_back(std::move(task));
-                audio_queue_cv_.notify_all();
-            } else {
-                ESP_LOGE(TAG, "Failed to decode audio");
-                lock.lock();
+        /* Sounds are decoded into the overlay queue, a reset of the reply does not touch them */
+        bool sound_decoded = DecodeSound();
+
+        /* Move the arrived packets into the jitter buffer */
+        std::unique_ptr<AudioStreamPacket> packet;
+        while (!jitter_buffer_.Full() && audio_decode_queue_.Pop(packet)) {
+            jitter_buffer_.Push(std::move(packet), now_ms);
+        }
+
+        /* While recording, free the testing queue slots dropped by Clear() so the encoder task can push again */
+        if (!audio_testing_playback_) {
+            audio_testing_queue_.ReleaseDropped();
+        }
+
+        /* Decode the audio from jitter buffer, or play back the recorded audio testing queue.
+         * A packet with empty payload from the jitter buffer is decoded as packet loss concealment. */
+        if (audio_playback_queue_.Full() || !(jitter_buffer_.Pop(packet, now_ms) ||
+            (audio_testing_playback_ && audio_testing_queue_.Pop(packet)))) {
+            if (!sound_decoded) {
+                ulTaskNotifyTake(pdTRUE, jitter_buffer_.GetWaitTicks(now_ms));
             }
-            debug_statistics_.decode_count++;
-        }
-        
-        /* Encode the audio to send queue */
-        if (!audio_encode_queue_.empty() && audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE) {
-            auto task = std::move(audio_encode_queue_.front());
-            audio_encode_queue_.pop_front();
-            audio_queue_cv_.notify_all();
-            lock.unlock();
-
-            auto packet = std::make_unique<AudioStreamPacket>();
-            packet->frame_duration = OPUS_FRAME_DURATION_MS;
-            packet->sample_rate = 16000;
-            packet->timestamp = task->timestamp;
-            if (!opus_encoder_->Encode(std::move(task->pcm), packet->payload)) {
-                ESP_LOGE(TAG, "Failed to encode audio");
-                continue;
+            continue;
+        }
+
+        int64_t start_time = esp_timer_get_time();
+        auto task = NewAudioTask(kAudioTaskTypeDecodeToPlaybackQueue);
+        task->timestamp = packet->timestamp;
+        task->origin_time = packet->origin_time;
+
+        SetDecodeSampleRate(packet->sample_rate, packet->frame_duration);
+        // When resampling, decode into the persistent buffer and resample into the recycled task buffer
+        bool resample = opus_decoder_->sample_rate() != codec_->output_sample_rate();
+        auto& pcm = resample ? decode_buffer_ : task->pcm;
+        if (opus_decoder_->Decode(std::move(packet->payload), pcm)) {
+            if (resample) {
+                task->pcm.resize(output_resampler_.GetOutputSamples(pcm.size()));
+                output_resampler_.Process(pcm.data(), pcm.size(), task->pcm.data());
             }
+            int64_t end_time = esp_timer_get_time();
+            debug_statistics_.decode_timing.Add(end_time - start_time);
+            AudioLatencyTracer::GetInstance().Record(kAudioLatencyDecode, task->origin_time, end_time);
+            task->stage_time = end_time;
+            audio_playback_queue_.Push(std::move(task));
+        } else {
+            ESP_LOGE(TAG, "Failed to decode audio");
+        }
+        debug_statistics_.decode_count++;
+    }
 
-            if (task->type == kAudioTaskTypeEncodeToSendQueue) {
-                {
-                    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-                    audio_send_queue_.push_back(std::move(packet));
-                }
-                if (callbacks_.on_send_queue_available) {
-                    callbacks_.on_send_queue_available();
-                }
-            } else if (task->type == kAudioTaskTypeEncodeToTestingQueue) {
-                std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-                audio_testing_queue_.push_back(std::move(packet));
+    audio_decode_queue_.SetDataWaiter(nullptr);
+    audio_testing_queue_.SetDataWaiter(nullptr);
+    audio_sound_queue_.SetDataWaiter(nullptr);
+    audio_playback_queue_.SetSpaceWaiter(nullptr);
+    audio_overlay_queue_.SetSpaceWaiter(nullptr);
+    ESP_LOGW(TAG, "Opus decoder task stopped");
+}
+
+bool AudioService::DecodeSound() {
+    if (cached_sound_ == nullptr && sound_demuxer_ == nullptr) {
+        {
+            /* PlaySound() pushes cached sounds to the overlay queue only while no sound is busy here */
+            std::lock_guard<std::mutex> lock(sound_mutex_);
+            sound_busy_ = audio_sound_queue_.Pop(current_sound_);
+        }
+        if (!sound_busy_) {
+            if (sound_playing_ && audio_overlay_queue_.Empty()) {
+                // Free the decoder between sounds, it is only needed for the sounds not in the cache
+                sound_decoder_.reset();
+                sound_playing_ = false;
+            }
+            return false;
+        }
+        sound_playing_ = true;
+        if (SOUND_CACHE_MAX_BYTES > 0) {
+            cached_sound_ = sound_cache_.Find(current_sound_.data(), codec_->output_sample_rate());
+        }
+        if (cached_sound_ != nullptr) {
+            cached_sound_offset_ = 0;
+        } else {
+            sound_demuxer_ = std::make_unique<OggDemuxer>(current_sound_);
+            sound_fill_ = SOUND_CACHE_MAX_BYTES > 0;
+            sound_fill_buffer_.clear();
+            if (sound_decoder_ != nullptr) {
+                sound_decoder_->ResetState();
+            }
+        }
+    }
+
+    /* The sound stays busy while the overlay queue is full, so PlaySound() cannot push in between */
+    if (audio_overlay_queue_.Full()) {
+        return false;
+    }
+
+    auto task = NewAudioTask(kAudioTaskTypeDecodeToPlaybackQueue);
+    if (cached_sound_ != nullptr) {
+        /* A sound cached while it was queued, played in frames of the decoded size */
+        size_t frame_samples = cached_sound_->sample_rate * OPUS_FRAME_DURATION_MS / 1000;
+        size_t samples = std::min(frame_samples, cached_sound_->samples - cached_sound_offset_);
+        const int16_t* begin = cached_sound_->pcm + cached_sound_offset_;
+        task->pcm.assign(begin, begin + samples);
+        cached_sound_offset_ += samples;
+        if (cached_sound_offset_ >= cached_sound_->samples) {
+            cached_sound_.reset();
+        }
+    } else {
+        OggOpusPacket packet;
+        if (!sound_demuxer_->NextPacket(packet)) {
+            FinishSound();
+            return true;
+        }
+        if (!DecodeSoundPacket(packet, task->pcm)) {
+            ESP_LOGE(TAG, "Failed to decode sound");
+            sound_fill_ = false;
+        } else if (sound_fill_) {
+            if ((sound_fill_buffer_.size() + task->pcm.size()) * sizeof(int16_t) > sound_cache_.max_bytes()) {
+                // Too long to be cached
+                sound_fill_ = false;
+                std::vector<int16_t>().swap(sound_fill_buffer_);
+            } else {
+                sound_fill_buffer_.insert(sound_fill_buffer_.end(), task->pcm.begin(), task->pcm.end());
             }
-            debug_statistics_.encode_count++;
-            lock.lock();
         }
     }
 
-    ESP_LOGW(TAG, "Opus codec task stopped");
+    std::lock_guard<std::mutex> lock(sound_mutex_);
+    if (!task->pcm.empty()) {
+        task->stage_time = esp_timer_get_time();
+        audio_overlay_queue_.Push(std::move(task));
+    }
+    sound_busy_ = cached_sound_ != nullptr || sound_demuxer_ != nullptr;
+    return true;
+}
+
+bool AudioService::PushCachedSound(const std::string_view& sound) {
+    /* Called with sound_mutex_ held. A sound queued or being decoded plays first, so the cached one waits its turn */
+    if (SOUND_CACHE_MAX_BYTES == 0 || sound_busy_ || !audio_sound_queue_.Empty()) {
+        return false;
+    }
+    auto cached = sound_cache_.Find(sound.data(), codec_->output_sample_rate());
+    if (cached == nullptr) {
+        return false;
+    }
+    size_t frame_samples = cached->sample_rate * OPUS_FRAME_DURATION_MS / 1000;
+    if ((cached->samples + frame_samples - 1) / frame_samples > audio_overlay_queue_.Space()) {
+        /* The decoder task plays it from the cache once there is room */
+        return false;
+    }
+
+    int64_t now = esp_timer_get_time();
+    for (size_t offset = 0; offset < cached->samples; offset += frame_samples) {
+        auto task = NewAudioTask(kAudioTaskTypeDecodeToPlaybackQueue);
+        const int16_t* begin = cached->pcm + offset;
+        task->pcm.assign(begin, begin + std::min(frame_samples, cached->samples - offset));
+        task->stage_time = now;
+        audio_overlay_queue_.Push(std::move(task));
+    }
+    return true;
+}
+
+bool AudioService::DecodeSoundPacket(const OggOpusPacket& packet, std::vector<int16_t>& output) {
+    int sample_rate = sound_demuxer_->input_sample_rate();
+    if (sample_rate != 8000 && sample_rate != 12000 && sample_rate != 16000 &&
+        sample_rate != 24000 && sample_rate != 48000) {
+        sample_rate = 48000;
+    }
+    int frame_duration = packet.samples / 48;
+    if (sound_decoder_ == nullptr || sound_decoder_->sample_rate() != sample_rate ||
+        sound_decoder_->duration_ms() != frame_duration) {
+        sound_decoder_ = std::make_unique<OpusDecoderWrapper>(sample_rate, 1, frame_duration);
+        /* A sound that cannot be resampled is skipped rather than played at the wrong speed */
+        if (sample_rate != codec_->output_sample_rate() &&
+            !sound_resampler_.Configure(sample_rate, codec_->output_sample_rate())) {
+            sound_decoder_.reset();
+            return false;
+        }
+    }
+
+    // The demuxer hands out views into the sound in flash, the decoder takes a vector
+    sound_payload_.assign(packet.data, packet.data + packet.size);
+    bool resample = sample_rate != codec_->output_sample_rate();
+    auto& pcm = resample ? decode_buffer_ : output;
+    if (!sound_decoder_->Decode(std::move(sound_payload_), pcm)) {
+        return false;
+    }
+
+    // Drop the pre-skip and the end trim, they are counted at 48 kHz
+    size_t front = std::min(pcm.size(), (size_t)packet.trim_start * sample_rate / 48000);
+    size_t back = std::min(pcm.size() - front, (size_t)packet.trim_end * sample_rate / 48000);
+    pcm.resize(pcm.size() - back);
+    pcm.erase(pcm.begin(), pcm.begin() + front);
+
+    if (resample) {
+        output.resize(sound_resampler_.GetOutputSamples(pcm.size()));
+        if (!pcm.empty()) {
+            sound_resampler_.Process(pcm.data(), pcm.size(), output.data());
+        }
+    }
+    debug_statistics_.decode_count++;
+    return true;
+}
+
+void AudioService::FinishSound() {
+    if (sound_demuxer_->crc_errors() > 0) {
+        ESP_LOGW(TAG, "Sound has %lu corrupted pages", sound_demuxer_->crc_errors());
+    }
+    if (sound_fill_) {
+        sound_cache_.Insert(current_sound_.data(), codec_->output_sample_rate(), sound_fill_buffer_.data(), sound_fill_buffer_.size());
+    }
+    sound_fill_ = false;
+    std::vector<int16_t>().swap(sound_fill_buffer_);
+    sound_demuxer_.reset();
+    std::lock_guard<std::mutex> lock(sound_mutex_);
+    sound_busy_ = false;
 }
 
 void AudioService::SetDecodeSampleRate(int sample_rate, int frame_duration) {
@@ -397,59 +787,120 @@ void AudioService::SetDecodeSampleRate(int sample_rate, int frame_duration) {
 
     opus_decoder_.reset();
     opus_decoder_ = std::make_unique<OpusDecoderWrapper>(sample_rate, 1, frame_duration);
+    if (frame_duration > 0) {
+        audio_decode_queue_.SetCapacity(MAX_DECODE_DURATION_MS / frame_duration);
+        audio_playback_queue_.SetCapacity(MAX_PLAYBACK_DURATION_MS / frame_duration);
+    }
 
-    auto codec = Board::GetInstance().GetAudioCodec();
-    if (opus_decoder_->sample_rate() != codec->output_sample_rate()) {
-        ESP_LOGI(TAG, "Resampling audio from %d to %d", opus_decoder_->sample_rate(), codec->output_sample_rate());
-        output_resampler_.Configure(opus_decoder_->sample_rate(), codec->output_sample_rate());
+    if (opus_decoder_->sample_rate() != codec_->output_sample_rate()) {
+        ESP_LOGI(TAG, "Resampling audio from %d to %d", opus_decoder_->sample_rate(), codec_->output_sample_rate());
+        if (!output_resampler_.Configure(opus_decoder_->sample_rate(), codec_->output_sample_rate())) {
+            ESP_LOGE(TAG, "Cannot resample from %d to %d, the downlink is played as it is",
+                opus_decoder_->sample_rate(), codec_->output_sample_rate());
+        }
     }
 }
 
 void AudioService::PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm) {
-    auto task = std::make_unique<AudioTask>();
-    task->type = type;
-    task->pcm = std::move(pcm);
-    
-    /* Push the task to the encode queue */
-    std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-
-    /* If the task is to send queue, we need to set the timestamp */
-    if (type == kAudioTaskTypeEncodeToSendQueue && !timestamp_queue_.empty()) {
-        if (timestamp_queue_.size() <= MAX_TIMESTAMPS_IN_QUEUE) {
-            task->timestamp = timestamp_queue_.front();
-        } else {
-            ESP_LOGW(TAG, "Timestamp queue (%u) is full, dropping timestamp", timestamp_queue_.size());
+    auto task = NewAudioTask(type);
+    /* Swap instead of move, so the producer gets the recycled buffer of the task back */
+    task->pcm.swap(pcm);
+
+    /* If the task is to send queue, we need to set the timestamp and the capture time */
+    if (type == kAudioTaskTypeEncodeToSendQueue) {
+        auto& tracer = AudioLatencyTracer::GetInstance();
+        task->origin_time = tracer.TakeCaptureTime(task->pcm.size());
+        task->stage_time = esp_timer_get_time();
+        tracer.Record(kAudioLatencyProcess, task->origin_time, task->stage_time);
+
+        std::lock_guard<std::mutex> lock(timestamp_mutex_);
+        if (!timestamp_queue_.empty()) {
+            if (timestamp_queue_.size() <= MAX_TIMESTAMPS_IN_QUEUE) {
+                task->timestamp = timestamp_queue_.front();
+            } else {
+                ESP_LOGW(TAG, "Timestamp queue (%u) is full, dropping timestamp", timestamp_queue_.size());
+            }
+            timestamp_queue_.pop_front();
         }
-        timestamp_queue_.pop_front();
     }
 
-    audio_queue_cv_.wait(lock, [this]() { return audio_encode_queue_.size() < MAX_ENCODE_TASKS_IN_QUEUE; });
-    audio_encode_queue_.push_back(std::move(task));
-    audio_queue_cv_.notify_all();
+    if (type == kAudioTaskTypeEncodeToSendQueue && UPLINK_DTX_KEEPALIVE_MS > 0 && SuppressUplinkFrame(task)) {
+        return;
+    }
+    PushEncodeTask(task);
 }
 
-bool AudioService::PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet, bool wait) {
-    std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-    if (audio_decode_queue_.size() >= MAX_DECODE_PACKETS_IN_QUEUE) {
-        if (wait) {
-            audio_queue_cv_.wait(lock, [this]() { return audio_decode_queue_.size() < MAX_DECODE_PACKETS_IN_QUEUE; });
-        } else {
+bool AudioService::PushEncodeTask(std::unique_ptr<AudioTask>& task) {
+    /* Push the task to the encode queue, wait for the encoder task if it is full */
+    while (audio_encode_queue_.Full()) {
+        if (service_stopped_) {
             return false;
         }
+        audio_encode_queue_.WaitForSpace(pdMS_TO_TICKS(encode_frame_duration_));
     }
-    audio_decode_queue_.push_back(std::move(packet));
-    audio_queue_cv_.notify_all();
+    audio_encode_queue_.Push(std::move(task));
     return true;
 }
 
-std::unique_ptr<AudioStreamPacket> AudioService::PopPacketFromSendQueue() {
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    if (audio_send_queue_.empty()) {
-        return nullptr;
+bool AudioService::SuppressUplinkFrame(std::unique_ptr<AudioTask>& task) {
+    /* A new listening session starts with a keepalive frame, the frames held from the last one are dropped */
+    if (dtx_reset_.exchange(false)) {
+        dtx_held_tasks_.clear();
+        dtx_silence_ms_ = UPLINK_DTX_KEEPALIVE_MS;
+    }
+
+    if (voice_detected_) {
+        /* Speech started, the held frames go out before this one */
+        dtx_silence_ms_ = 0;
+        while (!dtx_held_tasks_.empty()) {
+            auto held = std::move(dtx_held_tasks_.front());
+            dtx_held_tasks_.pop_front();
+            if (!PushEncodeTask(held)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /* Hold the frame back, the oldest held frame is either dropped or sent as a keepalive */
+    int frame_ms = task->pcm.size() / 16;
+    dtx_held_tasks_.push_back(std::move(task));
+    if ((int)dtx_held_tasks_.size() * frame_ms <= UPLINK_DTX_PREROLL_MS) {
+        return true;
+    }
+    task = std::move(dtx_held_tasks_.front());
+    dtx_held_tasks_.pop_front();
+    dtx_silence_ms_ += frame_ms;
+    if (dtx_silence_ms_ < UPLINK_DTX_KEEPALIVE_MS) {
+        uplink_dtx_statistics_.suppressed_frames++;
+        return true;
+    }
+    dtx_silence_ms_ = 0;
+    return false;
+}
+
+void AudioService::LogUplinkDtxStatistics() {
+    auto& dtx = uplink_dtx_statistics_;
+    uint32_t saved_bytes = 0;
+    if (dtx.silence_packets > 0) {
+        saved_bytes = (uint64_t)dtx.suppressed_frames * dtx.silence_bytes / dtx.silence_packets;
+    }
+    ESP_LOGI(TAG, "Uplink DTX: sent %lu frames (%lu bytes), suppressed %lu frames (about %lu bytes)",
+        dtx.sent_frames, dtx.sent_bytes, dtx.suppressed_frames, saved_bytes);
+}
+
+bool AudioService::PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet) {
+    std::lock_guard<std::mutex> lock(decode_producer_mutex_);
+    if (!audio_decode_queue_.Push(std::move(packet))) {
+        debug_statistics_.decode_drop_count++;
+        return false;
     }
-    auto packet = std::move(audio_send_queue_.front());
-    audio_send_queue_.pop_front();
-    audio_queue_cv_.notify_all();
+    return true;
+}
+
+std::unique_ptr<AudioStreamPacket> AudioService::PopPacketFromSendQueue() {
+    std::unique_ptr<AudioStreamPacket> packet;
+    audio_send_queue_.Pop(packet);
     return packet;
 }
 
@@ -464,8 +915,9 @@ const std::string& AudioService::GetLastWakeWord() const {
 }
 
 std::unique_ptr<AudioStreamPacket> AudioService::PopWakeWordPacket() {
-    auto packet = std::make_unique<AudioStreamPacket>();
+    auto packet = NewAudioStreamPacket();
     if (wake_word_->GetWakeWordOpus(packet->payload)) {
+        packet->headroom = AUDIO_PACKET_HEADROOM;
         return packet;
     }
     return nullptr;
@@ -497,38 +949,109 @@ void AudioService::EnableVoiceProcessing(bool enable) {
     ESP_LOGD(TAG, "%s voice processing", enable ? "Enabling" : "Disabling");
     if (enable) {
         if (!audio_processor_initialized_) {
-            audio_processor_->Initialize(codec_, OPUS_FRAME_DURATION_MS, models_list_);
+            audio_processor_->Initialize(codec_, encode_frame_duration_, models_list_);
             audio_processor_initialized_ = true;
         }
 
         /* We should make sure no audio is playing */
         ResetDecoder();
         audio_input_need_warmup_ = true;
+        AudioLatencyTracer::GetInstance().ResetCapture();
+        /* The frame producer resets its DTX state before the first frame of the session */
+        dtx_reset_ = true;
+        uplink_dtx_statistics_ = UplinkDtxStatistics();
         audio_processor_->Start();
         xEventGroupSetBits(event_group_, AS_EVENT_AUDIO_PROCESSOR_RUNNING);
     } else {
         audio_processor_->Stop();
         xEventGroupClearBits(event_group_, AS_EVENT_AUDIO_PROCESSOR_RUNNING);
+        if (UPLINK_DTX_KEEPALIVE_MS > 0) {
+            LogUplinkDtxStatistics();
+        }
     }
 }
 
 void AudioService::EnableAudioTesting(bool enable) {
     ESP_LOGI(TAG, "%s audio testing", enable ? "Enabling" : "Disabling");
     if (enable) {
+        audio_testing_playback_ = false;
+        audio_testing_queue_.Clear();
         xEventGroupSetBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING);
     } else {
         xEventGroupClearBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING);
-        /* Copy audio_testing_queue_ to audio_decode_queue_ */
-        std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-        audio_decode_queue_ = std::move(audio_testing_queue_);
-        audio_queue_cv_.notify_all();
+        /* Let the decoder task play back audio_testing_queue_ */
+        audio_testing_playback_ = true;
+        if (opus_decoder_task_handle_ != nullptr) {
+            xTaskNotifyGive(opus_decoder_task_handle_);
+        }
+    }
+}
+
+bool AudioService::MeasureRoundTripLatency(RoundTripLatency& result) {
+    std::unique_lock<std::mutex> lock(latency_probe_mutex_, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        ESP_LOGW(TAG, "Latency measurement already running");
+        return false;
+    }
+    EventBits_t bits = xEventGroupGetBits(event_group_);
+    if (service_stopped_ || (bits & (AS_EVENT_AUDIO_TESTING_RUNNING | AS_EVENT_AUDIO_PROCESSOR_RUNNING)) || !IsIdle()) {
+        ESP_LOGW(TAG, "Audio is busy, cannot measure the latency");
+        return false;
+    }
+
+    ESP_LOGI(TAG, "Measuring round-trip latency");
+    latency_probe_.Begin(codec_->output_sample_rate(), 16000);
+    xEventGroupClearBits(event_group_, AS_EVENT_LATENCY_PROBE_DONE);
+    xEventGroupSetBits(event_group_, AS_EVENT_LATENCY_PROBE_RUNNING);
+    latency_probe_pending_ = true;
+    xTaskNotifyGive(opus_decoder_task_handle_);
+
+    bits = xEventGroupWaitBits(event_group_, AS_EVENT_LATENCY_PROBE_DONE, pdTRUE, pdFALSE,
+        pdMS_TO_TICKS(LATENCY_PROBE_CAPTURE_MS + 1000));
+    if (!(bits & AS_EVENT_LATENCY_PROBE_DONE)) {
+        /*
+         * The input task may be inside Capture(), so the probe is only released once it has
+         * acknowledged the stop. If the service stops meanwhile, the buffers are kept until the
+         * next Begin()
+         */
+        latency_probe_pending_ = false;
+        xEventGroupClearBits(event_group_, AS_EVENT_LATENCY_PROBE_RUNNING | AS_EVENT_LATENCY_PROBE_STOPPED);
+        xEventGroupSetBits(event_group_, AS_EVENT_LATENCY_PROBE_STOP);
+        while (!service_stopped_) {
+            /* A capture that completed right at the timeout leaves DONE set, it is cleared here too */
+            bits = xEventGroupWaitBits(event_group_, AS_EVENT_LATENCY_PROBE_STOPPED | AS_EVENT_LATENCY_PROBE_DONE,
+                pdTRUE, pdFALSE, pdMS_TO_TICKS(100));
+            if (bits & AS_EVENT_LATENCY_PROBE_STOPPED) {
+                latency_probe_.End();
+                break;
+            }
+        }
+        ESP_LOGW(TAG, "Latency measurement timed out");
+        return false;
+    }
+
+    result = RoundTripLatency();
+    bool found = latency_probe_.Analyze(result);
+    int64_t playback_time = latency_probe_.playback_time();
+    latency_probe_.End();
+    if (!found) {
+        return false;
     }
+    result.output_dma_us = AUDIO_CODEC_DMA_DESC_NUM * AUDIO_CODEC_DMA_FRAME_NUM * 1000000LL / codec_->output_sample_rate();
+    result.input_dma_us = AUDIO_CODEC_DMA_DESC_NUM * AUDIO_CODEC_DMA_FRAME_NUM * 1000000LL / codec_->input_sample_rate();
+    if (codec_->input_sample_rate() != 16000) {
+        result.resampler_us = input_resampler_.delay_us();
+    }
+    AudioLatencyTracer::GetInstance().Record(kAudioLatencyRoundTrip, playback_time, playback_time + result.latency_us);
+    ESP_LOGI(TAG, "Round-trip latency %d us (output DMA %d us, input DMA %d us, resampler %d us), correlation %d / 1000",
+        result.latency_us, result.output_dma_us, result.input_dma_us, result.resampler_us, result.correlation);
+    return true;
 }
 
 void AudioService::EnableDeviceAec(bool enable) {
     ESP_LOGI(TAG, "%s device AEC", enable ? "Enabling" : "Disabling");
     if (!audio_processor_initialized_) {
-        audio_processor_->Initialize(codec_, OPUS_FRAME_DURATION_MS, models_list_);
+        audio_processor_->Initialize(codec_, encode_frame_duration_, models_list_);
         audio_processor_initialized_ = true;
     }
 
@@ -546,111 +1069,56 @@ void AudioService::PlaySound(const std::string_view& ogg) {
         codec_->EnableOutput(true);
     }
 
-    const uint8_t* buf = reinterpret_cast<const uint8_t*>(ogg.data());
-    size_t size = ogg.size();
-    size_t offset = 0;
-
-    auto find_page = [&](size_t start)->size_t {
-        for (size_t i = start; i + 4 <= size; ++i) {
-            if (buf[i] == 'O' && buf[i+1] == 'g' && buf[i+2] == 'g' && buf[i+3] == 'S') return i;
-        }
-        return static_cast<size_t>(-1);
-    };
-
-    bool seen_head = false;
-    bool seen_tags = false;
-    int sample_rate = 16000; // 默认值
-
-    while (true) {
-        size_t pos = find_page(offset);
-        if (pos == static_cast<size_t>(-1)) break;
-        offset = pos;
-        if (offset + 27 > size) break;
-
-        const uint8_t* page = buf + offset;
-        uint8_t page_segments = page[26];
-        size_t seg_table_off = offset + 27;
-        if (seg_table_off + page_segments > size) break;
-
-        size_t body_size = 0;
-        for (size_t i = 0; i < page_segments; ++i) body_size += page[27 + i];
-
-        size_t body_off = seg_table_off + page_segments;
-        if (body_off + body_size > size) break;
-
-        // Parse packets using lacing
-        size_t cur = body_off;
-        size_t seg_idx = 0;
-        while (seg_idx < page_segments) {
-            size_t pkt_len = 0;
-            size_t pkt_start = cur;
-            bool continued = false;
-            do {
-                uint8_t l = page[27 + seg_idx++];
-                pkt_len += l;
-                cur += l;
-                continued = (l == 255);
-            } while (continued && seg_idx < page_segments);
-
-            if (pkt_len == 0) continue;
-            const uint8_t* pkt_ptr = buf + pkt_start;
-
-            if (!seen_head) {
-                // 解析OpusHead包
-                if (pkt_len >= 19 && std::memcmp(pkt_ptr, "OpusHead", 8) == 0) {
-                    seen_head = true;
-                    
-                    // OpusHead结构：[0-7] "OpusHead", [8] version, [9] channel_count, [10-11] pre_skip
-                    // [12-15] input_sample_rate, [16-17] output_gain, [18] mapping_family
-                    if (pkt_len >= 12) {
-                        uint8_t version = pkt_ptr[8];
-                        uint8_t channel_count = pkt_ptr[9];
-                        
-                        if (pkt_len >= 16) {
-                            // 读取输入采样率 (little-endian)
-                            sample_rate = pkt_ptr[12] | (pkt_ptr[13] << 8) | 
-                                        (pkt_ptr[14] << 16) | (pkt_ptr[15] << 24);
-                            ESP_LOGI(TAG, "OpusHead: version=%d, channels=%d, sample_rate=%d", 
-                                   version, channel_count, sample_rate);
-                        }
-                    }
-                }
-                continue;
-            }
-            if (!seen_tags) {
-                // Expect OpusTags in second packet
-                if (pkt_len >= 8 && std::memcmp(pkt_ptr, "OpusTags", 8) == 0) {
-                    seen_tags = true;
-                }
-                continue;
-            }
-
-            // Audio packet (Opus)
-            auto packet = std::make_unique<AudioStreamPacket>();
-            packet->sample_rate = sample_rate;
-            packet->frame_duration = 60;
-            packet->payload.resize(pkt_len);
-            std::memcpy(packet->payload.data(), pkt_ptr, pkt_len);
-            PushPacketToDecodeQueue(std::move(packet), true);
-        }
-
-        offset = body_off + body_size;
+    std::lock_guard<std::mutex> lock(sound_mutex_);
+    if (PushCachedSound(ogg)) {
+        return;
+    }
+    /* The decoder task demuxes the sound, so the Opus packets are never copied out of flash up front */
+    std::string_view sound = ogg;
+    if (!audio_sound_queue_.Push(std::move(sound))) {
+        ESP_LOGW(TAG, "Sound queue is full, dropping sound");
     }
 }
 
 bool AudioService::IsIdle() {
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    return audio_encode_queue_.empty() && audio_decode_queue_.empty() && audio_playback_queue_.empty() && audio_testing_queue_.empty();
+    return audio_encode_queue_.Empty() && audio_decode_queue_.Empty() && jitter_buffer_.Empty() &&
+        audio_playback_queue_.Empty() && audio_testing_queue_.Empty() &&
+        audio_sound_queue_.Empty() && audio_overlay_queue_.Empty() && !sound_playing_;
 }
 
 void AudioService::ResetDecoder() {
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    opus_decoder_->ResetState();
-    timestamp_queue_.clear();
-    audio_decode_queue_.clear();
-    audio_playback_queue_.clear();
-    audio_testing_queue_.clear();
-    audio_queue_cv_.notify_all();
+    decoder_reset_pending_ = true;
+    {
+        std::lock_guard<std::mutex> lock(timestamp_mutex_);
+        timestamp_queue_.clear();
+    }
+    audio_decode_queue_.Clear();
+    audio_playback_queue_.Clear();
+    audio_testing_queue_.Clear();
+}
+
+void AudioService::SetEncodeFrameDuration(int frame_duration) {
+    if (frame_duration != 20 && frame_duration != 40 && frame_duration != 60) {
+        ESP_LOGW(TAG, "Unsupported frame duration %d ms, keep %d ms", frame_duration, encode_frame_duration_.load());
+        return;
+    }
+    if (frame_duration < OPUS_MIN_ENCODE_FRAME_DURATION_MS) {
+        ESP_LOGW(TAG, "Frame duration %d ms is too short for this chip, use %d ms", frame_duration,
+            OPUS_MIN_ENCODE_FRAME_DURATION_MS);
+        frame_duration = OPUS_MIN_ENCODE_FRAME_DURATION_MS;
+    }
+    if (frame_duration == encode_frame_duration_) {
+        return;
+    }
+
+    ESP_LOGI(TAG, "Set encode frame duration to %d ms", frame_duration);
+    encode_frame_duration_ = frame_duration;
+    audio_encode_queue_.SetCapacity(MAX_ENCODE_DURATION_MS / frame_duration);
+    audio_send_queue_.SetCapacity(MAX_SEND_DURATION_MS / frame_duration);
+    audio_testing_queue_.SetCapacity(AUDIO_TESTING_MAX_DURATION_MS / frame_duration);
+    if (audio_processor_initialized_) {
+        audio_processor_->SetFrameDuration(frame_duration);
+    }
 }
 
 void AudioService::CheckAndUpdateAudioPowerState() {
@@ -670,4 +1138,66 @@ void AudioService::CheckAndUpdateAudioPowerState() {
 
 void AudioService::SetModelsList(srmodel_list_t* models_list) {
     models_list_ = models_list;
-}
\ No newline at end of file
+}
+
+AudioPipelineStatistics AudioService::GetPipelineStatistics() const {
+    AudioPipelineStatistics stats;
+    stats.debug = debug_statistics_;
+    stats.jitter = jitter_buffer_.GetStats();
+    stats.encode_queue = { audio_encode_queue_.high_water(), audio_encode_queue_.capacity() };
+    stats.send_queue = { audio_send_queue_.high_water(), audio_send_queue_.capacity() };
+    stats.testing_queue = { audio_testing_queue_.high_water(), audio_testing_queue_.capacity() };
+    stats.decode_queue = { audio_decode_queue_.high_water(), audio_decode_queue_.capacity() };
+    stats.playback_queue = { audio_playback_queue_.high_water(), audio_playback_queue_.capacity() };
+    return stats;
+}
+
+void AudioService::PrintStatistics() {
+    auto& packet_pool = GetPacketPool();
+    auto& task_pool = GetTaskPool();
+    ESP_LOGI(TAG, "Packet pool: %u/%u free, hits %lu, misses %lu; task pool: %u/%u free, hits %lu, misses %lu",
+        packet_pool.available(), packet_pool.capacity(), packet_pool.hits(), packet_pool.misses(),
+        task_pool.available(), task_pool.capacity(), task_pool.hits(), task_pool.misses());
+
+    auto jitter = jitter_buffer_.GetStats();
+    ESP_LOGI(TAG, "Jitter buffer: depth %lu/%lu, jitter %lu ms, late %lu, concealed %lu, lost %lu, underruns %lu",
+        jitter.depth, jitter.target_depth, jitter.jitter_ms, jitter.late_packets,
+        jitter.concealed_frames, jitter.lost_packets, jitter.underruns);
+
+    ESP_LOGI(TAG, "Queue high water: encode %u/%u, send %u/%u, decode %u/%u, playback %u/%u; decode drops %lu",
+        audio_encode_queue_.high_water(), audio_encode_queue_.capacity(),
+        audio_send_queue_.high_water(), audio_send_queue_.capacity(),
+        audio_decode_queue_.high_water(), audio_decode_queue_.capacity(),
+        audio_playback_queue_.high_water(), audio_playback_queue_.capacity(),
+        debug_statistics_.decode_drop_count.load());
+
+    AudioLatencyTracer::GetInstance().PrintReport();
+
+    if (SOUND_CACHE_MAX_BYTES > 0) {
+        ESP_LOGI(TAG, "Sound cache: %u / %u bytes", sound_cache_.bytes(), sound_cache_.max_bytes());
+    }
+
+    // The peaks are taken and reset in one step, the codec tasks may be adding a frame right now
+    uint32_t encode_max_us = debug_statistics_.encode_timing.max_us.exchange(0);
+    uint32_t decode_max_us = debug_statistics_.decode_timing.max_us.exchange(0);
+    CodecTimingStatistics encode = debug_statistics_.encode_timing;
+    CodecTimingStatistics decode = debug_statistics_.decode_timing;
+    UBaseType_t encoder_stack_free = 0;
+    UBaseType_t decoder_stack_free = 0;
+    if (!service_stopped_) {
+        encoder_stack_free = uxTaskGetStackHighWaterMark(opus_encoder_task_handle_);
+        decoder_stack_free = uxTaskGetStackHighWaterMark(opus_decoder_task_handle_);
+    }
+    ESP_LOGI(TAG, "Opus encoder: avg %lu us, max %lu us, stack free %u; decoder: avg %lu us, max %lu us, stack free %u",
+        encode.frames > 0 ? (uint32_t)(encode.total_us / encode.frames) : 0, encode_max_us, encoder_stack_free,
+        decode.frames > 0 ? (uint32_t)(decode.total_us / decode.frames) : 0, decode_max_us, decoder_stack_free);
+
+    OpusEncoderGovernorStats governor;
+    {
+        std::lock_guard<std::mutex> lock(encoder_governor_mutex_);
+        governor = encoder_governor_stats_;
+    }
+    ESP_LOGI(TAG, "Opus encoder complexity %d/%d, bitrate %d/%d, last window p50 %lu us, p95 %lu us, max %lu us",
+        governor.complexity, governor.max_complexity, governor.bitrate, governor.max_bitrate,
+        governor.p50_us, governor.p95_us, governor.max_us);
+}
@@ -3,7 +3,7 @@
 
 #include <memory>
 #include <deque>
-#include <condition_variable>
+#include <atomic>
 #include <chrono>
 #include <mutex>
 
@@ -13,12 +13,21 @@
 #include <esp_timer.h>
 #include <model_path.h>
 
-#include <opus_encoder.h>
 #include <opus_decoder.h>
-#include <opus_resampler.h>
 
 #include "audio_codec.h"
 #include "audio_processor.h"
+#include "audio_queue.h"
+#include "audio_pool.h"
+#include "polyphase_resampler.h"
+#include "opus_frame_encoder.h"
+#include "jitter_buffer.h"
+#include "sound_cache.h"
+#include "audio_mixer.h"
+#include "ogg_demuxer.h"
+#include "opus_encoder_governor.h"
+#include "audio_latency_tracer.h"
+#include "latency_probe.h"
 #include "processors/audio_debugger.h"
 #include "wake_word.h"
 #include "protocol.h"
@@ -27,21 +36,80 @@
 /*
  * There are two types of audio data flow:
  * 1. (MIC) -> [Processors] -> {Encode Queue} -> [Opus Encoder] -> {Send Queue} -> (Server)
- * 2. (Server) -> {Decode Queue} -> [Opus Decoder] -> {Playback Queue} -> (Speaker)
+ * 2. (Server) -> {Decode Queue} -> [Jitter Buffer] -> [Opus Decoder] -> {Playback Queue} -> [Mixer] -> (Speaker)
+ *    (PlaySound) -> {Sound Queue} -> [Opus Decoder] -> {Overlay Queue} -> [Mixer]
+ *    (PlaySound) -> [Sound Cache] -> {Overlay Queue} -> [Mixer]
  *
- * We use one task for MIC / Speaker / Processors, and one task for Opus Encoder / Opus Decoder.
+ * We use one task for MIC / Speaker / Processors, one task for Opus Encoder and one task for Opus Decoder,
+ * so a slow decode (with resampling) never delays the uplink encode, and vice versa.
  * 
  * Decode Queue and Send Queue are the main queues, because Opus packets are quite smaller than PCM packets.
  * 
+ * Every queue is a bounded SPSC ring (AudioQueue) that wakes only the task waiting on it, so the
+ * input, output and codec tasks never contend on a shared lock.
  */
 
+// Preferred uplink frame duration, the server may choose another one in its hello
+#ifdef CONFIG_OPUS_FRAME_DURATION_MS
+#define OPUS_FRAME_DURATION_MS CONFIG_OPUS_FRAME_DURATION_MS
+#else
 #define OPUS_FRAME_DURATION_MS 60
-#define MAX_ENCODE_TASKS_IN_QUEUE 2
-#define MAX_PLAYBACK_TASKS_IN_QUEUE 2
-#define MAX_DECODE_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
-#define MAX_SEND_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
+#endif
+#define OPUS_MIN_FRAME_DURATION_MS 20
+// Shortest uplink frame the chip encodes in realtime, like the choices of CONFIG_OPUS_FRAME_DURATION_MS
+#if CONFIG_IDF_TARGET_ESP32S3 || CONFIG_IDF_TARGET_ESP32P4
+#define OPUS_MIN_ENCODE_FRAME_DURATION_MS 20
+#else
+#define OPUS_MIN_ENCODE_FRAME_DURATION_MS 60
+#endif
+// Queue depths are given in milliseconds, the packet limits follow the frame duration in use
+#define MAX_ENCODE_DURATION_MS 120
+#define MAX_PLAYBACK_DURATION_MS 120
+#define MAX_DECODE_DURATION_MS 2400
+#define MAX_SEND_DURATION_MS 2400
 #define AUDIO_TESTING_MAX_DURATION_MS 10000
+#define MAX_ENCODE_TASKS_IN_QUEUE (MAX_ENCODE_DURATION_MS / OPUS_MIN_FRAME_DURATION_MS)
+#define MAX_PLAYBACK_TASKS_IN_QUEUE (MAX_PLAYBACK_DURATION_MS / OPUS_MIN_FRAME_DURATION_MS)
+#define MAX_DECODE_PACKETS_IN_QUEUE (MAX_DECODE_DURATION_MS / OPUS_MIN_FRAME_DURATION_MS)
+#define MAX_SEND_PACKETS_IN_QUEUE (MAX_SEND_DURATION_MS / OPUS_MIN_FRAME_DURATION_MS)
+#define MAX_TESTING_PACKETS_IN_QUEUE (AUDIO_TESTING_MAX_DURATION_MS / OPUS_MIN_FRAME_DURATION_MS)
+#define MAX_SOUNDS_IN_QUEUE 16
 #define MAX_TIMESTAMPS_IN_QUEUE 3
+// Pool sizes cover full queues at the preferred frame duration, plus the frames being processed by the tasks
+#define AUDIO_PACKET_POOL_SIZE ((MAX_DECODE_DURATION_MS + MAX_SEND_DURATION_MS) / OPUS_FRAME_DURATION_MS + 4)
+#define AUDIO_TASK_POOL_SIZE ((MAX_ENCODE_DURATION_MS + 2 * MAX_PLAYBACK_DURATION_MS) / OPUS_FRAME_DURATION_MS + 4)
+
+// Decoded system sounds kept for PlaySound(), 0 disables the cache
+#ifdef CONFIG_SOUND_CACHE_SIZE_KB
+#define SOUND_CACHE_MAX_BYTES (CONFIG_SOUND_CACHE_SIZE_KB * 1024)
+#else
+#define SOUND_CACHE_MAX_BYTES 0
+#endif
+// While a sound plays over the reply, the reply is lowered to this Q15 gain (about -12 dB)
+#define AUDIO_VOICE_DUCK_GAIN 8192
+
+// Uplink DTX: while no voice is detected only one frame per keepalive interval is sent, 0 disables DTX.
+// The last frames before the voice onset are held back and sent with it, so the VAD delay does not clip speech
+#ifdef CONFIG_UPLINK_DTX_KEEPALIVE_MS
+#define UPLINK_DTX_KEEPALIVE_MS CONFIG_UPLINK_DTX_KEEPALIVE_MS
+#else
+#define UPLINK_DTX_KEEPALIVE_MS 0
+#endif
+#define UPLINK_DTX_PREROLL_MS 180
+
+// PrintStatistics() reports the stack high water marks of the codec tasks
+#define OPUS_ENCODER_TASK_STACK_SIZE (2048 * 12)
+#define OPUS_DECODER_TASK_STACK_SIZE (2048 * 8)
+#if defined(CONFIG_OPUS_ENCODER_TASK_CORE) && CONFIG_OPUS_ENCODER_TASK_CORE >= 0
+#define OPUS_ENCODER_TASK_CORE CONFIG_OPUS_ENCODER_TASK_CORE
+#else
+#define OPUS_ENCODER_TASK_CORE tskNO_AFFINITY
+#endif
+#if defined(CONFIG_OPUS_DECODER_TASK_CORE) && CONFIG_OPUS_DECODER_TASK_CORE >= 0
+#define OPUS_DECODER_TASK_CORE CONFIG_OPUS_DECODER_TASK_CORE
+#else
+#define OPUS_DECODER_TASK_CORE tskNO_AFFINITY
+#endif
 
 #define AUDIO_POWER_TIMEOUT_MS 15000
 #define AUDIO_POWER_CHECK_INTERVAL_MS 1000
@@ -51,6 +119,11 @@
 #define AS_EVENT_WAKE_WORD_RUNNING          (1 << 1)
 #define AS_EVENT_AUDIO_PROCESSOR_RUNNING    (1 << 2)
 #define AS_EVENT_PLAYBACK_NOT_EMPTY         (1 << 3)
+#define AS_EVENT_LATENCY_PROBE_RUNNING      (1 << 4)
+#define AS_EVENT_LATENCY_PROBE_DONE         (1 << 5)
+// A timed out measurement asks the input task to stop capturing and waits for the acknowledgement
+#define AS_EVENT_LATENCY_PROBE_STOP         (1 << 6)
+#define AS_EVENT_LATENCY_PROBE_STOPPED      (1 << 7)
 
 struct AudioServiceCallbacks {
     std::function<void(void)> on_send_queue_available;
@@ -64,19 +137,107 @@ enum AudioTaskType {
     kAudioTaskTypeEncodeToSendQueue,
     kAudioTaskTypeEncodeToTestingQueue,
     kAudioTaskTypeDecodeToPlaybackQueue,
+    kAudioTaskTypeLatencyProbe,
 };
 
 struct AudioTask {
     AudioTaskType type;
     std::vector<int16_t> pcm;
-    uint32_t timestamp;
+    uint32_t timestamp = 0;
+    int64_t origin_time = 0;    // Same as AudioStreamPacket, for the latency tracer
+    int64_t stage_time = 0;
+
+    // Called when the task goes back to the pool, the PCM buffer keeps its capacity
+    void Reset() {
+        pcm.clear();
+        timestamp = 0;
+        origin_time = 0;
+        stage_time = 0;
+    }
+};
+
+// Like AudioStreamPacket, AudioTask objects are recycled through a fixed-capacity pool
+namespace std {
+template <>
+struct default_delete<AudioTask> {
+    void operator()(AudioTask* task) const;
+};
+}
+
+// Processing time of one codec direction, written by its codec task. PrintStatistics() reads it from
+// another task and takes max_us with exchange(0), so a new peak is never lost. A copy is a snapshot
+struct CodecTimingStatistics {
+    std::atomic<uint32_t> frames = 0;
+    std::atomic<uint64_t> total_us = 0;
+    std::atomic<uint32_t> max_us = 0;
+
+    CodecTimingStatistics() = default;
+    CodecTimingStatistics(const CodecTimingStatistics& other) { *this = other; }
+    CodecTimingStatistics& operator=(const CodecTimingStatistics& other) {
+        frames = other.frames.load();
+        total_us = other.total_us.load();
+        max_us = other.max_us.load();
+        return *this;
+    }
+
+    void Add(uint32_t us) {
+        frames++;
+        total_us += us;
+        uint32_t max = max_us.load();
+        while (us > max && !max_us.compare_exchange_weak(max, us)) {
+        }
+    }
 };
 
+// Each counter is written by one task and read by PrintStatistics() from another. A copy is a snapshot
 struct DebugStatistics {
-    uint32_t input_count = 0;
-    uint32_t decode_count = 0;
-    uint32_t encode_count = 0;
-    uint32_t playback_count = 0;
+    std::atomic<uint32_t> input_count = 0;
+    std::atomic<uint32_t> decode_count = 0;
+    std::atomic<uint32_t> encode_count = 0;
+    std::atomic<uint32_t> playback_count = 0;
+    std::atomic<uint32_t> decode_drop_count = 0;     // Packets dropped because the decode queue was full
+    CodecTimingStatistics encode_timing;
+    CodecTimingStatistics decode_timing;
+
+    DebugStatistics() = default;
+    DebugStatistics(const DebugStatistics& other) { *this = other; }
+    DebugStatistics& operator=(const DebugStatistics& other) {
+        input_count = other.input_count.load();
+        decode_count = other.decode_count.load();
+        encode_count = other.encode_count.load();
+        playback_count = other.playback_count.load();
+        decode_drop_count = other.decode_drop_count.load();
+        encode_timing = other.encode_timing;
+        decode_timing = other.decode_timing;
+        return *this;
+    }
+};
+
+// Uplink DTX counters of the current listening session
+struct UplinkDtxStatistics {
+    uint32_t sent_frames = 0;
+    uint32_t sent_bytes = 0;
+    uint32_t suppressed_frames = 0;
+    // Packets encoded while no voice was detected, their average size estimates the suppressed bytes
+    uint32_t silence_packets = 0;
+    uint32_t silence_bytes = 0;
+};
+
+// High water mark of a queue since the service was created, and its current capacity
+struct AudioQueueUsage {
+    size_t high_water = 0;
+    size_t capacity = 0;
+};
+
+// The counters PrintStatistics() logs, for benchmarks that check them
+struct AudioPipelineStatistics {
+    DebugStatistics debug;
+    JitterBufferStats jitter;
+    AudioQueueUsage encode_queue;
+    AudioQueueUsage send_queue;
+    AudioQueueUsage testing_queue;
+    AudioQueueUsage decode_queue;
+    AudioQueueUsage playback_queue;
 };
 
 class AudioService {
@@ -85,6 +246,8 @@ public:
     ~AudioService();
 
     void Initialize(AudioCodec* codec);
+    // The codec the service plays and records with, which is not the board's with CONFIG_USE_WAV_AUDIO_CODEC
+    AudioCodec* codec() const { return codec_; }
     void Start();
     void Stop();
     void EncodeWakeWord();
@@ -99,15 +262,24 @@ public:
     void EnableVoiceProcessing(bool enable);
     void EnableAudioTesting(bool enable);
     void EnableDeviceAec(bool enable);
+    // Plays a chirp and finds it in the capture, blocks for about a second. Fails if audio is busy
+    bool MeasureRoundTripLatency(RoundTripLatency& result);
 
     void SetCallbacks(AudioServiceCallbacks& callbacks);
 
-    bool PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet, bool wait = false);
+    bool PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet);
     std::unique_ptr<AudioStreamPacket> PopPacketFromSendQueue();
+    // The sound is played from where it is, it must stay valid until played (e.g. Lang::Sounds in flash).
+    // Sounds play one after another, over the reply if one is playing
     void PlaySound(const std::string_view& sound);
     bool ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples);
     void ResetDecoder();
+    void SetEncodeFrameDuration(int frame_duration);
+    int encode_frame_duration() const { return encode_frame_duration_; }
     void SetModelsList(srmodel_list_t* models_list);
+    JitterBufferStats GetJitterBufferStats() const { return jitter_buffer_.GetStats(); }
+    AudioPipelineStatistics GetPipelineStatistics() const;
+    void PrintStatistics();
 
 private:
     AudioCodec* codec_ = nullptr;
@@ -115,12 +287,26 @@ private:
     std::unique_ptr<AudioProcessor> audio_processor_;
     std::unique_ptr<WakeWord> wake_word_;
     std::unique_ptr<AudioDebugger> audio_debugger_;
-    std::unique_ptr<OpusEncoderWrapper> opus_encoder_;
+    std::unique_ptr<OpusFrameEncoder> opus_encoder_;
+    // Encoder task only, after Initialize()
+    OpusEncoderGovernor encoder_governor_;
+    // The stats of encoder_governor_ as of its last window, published by the encoder task
+    std::mutex encoder_governor_mutex_;
+    OpusEncoderGovernorStats encoder_governor_stats_;
     std::unique_ptr<OpusDecoderWrapper> opus_decoder_;
-    OpusResampler input_resampler_;
-    OpusResampler reference_resampler_;
-    OpusResampler output_resampler_;
+    PolyphaseResampler input_resampler_;
+    PolyphaseResampler reference_resampler_;
+    PolyphaseResampler output_resampler_;
+    // Input path buffers, only used by ReadAudioData() so they keep their capacity between frames
+    std::mutex input_buffer_mutex_;
+    std::vector<int16_t> input_mic_buffer_;
+    std::vector<int16_t> input_reference_buffer_;
+    std::vector<int16_t> resampled_mic_buffer_;
+    std::vector<int16_t> resampled_reference_buffer_;
+    std::vector<int16_t> decode_buffer_;
+    JitterBuffer jitter_buffer_{MAX_DECODE_PACKETS_IN_QUEUE};
     DebugStatistics debug_statistics_;
+    UplinkDtxStatistics uplink_dtx_statistics_;
     srmodel_list_t* models_list_ = nullptr;
 
     EventGroupHandle_t event_group_;
@@ -128,16 +314,61 @@ private:
     // Audio encode / decode
     TaskHandle_t audio_input_task_handle_ = nullptr;
     TaskHandle_t audio_output_task_handle_ = nullptr;
-    TaskHandle_t opus_codec_task_handle_ = nullptr;
-    std::mutex audio_queue_mutex_;
-    std::condition_variable audio_queue_cv_;
-    std::deque<std::unique_ptr<AudioStreamPacket>> audio_decode_queue_;
-    std::deque<std::unique_ptr<AudioStreamPacket>> audio_send_queue_;
-    std::deque<std::unique_ptr<AudioStreamPacket>> audio_testing_queue_;
-    std::deque<std::unique_ptr<AudioTask>> audio_encode_queue_;
-    std::deque<std::unique_ptr<AudioTask>> audio_playback_queue_;
+    TaskHandle_t opus_encoder_task_handle_ = nullptr;
+    TaskHandle_t opus_decoder_task_handle_ = nullptr;
+    AudioQueue<std::unique_ptr<AudioStreamPacket>> audio_decode_queue_{MAX_DECODE_PACKETS_IN_QUEUE};
+    AudioQueue<std::unique_ptr<AudioStreamPacket>> audio_send_queue_{MAX_SEND_PACKETS_IN_QUEUE};
+    AudioQueue<std::unique_ptr<AudioStreamPacket>> audio_testing_queue_{MAX_TESTING_PACKETS_IN_QUEUE};
+    AudioQueue<std::unique_ptr<AudioTask>> audio_encode_queue_{MAX_ENCODE_TASKS_IN_QUEUE};
+    AudioQueue<std::unique_ptr<AudioTask>> audio_playback_queue_{MAX_PLAYBACK_TASKS_IN_QUEUE};
+    // The decode queue has several producers (network, UI), they are serialized here
+    std::mutex decode_producer_mutex_;
     // For server AEC
+    std::mutex timestamp_mutex_;
     std::deque<uint32_t> timestamp_queue_;
+    // Uplink DTX, only touched by the task producing the send frames. Other tasks request a reset
+    // through dtx_reset_, which that task applies before its next frame
+    std::deque<std::unique_ptr<AudioTask>> dtx_held_tasks_;
+    int dtx_silence_ms_ = 0;
+    std::atomic<bool> dtx_reset_ = false;
+    // Set by EnableAudioTesting(false) to play back the recorded testing queue
+    std::atomic<bool> audio_testing_playback_ = false;
+    // Round-trip latency measurement: the decoder task queues the chirp, the output task marks
+    // when it is written and the input task captures it
+    std::mutex latency_probe_mutex_;
+    LatencyProbe latency_probe_;
+    std::atomic<bool> latency_probe_pending_ = false;
+    // Set by ResetDecoder(), the decoder state is only touched by the decoder task
+    std::atomic<bool> decoder_reset_pending_ = false;
+
+    // Sounds from PlaySound(), decoded by the decoder task into the overlay queue so they play over
+    // the reply instead of after it. A cached sound is pushed to the overlay queue by PlaySound()
+    // itself when no other sound is ahead of it. Both queues have several producers, serialized here
+    std::mutex sound_mutex_;
+    bool sound_busy_ = false;   // Guarded by sound_mutex_: the decoder task is producing a sound
+    AudioQueue<std::string_view> audio_sound_queue_{MAX_SOUNDS_IN_QUEUE};
+    AudioQueue<std::unique_ptr<AudioTask>> audio_overlay_queue_{MAX_PLAYBACK_TASKS_IN_QUEUE};
+    SoundCache sound_cache_{SOUND_CACHE_MAX_BYTES};
+    std::atomic<bool> sound_playing_ = false;
+    // Decoder task only: the sound being played, from the cache or from its Ogg data
+    std::string_view current_sound_;
+    std::shared_ptr<const CachedSound> cached_sound_;
+    size_t cached_sound_offset_ = 0;
+    std::unique_ptr<OggDemuxer> sound_demuxer_;
+    std::unique_ptr<OpusDecoderWrapper> sound_decoder_;
+    PolyphaseResampler sound_resampler_;
+    std::vector<uint8_t> sound_payload_;
+    bool sound_fill_ = false;
+    std::vector<int16_t> sound_fill_buffer_;
+
+    // Output task only: mixes the reply (playback queue) and the sounds (overlay queue)
+    AudioMixer mixer_;
+    int voice_mix_source_ = -1;
+    int sound_mix_source_ = -1;
+    std::vector<int16_t> mix_buffer_;
+
+    // Uplink frame duration, the encoder task follows the frame size produced by the processor
+    std::atomic<int> encode_frame_duration_ = OPUS_FRAME_DURATION_MS;
 
     bool wake_word_initialized_ = false;
     bool audio_processor_initialized_ = false;
@@ -151,9 +382,19 @@ private:
 
     void AudioInputTask();
     void AudioOutputTask();
-    void OpusCodecTask();
+    void OpusEncoderTask();
+    void OpusDecoderTask();
     void PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm);
+    bool PushEncodeTask(std::unique_ptr<AudioTask>& task);
+    bool SuppressUplinkFrame(std::unique_ptr<AudioTask>& task);
+    void LogUplinkDtxStatistics();
     void SetDecodeSampleRate(int sample_rate, int frame_duration);
+    bool DecodeSound();
+    bool PushCachedSound(const std::string_view& sound);
+    bool DecodeSoundPacket(const OggOpusPacket& packet, std::vector<int16_t>& output);
+    void FinishSound();
+    void MixSource(int source, std::unique_ptr<AudioTask>& task, size_t& offset, size_t samples);
+    void OnPlaybackTaskDone(const AudioTask& task);
     void CheckAndUpdateAudioPowerState();
 };
 
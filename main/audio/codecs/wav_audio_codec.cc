@@ -0,0 +1,217 @@
+#include "wav_audio_codec.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/task.h>
+#include <cstring>
+#include <algorithm>
+
+#define TAG "WavAudioCodec"
+
+#define WAV_HEADER_SIZE 44
+
+static uint16_t ReadLe16(const uint8_t* p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t ReadLe32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void WriteLe16(uint8_t* p, uint16_t value) {
+    p[0] = value & 0xFF;
+    p[1] = value >> 8;
+}
+
+static void WriteLe32(uint8_t* p, uint32_t value) {
+    p[0] = value & 0xFF;
+    p[1] = (value >> 8) & 0xFF;
+    p[2] = (value >> 16) & 0xFF;
+    p[3] = value >> 24;
+}
+
+WavAudioCodec::WavAudioCodec(const std::string& input_path, const std::string& output_path, int output_sample_rate, float speed) {
+    duplex_ = true;
+    input_reference_ = false;
+    input_channels_ = 1;
+    input_sample_rate_ = 16000;
+    output_sample_rate_ = output_sample_rate;
+    speed_ = speed > 0 ? speed : 1.0f;
+
+    if (!input_path.empty() && !OpenInput(input_path)) {
+        ESP_LOGE(TAG, "Failed to open input file %s, the input will be silence", input_path.c_str());
+    }
+    if (!output_path.empty() && !OpenOutput(output_path)) {
+        ESP_LOGE(TAG, "Failed to open output file %s", output_path.c_str());
+    }
+}
+
+WavAudioCodec::~WavAudioCodec() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (input_file_ != nullptr) {
+        fclose(input_file_);
+    }
+    if (output_file_ != nullptr) {
+        UpdateOutputHeader();
+        fclose(output_file_);
+    }
+}
+
+bool WavAudioCodec::OpenInput(const std::string& path) {
+    input_file_ = fopen(path.c_str(), "rb");
+    if (input_file_ == nullptr) {
+        return false;
+    }
+
+    uint8_t header[12];
+    if (fread(header, 1, sizeof(header), input_file_) != sizeof(header) ||
+        memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0) {
+        ESP_LOGE(TAG, "Not a WAV file: %s", path.c_str());
+        fclose(input_file_);
+        input_file_ = nullptr;
+        return false;
+    }
+
+    // Walk the chunks until the data chunk, the fmt chunk comes before it
+    bool has_format = false;
+    uint8_t chunk[8];
+    while (fread(chunk, 1, sizeof(chunk), input_file_) == sizeof(chunk)) {
+        uint32_t chunk_size = ReadLe32(chunk + 4);
+        if (memcmp(chunk, "fmt ", 4) == 0 && chunk_size >= 16) {
+            uint8_t format[16];
+            if (fread(format, 1, sizeof(format), input_file_) != sizeof(format)) {
+                break;
+            }
+            uint16_t audio_format = ReadLe16(format);
+            uint16_t channels = ReadLe16(format + 2);
+            uint16_t bits_per_sample = ReadLe16(format + 14);
+            if (audio_format != 1 || bits_per_sample != 16 || channels < 1 || channels > 2) {
+                ESP_LOGE(TAG, "Unsupported WAV format %u, %u channels, %u bits", audio_format, channels, bits_per_sample);
+                break;
+            }
+            input_channels_ = channels;
+            input_reference_ = channels == 2;
+            input_sample_rate_ = ReadLe32(format + 4);
+            has_format = true;
+            fseek(input_file_, (chunk_size - sizeof(format)) + (chunk_size & 1), SEEK_CUR);
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            if (!has_format) {
+                break;
+            }
+            input_data_offset_ = ftell(input_file_);
+            // A stream writer may leave the size at 0xFFFFFFFF, the data then ends with the file
+            fseek(input_file_, 0, SEEK_END);
+            long file_end = ftell(input_file_);
+            input_data_end_ = (unsigned long)chunk_size < (unsigned long)(file_end - input_data_offset_) ?
+                input_data_offset_ + (long)chunk_size : file_end;
+            fseek(input_file_, input_data_offset_, SEEK_SET);
+            ESP_LOGI(TAG, "Input %s: %d Hz, %d channels", path.c_str(), input_sample_rate_, input_channels_);
+            return true;
+        } else {
+            fseek(input_file_, chunk_size + (chunk_size & 1), SEEK_CUR);
+        }
+    }
+
+    fclose(input_file_);
+    input_file_ = nullptr;
+    return false;
+}
+
+bool WavAudioCodec::OpenOutput(const std::string& path) {
+    output_file_ = fopen(path.c_str(), "wb");
+    if (output_file_ == nullptr) {
+        return false;
+    }
+    output_data_size_ = 0;
+    UpdateOutputHeader();
+    ESP_LOGI(TAG, "Output %s: %d Hz, %d channels", path.c_str(), output_sample_rate_, output_channels_);
+    return true;
+}
+
+void WavAudioCodec::UpdateOutputHeader() {
+    uint8_t header[WAV_HEADER_SIZE];
+    memcpy(header, "RIFF", 4);
+    WriteLe32(header + 4, 36 + output_data_size_);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    WriteLe32(header + 16, 16);
+    WriteLe16(header + 20, 1);
+    WriteLe16(header + 22, output_channels_);
+    WriteLe32(header + 24, output_sample_rate_);
+    WriteLe32(header + 28, output_sample_rate_ * output_channels_ * sizeof(int16_t));
+    WriteLe16(header + 32, output_channels_ * sizeof(int16_t));
+    WriteLe16(header + 34, 16);
+    memcpy(header + 36, "data", 4);
+    WriteLe32(header + 40, output_data_size_);
+
+    fseek(output_file_, 0, SEEK_SET);
+    fwrite(header, 1, sizeof(header), output_file_);
+    fseek(output_file_, 0, SEEK_END);
+    fflush(output_file_);
+}
+
+void WavAudioCodec::Pace(int64_t& start_time, uint64_t& samples, int frames, int sample_rate) {
+    int64_t now = esp_timer_get_time();
+    // A caller less than the I2S DMA buffers late catches up without waiting. Later than that (idle
+    // output, or input not read), the clock restarts like after a DMA overrun
+    int64_t buffer_us = (int64_t)(AUDIO_CODEC_DMA_DESC_NUM * AUDIO_CODEC_DMA_FRAME_NUM * 1000000LL / sample_rate / speed_);
+    if (start_time + (int64_t)(samples * 1000000 / sample_rate / speed_) + buffer_us < now) {
+        start_time = now;
+        samples = 0;
+    }
+    samples += frames;
+    int64_t remaining_ms = (start_time + (int64_t)(samples * 1000000 / sample_rate / speed_) - now) / 1000;
+    if (remaining_ms > 0) {
+        vTaskDelay(pdMS_TO_TICKS(remaining_ms));
+    }
+}
+
+void WavAudioCodec::EnableOutput(bool enable) {
+    if (!enable && output_enabled_) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (output_file_ != nullptr) {
+            UpdateOutputHeader();
+        }
+    }
+    AudioCodec::EnableOutput(enable);
+}
+
+size_t WavAudioCodec::ReadData(int16_t* dest, size_t samples) {
+    long remaining = (input_data_end_ - ftell(input_file_)) / (long)sizeof(int16_t);
+    if (remaining <= 0) {
+        return 0;
+    }
+    return fread(dest, sizeof(int16_t), std::min(samples, (size_t)remaining), input_file_);
+}
+
+int WavAudioCodec::Read(int16_t* dest, int samples) {
+    Pace(input_start_time_, input_samples_, samples / input_channels_, input_sample_rate_);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t read = 0;
+    if (input_file_ != nullptr) {
+        read = ReadData(dest, samples);
+        while (read < (size_t)samples) {
+            // Start over from the beginning of the data chunk, which may be shorter than a read
+            fseek(input_file_, input_data_offset_, SEEK_SET);
+            size_t more = ReadData(dest + read, samples - read);
+            if (more == 0) {
+                break;
+            }
+            read += more;
+        }
+    }
+    if (read < (size_t)samples) {
+        memset(dest + read, 0, (samples - read) * sizeof(int16_t));
+    }
+    return samples;
+}
+
+int WavAudioCodec::Write(const int16_t* data, int samples) {
+    Pace(output_start_time_, output_samples_, samples / output_channels_, output_sample_rate_);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (output_file_ != nullptr) {
+        output_data_size_ += fwrite(data, sizeof(int16_t), samples, output_file_) * sizeof(int16_t);
+    }
+    return samples;
+}
@@ -0,0 +1,50 @@
+#ifndef _WAV_AUDIO_CODEC_H
+#define _WAV_AUDIO_CODEC_H
+
+#include "audio_codec.h"
+
+#include <cstdio>
+#include <string>
+#include <mutex>
+
+/*
+ * File-backed codec for benchmarking the audio pipeline without a microphone or speaker.
+ *
+ * The input is read from a 16-bit PCM WAV file (mono, or stereo as mic + reference) and starts over
+ * at the end of the file, so a short recording can drive a long run. The output is written to a WAV
+ * file at output_sample_rate. Both directions are paced by a clock running `speed` times faster than
+ * real time, like the I2S DMA would pace them.
+ */
+class WavAudioCodec : public AudioCodec {
+private:
+    std::mutex mutex_;
+    FILE* input_file_ = nullptr;
+    FILE* output_file_ = nullptr;
+    long input_data_offset_ = 0;
+    // End of the data chunk, chunks after it (LIST, id3) are not audio
+    long input_data_end_ = 0;
+    uint32_t output_data_size_ = 0;
+    float speed_ = 1.0f;
+    int64_t input_start_time_ = 0;
+    uint64_t input_samples_ = 0;
+    int64_t output_start_time_ = 0;
+    uint64_t output_samples_ = 0;
+
+    bool OpenInput(const std::string& path);
+    bool OpenOutput(const std::string& path);
+    // Reads up to samples from the data chunk, fewer at its end
+    size_t ReadData(int16_t* dest, size_t samples);
+    void UpdateOutputHeader();
+    void Pace(int64_t& start_time, uint64_t& samples, int frames, int sample_rate);
+
+    virtual int Read(int16_t* dest, int samples) override;
+    virtual int Write(const int16_t* data, int samples) override;
+
+public:
+    WavAudioCodec(const std::string& input_path, const std::string& output_path, int output_sample_rate, float speed = 1.0f);
+    virtual ~WavAudioCodec();
+
+    virtual void EnableOutput(bool enable) override;
+};
+
+#endif // _WAV_AUDIO_CODEC_H
@@ -0,0 +1,197 @@
+#include "jitter_buffer.h"
+
+#include <esp_log.h>
+
+#define TAG "JitterBuffer"
+
+static size_t RoundUpToPowerOfTwo(size_t value) {
+    size_t result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+JitterBuffer::JitterBuffer(size_t capacity) : slots_(RoundUpToPowerOfTwo(capacity)), capacity_(capacity) {
+}
+
+void JitterBuffer::Push(std::unique_ptr<AudioStreamPacket> packet, int64_t now_ms) {
+    if (packet->frame_duration > 0) {
+        frame_duration_ = packet->frame_duration;
+    }
+    sample_rate_ = packet->sample_rate;
+
+    // Packets without a sequence number are numbered in arrival order
+    uint32_t sequence = packet->sequence != 0 ? packet->sequence : max_sequence_ + 1;
+    if (!started_) {
+        started_ = true;
+        played_ = false;
+        head_sequence_ = sequence;
+        max_sequence_ = sequence;
+        has_transit_ = false;
+    }
+
+    const int32_t capacity = capacity_;
+    int32_t offset = (int32_t)(sequence - head_sequence_);
+    if (offset < -capacity || offset >= capacity) {
+        // The stream restarted, or the gap is longer than the buffer
+        ESP_LOGW(TAG, "Resync from sequence %lu to %lu", head_sequence_, sequence);
+        lost_packets_ += count_;
+        Flush();
+        played_ = false;
+        head_sequence_ = sequence;
+        max_sequence_ = sequence;
+        has_transit_ = false;
+        offset = 0;
+    } else if (offset < 0) {
+        // Once its slot was played or concealed, playing it would repeat audio or play it out of order
+        if (played_ || playing_ || (uint32_t)(max_sequence_ - sequence) >= capacity_) {
+            late_packets_++;
+            return;
+        }
+        // Reordered before the playout started
+        head_sequence_ = sequence;
+    }
+
+    auto& slot = Slot(sequence);
+    if (slot) {
+        // Duplicate
+        return;
+    }
+
+    if (count_ == 0) {
+        // Drained and silent for longer than any target depth: a pause of the stream, not jitter
+        if (now_ms - last_arrival_ms_ > JITTER_BUFFER_MAX_TARGET_MS) {
+            has_transit_ = false;
+        }
+        if (!playing_) {
+            wait_since_ms_ = now_ms;
+        }
+    }
+    last_arrival_ms_ = now_ms;
+    UpdateJitter(sequence, now_ms);
+    slot = std::move(packet);
+    count_++;
+    if ((int32_t)(sequence - max_sequence_) > 0) {
+        max_sequence_ = sequence;
+    }
+}
+
+bool JitterBuffer::Pop(std::unique_ptr<AudioStreamPacket>& packet, int64_t now_ms) {
+    if (count_ == 0) {
+        if (playing_) {
+            playing_ = false;
+            underruns_++;
+        }
+        return false;
+    }
+
+    uint32_t target_depth = TargetDepth();
+    if (!playing_) {
+        if (count_ < target_depth && now_ms - wait_since_ms_ < (int64_t)target_depth * frame_duration_) {
+            return false;
+        }
+        playing_ = true;
+    }
+
+    auto& slot = Slot(head_sequence_);
+    if (slot) {
+        packet = std::move(slot);
+        count_--;
+        head_sequence_++;
+        played_ = true;
+        conceal_run_ = 0;
+        wait_since_ms_ = now_ms;
+        return true;
+    }
+
+    // The next packet is missing, but later ones are buffered
+    if (conceal_run_ < JITTER_BUFFER_MAX_CONCEAL_FRAMES) {
+        if (count_ < target_depth && now_ms - wait_since_ms_ < frame_duration_) {
+            return false;
+        }
+        packet = NewAudioStreamPacket();
+        packet->sample_rate = sample_rate_;
+        packet->frame_duration = frame_duration_;
+        conceal_run_++;
+        concealed_frames_++;
+        head_sequence_++;
+        played_ = true;
+        wait_since_ms_ = now_ms;
+        return true;
+    }
+
+    // Too many frames missing in a row, jump to the next buffered packet
+    while (!Slot(head_sequence_)) {
+        head_sequence_++;
+        lost_packets_++;
+    }
+    conceal_run_ = 0;
+    return Pop(packet, now_ms);
+}
+
+TickType_t JitterBuffer::GetWaitTicks(int64_t now_ms) const {
+    if (count_ == 0) {
+        return portMAX_DELAY;
+    }
+    int64_t deadline = wait_since_ms_ + (playing_ ? (int64_t)frame_duration_ : (int64_t)TargetDepth() * frame_duration_);
+    int64_t remaining = deadline - now_ms;
+    return pdMS_TO_TICKS(remaining > 0 ? remaining : 0) + 1;
+}
+
+void JitterBuffer::Reset() {
+    Flush();
+    started_ = false;
+    has_transit_ = false;
+    conceal_run_ = 0;
+}
+
+JitterBufferStats JitterBuffer::GetStats() const {
+    JitterBufferStats stats;
+    stats.depth = count_;
+    stats.target_depth = TargetDepth();
+    stats.jitter_ms = jitter_ms_;
+    stats.late_packets = late_packets_;
+    stats.concealed_frames = concealed_frames_;
+    stats.lost_packets = lost_packets_;
+    stats.underruns = underruns_;
+    return stats;
+}
+
+void JitterBuffer::UpdateJitter(uint32_t sequence, int64_t now_ms) {
+    // RFC 3550 A.8: J += (|D| - J) / 16, where D is the change of the transit time between two
+    // consecutive arrivals. The send time is derived from the sequence number
+    int64_t transit = now_ms - (int64_t)sequence * frame_duration_;
+    if (has_transit_) {
+        int64_t d = transit - last_transit_ms_;
+        if (d < 0) {
+            d = -d;
+        }
+        jitter_x16_ += d - ((jitter_x16_ + 8) >> 4);
+        jitter_ms_ = jitter_x16_ >> 4;
+    }
+    last_transit_ms_ = transit;
+    has_transit_ = true;
+}
+
+uint32_t JitterBuffer::TargetDepth() const {
+    uint32_t jitter_ms = jitter_ms_ * JITTER_BUFFER_JITTER_FACTOR;
+    int frame_duration = frame_duration_;
+    uint32_t depth = 1 + (jitter_ms + frame_duration - 1) / frame_duration;
+    uint32_t max_depth = JITTER_BUFFER_MAX_TARGET_MS / frame_duration;
+    if (depth > max_depth) {
+        depth = max_depth;
+    }
+    if (depth > capacity_) {
+        depth = capacity_;
+    }
+    return depth > 0 ? depth : 1;
+}
+
+void JitterBuffer::Flush() {
+    for (auto& slot : slots_) {
+        slot.reset();
+    }
+    count_ = 0;
+    playing_ = false;
+}
@@ -0,0 +1,90 @@
+#ifndef JITTER_BUFFER_H
+#define JITTER_BUFFER_H
+
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+
+#include <freertos/FreeRTOS.h>
+
+#include "protocol.h"
+
+#define JITTER_BUFFER_MAX_TARGET_MS 600
+// Gaps longer than this are skipped instead of concealed
+#define JITTER_BUFFER_MAX_CONCEAL_FRAMES 3
+// The target depth covers this many times the interarrival jitter
+#define JITTER_BUFFER_JITTER_FACTOR 3
+
+struct JitterBufferStats {
+    uint32_t depth = 0;             // Packets currently buffered
+    uint32_t target_depth = 0;      // Packets buffered before playout starts
+    uint32_t jitter_ms = 0;         // Interarrival jitter (RFC 3550 A.8)
+    uint32_t late_packets = 0;      // Arrived after their slot was played or concealed
+    uint32_t concealed_frames = 0;  // Gaps filled with Opus PLC
+    uint32_t lost_packets = 0;      // Gaps skipped without concealment
+    uint32_t underruns = 0;         // Buffer ran empty while playing
+};
+
+/*
+ * Downlink jitter buffer between the decode queue and the Opus decoder.
+ *
+ * Packets are stored in slots indexed by sequence number, so out-of-order packets are played in
+ * order. The slot count is rounded up to a power of two, so the index stays continuous when the
+ * 32-bit sequence wraps; a packet older than the last one played or concealed is dropped as late. Packets without
+ * a sequence number (websocket, local sounds) are numbered in arrival order.
+ * The target depth follows the interarrival jitter, estimated from consecutive arrivals like in
+ * RFC 3550, so a pause between sentences does not count: the estimate restarts when a packet
+ * arrives at a drained buffer after more than JITTER_BUFFER_MAX_TARGET_MS. Playout (re)starts once the target depth is buffered, or once the oldest packet has
+ * waited that long. A missing packet is concealed by handing out an empty packet, which the Opus
+ * decoder turns into packet loss concealment.
+ *
+ * Only the decoder task uses it, except GetStats() which may be read from any task: what it reads is
+ * atomic, each value is current but they may be from different packets.
+ */
+class JitterBuffer {
+public:
+    explicit JitterBuffer(size_t capacity);
+
+    void Push(std::unique_ptr<AudioStreamPacket> packet, int64_t now_ms);
+    // Returns the next packet to decode, an empty payload means the frame must be concealed
+    bool Pop(std::unique_ptr<AudioStreamPacket>& packet, int64_t now_ms);
+    // How long the decoder task may sleep before Pop() could return something new
+    TickType_t GetWaitTicks(int64_t now_ms) const;
+    void Reset();
+
+    inline bool Full() const { return count_ >= capacity_; }
+    inline bool Empty() const { return count_ == 0; }
+    JitterBufferStats GetStats() const;
+
+private:
+    std::vector<std::unique_ptr<AudioStreamPacket>> slots_;
+    const uint32_t capacity_;       // Packets buffered at most, slots_.size() is the next power of two
+    std::atomic<uint32_t> count_ = 0;
+    bool started_ = false;
+    bool playing_ = false;
+    bool played_ = false;           // Something was played or concealed since the (re)start
+    uint32_t head_sequence_ = 0;    // Next sequence to play
+    uint32_t max_sequence_ = 0;     // Highest sequence buffered
+    bool has_transit_ = false;      // last_transit_ms_ is the baseline for the next arrival
+    int64_t last_transit_ms_ = 0;
+    int64_t last_arrival_ms_ = 0;
+    int64_t jitter_x16_ = 0;        // Interarrival jitter in milliseconds, scaled by 16
+    int64_t wait_since_ms_ = 0;     // When the buffer started waiting (prebuffer or gap)
+    std::atomic<int> frame_duration_ = 60;
+    int sample_rate_ = 0;
+    int conceal_run_ = 0;
+    // The counters of JitterBufferStats
+    std::atomic<uint32_t> jitter_ms_ = 0;
+    std::atomic<uint32_t> late_packets_ = 0;
+    std::atomic<uint32_t> concealed_frames_ = 0;
+    std::atomic<uint32_t> lost_packets_ = 0;
+    std::atomic<uint32_t> underruns_ = 0;
+
+    std::unique_ptr<AudioStreamPacket>& Slot(uint32_t sequence) { return slots_[sequence & (slots_.size() - 1)]; }
+    void UpdateJitter(uint32_t sequence, int64_t now_ms);
+    uint32_t TargetDepth() const;
+    void Flush();
+};
+
+#endif // JITTER_BUFFER_H
@@ -0,0 +1,140 @@
+#include "latency_probe.h"
+
+#include <esp_log.h>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+
+#define TAG "LatencyProbe"
+
+// Raised cosine fade at both ends of the chirp, against clicks
+#define LATENCY_PROBE_FADE_MS 5
+// The reference length is rounded down to this block, see Correlate()
+#define LATENCY_PROBE_BLOCK 16
+
+static void GenerateChirp(std::vector<int16_t>& output, int sample_rate, size_t samples, double amplitude) {
+    double duration = (double)samples / sample_rate;
+    double sweep = (LATENCY_PROBE_END_HZ - LATENCY_PROBE_START_HZ) / duration;
+    size_t fade = sample_rate * LATENCY_PROBE_FADE_MS / 1000;
+    output.resize(samples);
+    for (size_t i = 0; i < samples; i++) {
+        double t = (double)i / sample_rate;
+        double phase = 2 * M_PI * (LATENCY_PROBE_START_HZ * t + 0.5 * sweep * t * t);
+        double gain = 1.0;
+        size_t edge = std::min(i, samples - 1 - i);
+        if (edge < fade) {
+            gain = 0.5 - 0.5 * std::cos(M_PI * edge / fade);
+        }
+        output[i] = (int16_t)std::lround(amplitude * gain * std::sin(phase));
+    }
+}
+
+void LatencyProbe::Begin(int output_sample_rate, int capture_sample_rate) {
+    if (output_sample_rate != output_sample_rate_ || capture_sample_rate != capture_sample_rate_ || chirp_.empty()) {
+        output_sample_rate_ = output_sample_rate;
+        capture_sample_rate_ = capture_sample_rate;
+        GenerateChirp(chirp_, output_sample_rate, output_sample_rate * LATENCY_PROBE_CHIRP_MS / 1000,
+            LATENCY_PROBE_AMPLITUDE);
+        size_t reference_samples = capture_sample_rate * LATENCY_PROBE_CHIRP_MS / 1000;
+        GenerateChirp(reference_, capture_sample_rate, reference_samples - reference_samples % LATENCY_PROBE_BLOCK, 2047);
+    }
+    capture_.resize(capture_sample_rate * LATENCY_PROBE_CAPTURE_MS / 1000);
+    captured_ = 0;
+    capture_base_time_ = INT64_MAX;
+    playback_time_ = 0;
+}
+
+void LatencyProbe::End() {
+    chirp_ = std::vector<int16_t>();
+    reference_ = std::vector<int16_t>();
+    capture_ = std::vector<int16_t>();
+    captured_ = 0;
+}
+
+bool LatencyProbe::Capture(const int16_t* samples, size_t frames, int channels, int64_t read_time) {
+    if (captured_ >= capture_.size()) {
+        return true;
+    }
+    // The last sample arrived when InputData() returned, the first one a frame earlier
+    int64_t base_time = read_time - (int64_t)(captured_ + frames) * 1000000 / capture_sample_rate_;
+    capture_base_time_ = std::min(capture_base_time_, base_time);
+    size_t count = std::min(frames, capture_.size() - captured_);
+    for (size_t i = 0; i < count; i++) {
+        capture_[captured_ + i] = samples[i * channels];
+    }
+    captured_ += count;
+    return captured_ >= capture_.size();
+}
+
+int64_t LatencyProbe::Correlate(size_t lag) const {
+    const int16_t* x = capture_.data() + lag;
+    const int16_t* r = reference_.data();
+    int64_t sum = 0;
+    for (size_t i = 0; i < reference_.size(); i += LATENCY_PROBE_BLOCK) {
+        int32_t acc = 0;
+        for (size_t j = i; j < i + LATENCY_PROBE_BLOCK; j++) {
+            acc += x[j] * r[j];
+        }
+        sum += acc;
+    }
+    return sum;
+}
+
+bool LatencyProbe::Analyze(RoundTripLatency& result) {
+    int64_t playback_time = playback_time_;
+    if (captured_ < capture_.size() || playback_time == 0 || reference_.empty()) {
+        ESP_LOGW(TAG, "Nothing to analyze, captured %u samples, chirp %s", captured_,
+            playback_time == 0 ? "not played" : "played");
+        return false;
+    }
+
+    // Search from the moment the chirp was written, a negative latency is not possible
+    int64_t offset_us = playback_time - capture_base_time_;
+    size_t first_lag = offset_us > 0 ? offset_us * capture_sample_rate_ / 1000000 : 0;
+    size_t last_lag = first_lag + capture_sample_rate_ * LATENCY_PROBE_MAX_LATENCY_MS / 1000;
+    last_lag = std::min(last_lag, capture_.size() - reference_.size());
+    if (first_lag + 2 > last_lag) {
+        ESP_LOGW(TAG, "The chirp was played too late for the capture (%lld us after it started)", offset_us);
+        return false;
+    }
+
+    // The polarity of the speaker or mic may be inverted, so the peak is taken on the magnitude
+    size_t peak_lag = first_lag;
+    int64_t peak = 0;
+    for (size_t lag = first_lag; lag <= last_lag; lag++) {
+        int64_t value = std::llabs(Correlate(lag));
+        if (value > peak) {
+            peak = value;
+            peak_lag = lag;
+        }
+    }
+
+    double energy = 0;
+    for (size_t i = 0; i < reference_.size(); i++) {
+        energy += (double)capture_[peak_lag + i] * capture_[peak_lag + i];
+    }
+    double reference_energy = 0;
+    for (auto sample : reference_) {
+        reference_energy += (double)sample * sample;
+    }
+    int correlation = energy > 0 ? (int)(1000 * peak / std::sqrt(energy * reference_energy)) : 0;
+
+    // Parabolic interpolation between the neighbours for a sub-sample position
+    double position = peak_lag;
+    if (peak_lag > first_lag && peak_lag < last_lag) {
+        double before = std::llabs(Correlate(peak_lag - 1));
+        double after = std::llabs(Correlate(peak_lag + 1));
+        double curvature = before - 2.0 * peak + after;
+        if (curvature < 0) {
+            position += 0.5 * (before - after) / curvature;
+        }
+    }
+
+    result.latency_us = (int)(capture_base_time_ + std::lround(position * 1000000 / capture_sample_rate_) - playback_time);
+    result.correlation = correlation;
+    if (correlation < LATENCY_PROBE_MIN_CORRELATION) {
+        ESP_LOGW(TAG, "Chirp not found, correlation %d / 1000 at %d us", correlation, result.latency_us);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,75 @@
+#ifndef LATENCY_PROBE_H
+#define LATENCY_PROBE_H
+
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+// Silence played before the chirp, so the output DMA is as full as while streaming a reply
+#define LATENCY_PROBE_LEAD_MS 200
+#define LATENCY_PROBE_CHIRP_MS 128
+#define LATENCY_PROBE_START_HZ 500
+#define LATENCY_PROBE_END_HZ 4000
+// Chirp level, -6 dBFS before the codec volume
+#define LATENCY_PROBE_AMPLITUDE 16384
+#define LATENCY_PROBE_MAX_LATENCY_MS 500
+#define LATENCY_PROBE_CAPTURE_MS 1000
+// Normalized correlation peak below which the chirp is considered not heard, per mille
+#define LATENCY_PROBE_MIN_CORRELATION 250
+
+struct RoundTripLatency {
+    // From the chirp being passed to OutputData() to it coming back from InputData()
+    int latency_us = 0;
+    // I2S DMA buffering of each direction (AUDIO_CODEC_DMA_DESC_NUM x AUDIO_CODEC_DMA_FRAME_NUM frames),
+    // an upper bound of their share in latency_us
+    int output_dma_us = 0;
+    int input_dma_us = 0;
+    // Input resampler delay, included in latency_us like in the uplink
+    int resampler_us = 0;
+    // Normalized correlation peak, per mille
+    int correlation = 0;
+};
+
+/*
+ * Measures the speaker to mic latency with a linear chirp played through the output path and
+ * cross-correlated with the capture.
+ *
+ * The caller prepares the probe with Begin(), the output task calls MarkPlayback() right before
+ * writing the chirp, the input task passes every captured frame to Capture() until it returns
+ * true, then Analyze() finds the chirp. Capture times are taken when InputData() returns; the
+ * earliest return of all the frames anchors the capture timeline, as a late return only means
+ * the input task was scheduled late.
+ */
+class LatencyProbe {
+public:
+    void Begin(int output_sample_rate, int capture_sample_rate);
+    // Frees the buffers until the next Begin()
+    void End();
+
+    const std::vector<int16_t>& chirp() const { return chirp_; }
+    int lead_samples() const { return output_sample_rate_ * LATENCY_PROBE_LEAD_MS / 1000; }
+
+    void MarkPlayback(int64_t time) { playback_time_ = time; }
+    int64_t playback_time() const { return playback_time_; }
+    // First channel of interleaved frames, returns true when the capture is complete
+    bool Capture(const int16_t* samples, size_t frames, int channels, int64_t read_time);
+    bool Analyze(RoundTripLatency& result);
+
+private:
+    int output_sample_rate_ = 0;
+    int capture_sample_rate_ = 0;
+    // At the output rate, for playback
+    std::vector<int16_t> chirp_;
+    // The same chirp at the capture rate in Q11, so 16 products add up in 32 bits
+    std::vector<int16_t> reference_;
+    std::vector<int16_t> capture_;
+    size_t captured_ = 0;
+    // Time of capture_[0], in microseconds
+    int64_t capture_base_time_ = INT64_MAX;
+    std::atomic<int64_t> playback_time_ = 0;
+
+    int64_t Correlate(size_t lag) const;
+};
+
+#endif // LATENCY_PROBE_H
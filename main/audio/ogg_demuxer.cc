@@ -0,0 +1,241 @@
+#include "ogg_demuxer.h"
+
+#include <esp_log.h>
+#include <array>
+#include <cstring>
+#include <algorithm>
+
+#define TAG "OggDemuxer"
+
+#define OGG_PAGE_HEADER_SIZE 27
+#define OGG_HEADER_TYPE_CONTINUED 0x01
+#define OGG_HEADER_TYPE_EOS 0x04
+#define OPUS_MAX_PACKET_SAMPLES 5760    // 120 ms at 48 kHz
+
+static uint32_t ReadLe32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Ogg uses the CRC-32 with polynomial 0x04c11db7, no reflection, zero initial value and no final xor
+static constexpr std::array<uint32_t, 256> MakeOggCrcTable() {
+    std::array<uint32_t, 256> table = {};
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t r = i << 24;
+        for (int j = 0; j < 8; j++) {
+            r = (r & 0x80000000) ? (r << 1) ^ 0x04c11db7 : r << 1;
+        }
+        table[i] = r;
+    }
+    return table;
+}
+
+// Built at compile time, so demuxers on different tasks share it without a race on first use
+static constexpr std::array<uint32_t, 256> kOggCrcTable = MakeOggCrcTable();
+
+static uint32_t OggCrc32(const uint8_t* data, size_t size, uint32_t crc) {
+    for (size_t i = 0; i < size; i++) {
+        crc = (crc << 8) ^ kOggCrcTable[((crc >> 24) ^ data[i]) & 0xFF];
+    }
+    return crc;
+}
+
+OggDemuxer::OggDemuxer(std::string_view source)
+    : source_(reinterpret_cast<const uint8_t*>(source.data())), size_(source.size()) {
+}
+
+int OggDemuxer::GetPacketSamples(const uint8_t* data, size_t size) {
+    if (size < 1) {
+        return 0;
+    }
+
+    // Frame size from the TOC config (RFC 6716 section 3.1)
+    int config = data[0] >> 3;
+    int frame_samples;
+    if (config < 12) {
+        static const int silk[] = { 480, 960, 1920, 2880 };
+        frame_samples = silk[config & 3];
+    } else if (config < 16) {
+        frame_samples = (config & 1) ? 960 : 480;
+    } else {
+        frame_samples = 120 << (config & 3);
+    }
+
+    int frames;
+    switch (data[0] & 3) {
+    case 0:
+        frames = 1;
+        break;
+    case 1:
+    case 2:
+        frames = 2;
+        break;
+    default:
+        if (size < 2) {
+            return 0;
+        }
+        frames = data[1] & 0x3F;
+        break;
+    }
+
+    int samples = frames * frame_samples;
+    return samples <= OPUS_MAX_PACKET_SAMPLES ? samples : 0;
+}
+
+bool OggDemuxer::NextPage() {
+    while (offset_ + OGG_PAGE_HEADER_SIZE <= size_) {
+        const uint8_t* page = source_ + offset_;
+        if (memcmp(page, "OggS", 4) != 0) {
+            // Resync on the next capture pattern
+            auto next = static_cast<const uint8_t*>(memchr(page + 1, 'O', size_ - offset_ - 1));
+            offset_ = next != nullptr ? next - source_ : size_;
+            continue;
+        }
+
+        int segment_count = page[26];
+        size_t header_size = OGG_PAGE_HEADER_SIZE + segment_count;
+        size_t body_size = 0;
+        if (page[4] == 0 && offset_ + header_size <= size_) {
+            for (int i = 0; i < segment_count; i++) {
+                body_size += page[OGG_PAGE_HEADER_SIZE + i];
+            }
+        }
+        if (page[4] != 0 || offset_ + header_size + body_size > size_) {
+            offset_++;
+            continue;
+        }
+
+        // The CRC is computed with the CRC field set to zero
+        static const uint8_t zero_crc[4] = { 0, 0, 0, 0 };
+        uint32_t crc = OggCrc32(page, 22, 0);
+        crc = OggCrc32(zero_crc, 4, crc);
+        crc = OggCrc32(page + 26, header_size + body_size - 26, crc);
+        if (crc != ReadLe32(page + 22)) {
+            crc_errors_++;
+            ESP_LOGW(TAG, "CRC mismatch in page at offset %u", offset_);
+            offset_++;
+            continue;
+        }
+
+        page_ = page;
+        segment_count_ = segment_count;
+        segment_index_ = 0;
+        body_offset_ = offset_ + header_size;
+        page_eos_ = (page[5] & OGG_HEADER_TYPE_EOS) != 0;
+        page_granule_ = (int64_t)((uint64_t)ReadLe32(page + 6) | ((uint64_t)ReadLe32(page + 10) << 32));
+        offset_ += header_size + body_size;
+
+        bool continued = (page[5] & OGG_HEADER_TYPE_CONTINUED) != 0;
+        if (continuing_ && !continued) {
+            // The page holding the rest of the packet was lost
+            continued_.clear();
+            continuing_ = false;
+        } else if (!continuing_ && continued) {
+            // The start of this packet was lost, skip its tail
+            uint8_t lacing;
+            do {
+                lacing = page_[OGG_PAGE_HEADER_SIZE + segment_index_++];
+                body_offset_ += lacing;
+            } while (lacing == 255 && segment_index_ < segment_count_);
+            if (lacing == 255) {
+                continue;
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+bool OggDemuxer::ParseHeader(const uint8_t* data, size_t size) {
+    // [0-7] "OpusHead", [8] version, [9] channel_count, [10-11] pre_skip,
+    // [12-15] input_sample_rate, [16-17] output_gain, [18] mapping_family
+    if (size < 19 || memcmp(data, "OpusHead", 8) != 0) {
+        return false;
+    }
+    channels_ = data[9];
+    pre_skip_ = data[10] | (data[11] << 8);
+    input_sample_rate_ = ReadLe32(data + 12);
+    pre_skip_left_ = pre_skip_;
+    ESP_LOGI(TAG, "OpusHead: version=%d, channels=%d, pre_skip=%u, sample_rate=%d",
+        data[8], channels_, pre_skip_, input_sample_rate_);
+    return true;
+}
+
+bool OggDemuxer::NextPacket(OggOpusPacket& packet) {
+    while (true) {
+        if (page_ == nullptr || segment_index_ >= segment_count_) {
+            if (!NextPage()) {
+                return false;
+            }
+            if (segment_index_ >= segment_count_) {
+                continue;
+            }
+        }
+
+        // Collect the segments of one packet, a lacing value below 255 ends it
+        size_t start = body_offset_;
+        size_t size = 0;
+        uint8_t lacing;
+        do {
+            lacing = page_[OGG_PAGE_HEADER_SIZE + segment_index_++];
+            size += lacing;
+        } while (lacing == 255 && segment_index_ < segment_count_);
+        body_offset_ += size;
+
+        if (lacing == 255) {
+            // Continues on the next page, drop what is left of the last reassembled packet
+            if (!continuing_) {
+                continued_.clear();
+            }
+            continued_.insert(continued_.end(), source_ + start, source_ + start + size);
+            continuing_ = true;
+            continue;
+        }
+
+        packet = OggOpusPacket();
+        if (continuing_) {
+            continued_.insert(continued_.end(), source_ + start, source_ + start + size);
+            packet.data = continued_.data();
+            packet.size = continued_.size();
+            packet.borrowed = false;
+            continuing_ = false;
+        } else {
+            continued_.clear();
+            packet.data = source_ + start;
+            packet.size = size;
+        }
+        if (packet.size == 0) {
+            continue;
+        }
+
+        if (header_packets_ == 0) {
+            if (ParseHeader(packet.data, packet.size)) {
+                header_packets_++;
+            }
+            continue;
+        }
+        if (header_packets_ == 1) {
+            if (packet.size >= 8 && memcmp(packet.data, "OpusTags", 8) == 0) {
+                header_packets_++;
+            }
+            continue;
+        }
+
+        packet.samples = GetPacketSamples(packet.data, packet.size);
+        if (packet.samples == 0) {
+            ESP_LOGW(TAG, "Skip invalid packet of %u bytes", packet.size);
+            continue;
+        }
+
+        // Spread the pre-skip over the first packets
+        packet.trim_start = std::min<uint32_t>(pre_skip_left_, packet.samples);
+        pre_skip_left_ -= packet.trim_start;
+        decoded_samples_ += packet.samples;
+
+        // The granule position of the last page is the total length including the pre-skip
+        if (page_eos_ && segment_index_ >= segment_count_ && page_granule_ >= 0 &&
+            decoded_samples_ > page_granule_) {
+            packet.trim_end = std::min<int64_t>(decoded_samples_ - page_granule_, packet.samples - packet.trim_start);
+        }
+        return true;
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef OGG_DEMUXER_H
+#define OGG_DEMUXER_H
+
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+struct OggOpusPacket {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    // True if data points into the source buffer, false if the packet spanned pages and was
+    // reassembled into a buffer owned by the demuxer (valid until the next NextPacket() call)
+    bool borrowed = true;
+    int samples = 0;            // Duration at 48 kHz, from the TOC byte
+    uint16_t trim_start = 0;    // Decoded samples (48 kHz) to drop from the front, for the pre-skip
+    uint16_t trim_end = 0;      // Decoded samples (48 kHz) to drop from the back, for the end granule
+};
+
+/*
+ * Ogg Opus demuxer over an in-memory file, such as the sounds mapped from flash.
+ *
+ * Pages are parsed one at a time and their CRC is checked; a corrupted page is skipped by looking
+ * for the next capture pattern. Audio packets are handed out as views into the source, so the
+ * source must outlive them. Only packets that span pages are copied.
+ *
+ * The pre-skip from OpusHead and the granule position of the last page are turned into per-packet
+ * trims, so the decoded audio has exactly the length of the original.
+ */
+class OggDemuxer {
+public:
+    explicit OggDemuxer(std::string_view source);
+
+    // Returns false at the end of the stream
+    bool NextPacket(OggOpusPacket& packet);
+
+    inline int channels() const { return channels_; }
+    inline int input_sample_rate() const { return input_sample_rate_; }
+    inline uint16_t pre_skip() const { return pre_skip_; }
+    inline uint32_t crc_errors() const { return crc_errors_; }
+
+    // Duration of an Opus packet in samples at 48 kHz, 0 if the packet is invalid
+    static int GetPacketSamples(const uint8_t* data, size_t size);
+
+private:
+    const uint8_t* source_;
+    size_t size_;
+    size_t offset_ = 0;
+
+    // Current page
+    const uint8_t* page_ = nullptr;
+    int segment_count_ = 0;
+    int segment_index_ = 0;
+    size_t body_offset_ = 0;    // Offset of the next segment's data in the source
+    bool page_eos_ = false;
+    int64_t page_granule_ = -1;
+
+    std::vector<uint8_t> continued_;
+    bool continuing_ = false;
+
+    int header_packets_ = 0;
+    int channels_ = 0;
+    int input_sample_rate_ = 0;
+    uint16_t pre_skip_ = 0;
+    uint32_t pre_skip_left_ = 0;
+    int64_t decoded_samples_ = 0;
+    uint32_t crc_errors_ = 0;
+
+    bool NextPage();
+    bool ParseHeader(const uint8_t* data, size_t size);
+};
+
+#endif // OGG_DEMUXER_H
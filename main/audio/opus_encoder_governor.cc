@@ -0,0 +1,111 @@
+#include "opus_encoder_governor.h"
+
+#include <esp_log.h>
+#include <algorithm>
+
+#define TAG "OpusEncoderGovernor"
+
+int OpusEncoderGovernor::GetMaxComplexity(const std::string& chip_model) {
+    // Ceilings for 16 kHz mono, leaving the audio processor and the UI their share of the CPU
+    if (chip_model == "esp32p4") {
+        return 8;
+    } else if (chip_model == "esp32s3") {
+        return 5;
+    } else if (chip_model == "esp32") {
+        return 3;
+    }
+    // Single core RISC-V chips (C2 / C3 / C5 / C6) keep the cheapest setting
+    return 0;
+}
+
+int OpusEncoderGovernor::GetMaxBitrate(const std::string& chip_model) {
+    // 16 kHz mono speech, the libopus default for it is about 17 kbps
+    if (chip_model == "esp32p4") {
+        return 32000;
+    } else if (chip_model == "esp32s3") {
+        return 24000;
+    } else if (chip_model == "esp32") {
+        return 20000;
+    }
+    return 16000;
+}
+
+OpusEncoderGovernor::OpusEncoderGovernor(const std::string& chip_model) {
+    max_complexity_ = GetMaxComplexity(chip_model);
+    max_bitrate_ = GetMaxBitrate(chip_model);
+    // Start in the middle and let the measurements decide; the network is assumed to keep up
+    complexity_ = max_complexity_ / 2;
+    bitrate_ = max_bitrate_;
+    stats_.complexity = complexity_;
+    stats_.max_complexity = max_complexity_;
+    stats_.bitrate = bitrate_;
+    stats_.max_bitrate = max_bitrate_;
+    ESP_LOGI(TAG, "Chip %s: complexity %d, max %d, bitrate %d", chip_model.c_str(), complexity_, max_complexity_,
+        bitrate_);
+}
+
+void OpusEncoderGovernor::ResetWindow() {
+    window_size_ = 0;
+    overloaded_ = false;
+    congested_ = false;
+    drained_ = true;
+}
+
+bool OpusEncoderGovernor::AddFrame(uint32_t encode_us, int frame_duration_ms, size_t encode_queue_size,
+    size_t send_queue_size, size_t send_queue_capacity) {
+    window_[window_size_++] = encode_us;
+    // More than one frame waiting means the encoder does not keep up, unless the network held it back
+    congested_ = congested_ || send_queue_size * 2 > send_queue_capacity;
+    drained_ = drained_ && send_queue_size <= 1;
+    overloaded_ = overloaded_ || (encode_queue_size > 1 && !congested_);
+    if (window_size_ < window_.size()) {
+        return false;
+    }
+
+    std::sort(window_.begin(), window_.end());
+    stats_.p50_us = window_[window_.size() / 2];
+    stats_.p95_us = window_[window_.size() * 95 / 100];
+    stats_.max_us = window_.back();
+    uint32_t frame_us = frame_duration_ms * 1000;
+    bool high_load = overloaded_ || stats_.p95_us * 100 > frame_us * OPUS_GOVERNOR_HIGH_LOAD_PERCENT;
+    bool low_load = !congested_ && stats_.p95_us * 100 < frame_us * OPUS_GOVERNOR_LOW_LOAD_PERCENT;
+    bool bitrate_changed = UpdateBitrate(frame_duration_ms);
+    ResetWindow();
+
+    int complexity = complexity_;
+    if (high_load && complexity_ > 0) {
+        // Two steps at once when far over the budget
+        complexity = std::max(0, complexity_ - (stats_.p95_us * 100 > frame_us * OPUS_GOVERNOR_HIGH_LOAD_PERCENT * 2 ? 2 : 1));
+        hold_windows_ = OPUS_GOVERNOR_HOLD_WINDOWS;
+    } else if (hold_windows_ > 0) {
+        hold_windows_--;
+    } else if (low_load && complexity_ < max_complexity_) {
+        complexity = complexity_ + 1;
+    }
+
+    if (complexity == complexity_) {
+        return bitrate_changed;
+    }
+    ESP_LOGI(TAG, "Complexity %d -> %d, encode time p50 %lu us, p95 %lu us, max %lu us (%d ms frames)",
+        complexity_, complexity, stats_.p50_us, stats_.p95_us, stats_.max_us, frame_duration_ms);
+    complexity_ = complexity;
+    stats_.complexity = complexity;
+    return true;
+}
+
+bool OpusEncoderGovernor::UpdateBitrate(int frame_duration_ms) {
+    int bitrate = bitrate_;
+    if (congested_) {
+        bitrate = std::max(OPUS_GOVERNOR_MIN_BITRATE, bitrate_ - OPUS_GOVERNOR_BITRATE_STEP);
+    } else if (drained_) {
+        bitrate = std::min(max_bitrate_, bitrate_ + OPUS_GOVERNOR_BITRATE_STEP);
+    }
+    if (bitrate == bitrate_) {
+        return false;
+    }
+    ESP_LOGI(TAG, "Bitrate %d -> %d, send queue %s (%d ms frames)", bitrate_, bitrate,
+        congested_ ? "backed up" : "drained", frame_duration_ms);
+    bitrate_ = bitrate;
+    stats_.bitrate = bitrate;
+    return true;
+}
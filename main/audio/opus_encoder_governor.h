@@ -0,0 +1,76 @@
+#ifndef OPUS_ENCODER_GOVERNOR_H
+#define OPUS_ENCODER_GOVERNOR_H
+
+#include <array>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// Encode times collected before the complexity is reconsidered
+#define OPUS_GOVERNOR_WINDOW_FRAMES 50
+// Encode time budget in percent of the frame duration: step down above high, step up below low
+#define OPUS_GOVERNOR_HIGH_LOAD_PERCENT 40
+#define OPUS_GOVERNOR_LOW_LOAD_PERCENT 15
+// Windows to wait after a step down before stepping up again
+#define OPUS_GOVERNOR_HOLD_WINDOWS 4
+// The bitrate steps between this floor and the ceiling of the chip, one step per window
+#define OPUS_GOVERNOR_MIN_BITRATE 12000
+#define OPUS_GOVERNOR_BITRATE_STEP 4000
+
+struct OpusEncoderGovernorStats {
+    int complexity = 0;
+    int max_complexity = 0;
+    int bitrate = 0;
+    int max_bitrate = 0;
+    uint32_t p50_us = 0;
+    uint32_t p95_us = 0;
+    uint32_t max_us = 0;
+};
+
+/*
+ * Chooses the Opus encoder complexity from the measured encode time, and the bitrate from the
+ * send queue depth.
+ *
+ * Both ceilings come from the chip model, so a P4 or S3 encodes at a higher quality than a C3.
+ * Each window of frames, the 95th percentile of the encode time is compared with the frame
+ * duration: the complexity steps down when the encoder uses too much of the frame or the encode
+ * queue backs up, and steps up again while there is headroom and the send queue is not backed up.
+ * The bitrate steps down while the send queue backs up, as the network does not keep up, and
+ * steps back up to the ceiling of the chip while the send queue stays drained.
+ * Only the encoder task calls it, other tasks read a copy of stats() that the encoder task publishes.
+ */
+class OpusEncoderGovernor {
+public:
+    explicit OpusEncoderGovernor(const std::string& chip_model);
+
+    inline int complexity() const { return complexity_; }
+    inline int bitrate() const { return bitrate_; }
+    inline const OpusEncoderGovernorStats& stats() const { return stats_; }
+    // Frames in the current window, 0 right after a window has ended
+    inline size_t window_frames() const { return window_size_; }
+
+    // Returns true when the complexity or the bitrate has changed
+    bool AddFrame(uint32_t encode_us, int frame_duration_ms, size_t encode_queue_size, size_t send_queue_size,
+        size_t send_queue_capacity);
+    // Start a new window, e.g. after the frame duration has changed
+    void ResetWindow();
+
+private:
+    int complexity_;
+    int max_complexity_;
+    int bitrate_;
+    int max_bitrate_;
+    int hold_windows_ = 0;
+    std::array<uint32_t, OPUS_GOVERNOR_WINDOW_FRAMES> window_;
+    size_t window_size_ = 0;
+    bool overloaded_ = false;
+    bool congested_ = false;
+    bool drained_ = true;
+    OpusEncoderGovernorStats stats_;
+
+    static int GetMaxComplexity(const std::string& chip_model);
+    static int GetMaxBitrate(const std::string& chip_model);
+    bool UpdateBitrate(int frame_duration_ms);
+};
+
+#endif // OPUS_ENCODER_GOVERNOR_H
@@ -0,0 +1,68 @@
+#include "opus_frame_encoder.h"
+
+#include <esp_log.h>
+
+#define TAG "OpusFrameEncoder"
+
+OpusFrameEncoder::OpusFrameEncoder(int sample_rate, int channels, int duration_ms)
+    : sample_rate_(sample_rate), duration_ms_(duration_ms) {
+    int error;
+    encoder_ = opus_encoder_create(sample_rate, channels, OPUS_APPLICATION_VOIP, &error);
+    if (encoder_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create audio encoder, error code: %d", error);
+    }
+    frame_size_ = sample_rate / 1000 * channels * duration_ms;
+    max_packet_size_ = OPUS_FRAME_ENCODER_MAX_BITRATE / 8 * duration_ms / 1000;
+    SetDtx(false);
+}
+
+OpusFrameEncoder::~OpusFrameEncoder() {
+    if (encoder_ != nullptr) {
+        opus_encoder_destroy(encoder_);
+    }
+}
+
+void OpusFrameEncoder::SetDtx(bool enable) {
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_SET_DTX(enable ? 1 : 0));
+    }
+}
+
+void OpusFrameEncoder::SetComplexity(int complexity) {
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_SET_COMPLEXITY(complexity));
+    }
+}
+
+void OpusFrameEncoder::SetBitrate(int bitrate) {
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_SET_BITRATE(bitrate));
+    }
+}
+
+bool OpusFrameEncoder::Encode(const std::vector<int16_t>& pcm, std::vector<uint8_t>& output, size_t offset) {
+    if (encoder_ == nullptr) {
+        return false;
+    }
+    if ((int)pcm.size() != frame_size_) {
+        ESP_LOGE(TAG, "Frame of %u samples, expected %d", pcm.size(), frame_size_);
+        return false;
+    }
+
+    // Opus needs the maximum packet size up front, the output is cut back to the packet afterwards
+    output.resize(offset + max_packet_size_);
+    int ret = opus_encode(encoder_, pcm.data(), frame_size_, output.data() + offset, max_packet_size_);
+    if (ret < 0) {
+        ESP_LOGE(TAG, "Failed to encode audio, error code: %d", ret);
+        output.resize(offset);
+        return false;
+    }
+    output.resize(offset + ret);
+    return true;
+}
+
+void OpusFrameEncoder::ResetState() {
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_RESET_STATE);
+    }
+}
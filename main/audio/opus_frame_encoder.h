@@ -0,0 +1,46 @@
+#ifndef OPUS_FRAME_ENCODER_H
+#define OPUS_FRAME_ENCODER_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include <opus.h>
+
+// Bounds the packet size. Wideband speech stays far below it, and the output buffer is sized (and
+// value-initialized by resize()) to one packet at this bitrate before encoding in place
+#define OPUS_FRAME_ENCODER_MAX_BITRATE 64000
+
+/*
+ * Uplink Opus encoder that writes each packet at an offset of the output buffer, so the transport
+ * can fill its header in the space left in front and send the packet without moving it (see
+ * AudioStreamPacket::headroom). Set up like OpusEncoderWrapper: VOIP application, no DTX.
+ *
+ * Unlike OpusEncoderWrapper it does not buffer: every call encodes exactly one frame, and the PCM
+ * is only read, so the caller keeps its buffer. Only the encoder task uses it.
+ */
+class OpusFrameEncoder {
+public:
+    OpusFrameEncoder(int sample_rate, int channels, int duration_ms);
+    ~OpusFrameEncoder();
+
+    inline int sample_rate() const { return sample_rate_; }
+    inline int duration_ms() const { return duration_ms_; }
+
+    void SetDtx(bool enable);
+    void SetComplexity(int complexity);
+    void SetBitrate(int bitrate);
+    // Encodes straight into output[offset] and resizes output to the end of the packet. The output
+    // keeps its capacity, so a pooled packet buffer is only allocated once
+    bool Encode(const std::vector<int16_t>& pcm, std::vector<uint8_t>& output, size_t offset = 0);
+    void ResetState();
+
+private:
+    OpusEncoder* encoder_ = nullptr;
+    int sample_rate_;
+    int duration_ms_;
+    int frame_size_;
+    int max_packet_size_;
+};
+
+#endif // OPUS_FRAME_ENCODER_H
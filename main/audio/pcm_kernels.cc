@@ -0,0 +1,117 @@
+#include "pcm_kernels.h"
+
+#include <cstring>
+#include <climits>
+
+static inline bool IsWordAligned(const void* ptr) {
+    return (reinterpret_cast<uintptr_t>(ptr) & 3) == 0;
+}
+
+// Word access through memcpy keeps strict aliasing happy and compiles to a single load / store
+static inline uint32_t LoadWord(const int16_t* ptr) {
+    uint32_t value;
+    memcpy(&value, __builtin_assume_aligned(ptr, 4), sizeof(value));
+    return value;
+}
+
+static inline void StoreWord(int16_t* ptr, uint32_t value) {
+    memcpy(__builtin_assume_aligned(ptr, 4), &value, sizeof(value));
+}
+
+void PcmDeinterleave(const int16_t* interleaved, int16_t* left, int16_t* right, size_t frames) {
+    size_t i = 0;
+    if (IsWordAligned(interleaved) && IsWordAligned(left) && IsWordAligned(right)) {
+        // Two stereo frames in, one word per channel out
+        for (size_t k = 0; k < frames / 2; k++) {
+            uint32_t v0 = LoadWord(interleaved + 4 * k);
+            uint32_t v1 = LoadWord(interleaved + 4 * k + 2);
+            StoreWord(left + 2 * k, (v0 & 0xFFFF) | (v1 << 16));
+            StoreWord(right + 2 * k, (v0 >> 16) | (v1 & 0xFFFF0000));
+        }
+        i = frames & ~size_t(1);
+    }
+    for (; i < frames; i++) {
+        left[i] = interleaved[2 * i];
+        right[i] = interleaved[2 * i + 1];
+    }
+}
+
+void PcmInterleave(const int16_t* left, const int16_t* right, int16_t* interleaved, size_t frames) {
+    size_t i = 0;
+    if (IsWordAligned(interleaved) && IsWordAligned(left) && IsWordAligned(right)) {
+        for (size_t k = 0; k < frames / 2; k++) {
+            uint32_t l = LoadWord(left + 2 * k);
+            uint32_t r = LoadWord(right + 2 * k);
+            StoreWord(interleaved + 4 * k, (l & 0xFFFF) | (r << 16));
+            StoreWord(interleaved + 4 * k + 2, (l >> 16) | (r & 0xFFFF0000));
+        }
+        i = frames & ~size_t(1);
+    }
+    for (; i < frames; i++) {
+        interleaved[2 * i] = left[i];
+        interleaved[2 * i + 1] = right[i];
+    }
+}
+
+void PcmExtractLeft(const int16_t* interleaved, int16_t* mono, size_t frames) {
+    size_t i = 0;
+    if (IsWordAligned(interleaved) && IsWordAligned(mono)) {
+        // Word k of the output is written after words 2k and 2k+1 of the input are read, so in-place is safe
+        for (size_t k = 0; k < frames / 2; k++) {
+            uint32_t v0 = LoadWord(interleaved + 4 * k);
+            uint32_t v1 = LoadWord(interleaved + 4 * k + 2);
+            StoreWord(mono + 2 * k, (v0 & 0xFFFF) | (v1 << 16));
+        }
+        i = frames & ~size_t(1);
+    }
+    for (; i < frames; i++) {
+        mono[i] = interleaved[2 * i];
+    }
+}
+
+int32_t PcmVolumeToGain(int volume) {
+    if (volume <= 0) {
+        return 0;
+    }
+    return (int64_t)volume * volume * 65536 / 10000;
+}
+
+static inline int32_t SaturateToInt32(int64_t value) {
+    return value > INT32_MAX ? INT32_MAX : (value < INT32_MIN ? INT32_MIN : (int32_t)value);
+}
+
+void PcmScaleToInt32(const int16_t* src, int32_t* dest, size_t samples, int32_t gain) {
+    size_t i = 0;
+    if (gain >= 0 && gain <= 65536) {
+        // |sample * gain| <= 2^31, a 32-bit multiply cannot overflow and needs no clamp
+        for (; i + 4 <= samples; i += 4) {
+            dest[i] = src[i] * gain;
+            dest[i + 1] = src[i + 1] * gain;
+            dest[i + 2] = src[i + 2] * gain;
+            dest[i + 3] = src[i + 3] * gain;
+        }
+        for (; i < samples; i++) {
+            dest[i] = src[i] * gain;
+        }
+        return;
+    }
+    for (; i < samples; i++) {
+        dest[i] = SaturateToInt32((int64_t)src[i] * gain);
+    }
+}
+
+void PcmScaleToInt32Duplicate(const int16_t* src, int32_t* dest, size_t samples, int32_t gain) {
+    if (gain >= 0 && gain <= 65536) {
+        for (size_t i = 0; i < samples; i++) {
+            int32_t value = src[i] * gain;
+            dest[2 * i] = value;
+            dest[2 * i + 1] = value;
+        }
+        return;
+    }
+    for (size_t i = 0; i < samples; i++) {
+        int32_t value = SaturateToInt32((int64_t)src[i] * gain);
+        dest[2 * i] = value;
+        dest[2 * i + 1] = value;
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef PCM_KERNELS_H
+#define PCM_KERNELS_H
+
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * PCM helpers for the realtime audio tasks. They never allocate and work on caller-owned buffers.
+ *
+ * The 2-channel kernels move one stereo frame per 32-bit word when all buffers are word aligned
+ * (little-endian, which is true for every ESP32 and the host), and fall back to a scalar loop otherwise.
+ */
+
+// interleaved: frames * 2 samples -> left / right: frames samples each
+void PcmDeinterleave(const int16_t* interleaved, int16_t* left, int16_t* right, size_t frames);
+
+// left / right: frames samples each -> interleaved: frames * 2 samples
+void PcmInterleave(const int16_t* left, const int16_t* right, int16_t* interleaved, size_t frames);
+
+// Keep the left channel of a 2-channel buffer, mono may alias interleaved
+void PcmExtractLeft(const int16_t* interleaved, int16_t* mono, size_t frames);
+
+// Output volume 0-100 -> Q16 gain, squared for a perceptually even curve (100 -> 65536)
+int32_t PcmVolumeToGain(int volume);
+
+// 16-bit samples scaled by a Q16 gain into the 32-bit I2S slot format, saturated
+void PcmScaleToInt32(const int16_t* src, int32_t* dest, size_t samples, int32_t gain);
+
+// Same, with every sample written twice (mono played on both slots of a stereo I2S frame)
+void PcmScaleToInt32Duplicate(const int16_t* src, int32_t* dest, size_t samples, int32_t gain);
+
+// 32-bit I2S slots shifted right into 16-bit samples, saturated to +/-INT16_MAX. Inline with a plain
+// loop, so the constant shift of the caller is folded in and the compiler can vectorize it
+inline void PcmInt32ToInt16(const int32_t* src, int16_t* dest, size_t samples, int shift) {
+    for (size_t i = 0; i < samples; i++) {
+        int32_t value = src[i] >> shift;
+        dest[i] = value > INT16_MAX ? INT16_MAX : (value < -INT16_MAX ? -INT16_MAX : (int16_t)value);
+    }
+}
+
+#endif // PCM_KERNELS_H
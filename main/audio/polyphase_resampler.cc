@@ -0,0 +1,174 @@
+#include "polyphase_resampler.h"
+
+#include <esp_log.h>
+#include <cmath>
+#include <algorithm>
+#include <numeric>
+
+#define TAG "PolyphaseResampler"
+
+// Zero crossings of the sinc on each side, at the lower of the two rates
+#define RESAMPLER_FAST_ZERO_CROSSINGS 4
+#define RESAMPLER_HIGH_ZERO_CROSSINGS 8
+// Passband edge relative to the lower Nyquist frequency
+#define RESAMPLER_FAST_ROLLOFF 0.85
+#define RESAMPLER_HIGH_ROLLOFF 0.90
+#define RESAMPLER_FAST_KAISER_BETA 6.0
+#define RESAMPLER_HIGH_KAISER_BETA 8.0
+// 32 KB of coefficients, enough for 11.025 kHz -> 16 kHz (640 phases)
+#define RESAMPLER_MAX_COEFFICIENTS 16384
+
+static double BesselI0(double x) {
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < sum * 1e-12) {
+            break;
+        }
+    }
+    return sum;
+}
+
+bool PolyphaseResampler::Configure(int input_sample_rate, int output_sample_rate, ResamplerQuality quality) {
+    if (input_sample_rate == input_sample_rate_ && output_sample_rate == output_sample_rate_ && quality == quality_) {
+        Reset();
+        return coefficients_.size() > 1;
+    }
+    input_sample_rate_ = input_sample_rate;
+    output_sample_rate_ = output_sample_rate;
+    quality_ = quality;
+
+    int gcd = std::gcd(input_sample_rate, output_sample_rate);
+    int up = output_sample_rate / gcd;
+    int down = input_sample_rate / gcd;
+    int zero_crossings = quality == kResamplerQualityFast ? RESAMPLER_FAST_ZERO_CROSSINGS : RESAMPLER_HIGH_ZERO_CROSSINGS;
+    // A decimating filter is longer in input samples, round up to a multiple of 4 for the dot product
+    int taps = (2 * zero_crossings * std::max(up, down) + up - 1) / up;
+    taps = (taps + 3) & ~3;
+    if (up * taps > RESAMPLER_MAX_COEFFICIENTS) {
+        ESP_LOGE(TAG, "Unsupported ratio %d -> %d (%d phases of %d taps)", input_sample_rate, output_sample_rate, up, taps);
+        up_ = down_ = taps_ = 1;
+        coefficients_.assign(1, INT16_MAX);
+        Reset();
+        return false;
+    }
+    up_ = up;
+    down_ = down;
+    taps_ = taps;
+
+    // Windowed-sinc prototype at up * input rate, cut off below the lower Nyquist frequency
+    double rolloff = quality == kResamplerQualityFast ? RESAMPLER_FAST_ROLLOFF : RESAMPLER_HIGH_ROLLOFF;
+    double beta = quality == kResamplerQualityFast ? RESAMPLER_FAST_KAISER_BETA : RESAMPLER_HIGH_KAISER_BETA;
+    double cutoff = rolloff * 0.5 / std::max(up, down);
+    int length = up * taps;
+    double center = (length - 1) / 2.0;
+    double window_norm = BesselI0(beta);
+    std::vector<double> prototype(length);
+    for (int k = 0; k < length; k++) {
+        double t = k - center;
+        double sinc = t == 0 ? 1.0 : std::sin(2 * M_PI * cutoff * t) / (2 * M_PI * cutoff * t);
+        double r = t / (center + 1);
+        double window = BesselI0(beta * std::sqrt(std::max(0.0, 1 - r * r))) / window_norm;
+        prototype[k] = sinc * window;
+    }
+
+    // Phase p uses prototype[j * up + p] on input[i - j], stored reversed for a forward dot product.
+    // Each phase is normalized to unity DC gain, the rounding error goes to its largest tap
+    coefficients_.resize(length);
+    for (int p = 0; p < up; p++) {
+        double sum = 0;
+        for (int j = 0; j < taps; j++) {
+            sum += prototype[j * up + p];
+        }
+        int16_t* phase = &coefficients_[p * taps];
+        int total = 0;
+        int largest = 0;
+        for (int j = 0; j < taps; j++) {
+            int q = taps - 1 - j;
+            phase[q] = (int16_t)std::lround(prototype[j * up + p] / sum * 32768);
+            total += phase[q];
+            if (std::abs(phase[q]) > std::abs(phase[largest])) {
+                largest = q;
+            }
+        }
+        phase[largest] = std::clamp(phase[largest] + 32768 - total, -32768, 32767);
+    }
+
+    buffer_.reserve(taps_ - 1 + input_sample_rate / 1000 * 120);
+    Reset();
+    ESP_LOGI(TAG, "Resampling %d -> %d: %d phases of %d taps, delay %d us",
+        input_sample_rate, output_sample_rate, up_, taps_, delay_us());
+    return true;
+}
+
+void PolyphaseResampler::Reset() {
+    buffer_.assign(taps_ - 1, 0);
+    position_ = 0;
+}
+
+int PolyphaseResampler::GetOutputSamples(int input_samples) const {
+    uint32_t limit = (uint32_t)input_samples * up_;
+    if (limit <= position_) {
+        return 0;
+    }
+    return (limit - position_ + down_ - 1) / down_;
+}
+
+int PolyphaseResampler::delay_us() const {
+    if (input_sample_rate_ == 0) {
+        return 0;
+    }
+    // Half the prototype length, in input samples
+    return (int64_t)(up_ * taps_ - 1) * 1000000 / (2LL * up_ * input_sample_rate_);
+}
+
+static inline int16_t DotProduct(const int16_t* x, const int16_t* c, int taps) {
+    // Two accumulators and a 4-sample step, the compiler maps this to 16-bit multiply-accumulates
+    int32_t acc0 = 1 << 14;
+    int32_t acc1 = 0;
+    for (int q = 0; q < taps; q += 4) {
+        acc0 += x[q] * c[q] + x[q + 1] * c[q + 1];
+        acc1 += x[q + 2] * c[q + 2] + x[q + 3] * c[q + 3];
+    }
+    int32_t y = (acc0 + acc1) >> 15;
+    return y > INT16_MAX ? INT16_MAX : (y < INT16_MIN ? INT16_MIN : y);
+}
+
+void PolyphaseResampler::Process(const int16_t* input, int input_samples, int16_t* output) {
+    // Unsupported ratio: a single unity tap, which the 4-tap dot product cannot take
+    if (taps_ == 1) {
+        std::copy(input, input + input_samples, output);
+        return;
+    }
+
+    size_t history = taps_ - 1;
+    buffer_.resize(history + input_samples);
+    std::copy(input, input + input_samples, buffer_.begin() + history);
+
+    // Output k of this call reads input index i and phase p, advancing by down_ / up_ input samples
+    uint32_t limit = (uint32_t)input_samples * up_;
+    uint32_t index = position_ / up_;
+    uint32_t phase = position_ % up_;
+    uint32_t step_index = down_ / up_;
+    uint32_t step_phase = down_ % up_;
+    uint32_t position = position_;
+    const int16_t* data = buffer_.data();
+    const int16_t* coefficients = coefficients_.data();
+    while (position < limit) {
+        *output++ = DotProduct(data + index, coefficients + phase * taps_, taps_);
+        position += down_;
+        index += step_index;
+        phase += step_phase;
+        if (phase >= (uint32_t)up_) {
+            phase -= up_;
+            index++;
+        }
+    }
+    position_ = position - limit;
+
+    // Keep the last taps_ - 1 samples as the history of the next call
+    std::copy(buffer_.end() - history, buffer_.end(), buffer_.begin());
+    buffer_.resize(history);
+}
@@ -0,0 +1,52 @@
+#ifndef POLYPHASE_RESAMPLER_H
+#define POLYPHASE_RESAMPLER_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+enum ResamplerQuality {
+    kResamplerQualityFast,  // Shorter filter: lower CPU and delay, wider transition band
+    kResamplerQualityHigh,
+};
+
+/*
+ * Fixed-point polyphase resampler for the rational ratios between the usual codec and Opus rates
+ * (24k -> 16k, 16k -> 24k, 24k -> 48k, 48k -> 16k, 44.1k -> 16k ...).
+ *
+ * Configure() reduces the ratio to up / down and builds a Q15 table with one windowed-sinc phase per
+ * output position, each phase normalized to unity DC gain. Process() is then one short dot product
+ * per output sample. The state carries over between calls, so any input length can be passed and
+ * GetOutputSamples() tells exactly how many samples the next Process() call writes.
+ */
+class PolyphaseResampler {
+public:
+    // Returns false if the ratio needs too large a table, the resampler then copies the input as it is
+    bool Configure(int input_sample_rate, int output_sample_rate, ResamplerQuality quality = kResamplerQualityHigh);
+    // Clears the filter history, for a new stream at the same rates
+    void Reset();
+    void Process(const int16_t* input, int input_samples, int16_t* output);
+    int GetOutputSamples(int input_samples) const;
+
+    inline int input_sample_rate() const { return input_sample_rate_; }
+    inline int output_sample_rate() const { return output_sample_rate_; }
+    inline int taps() const { return taps_; }
+    // Group delay of the filter
+    int delay_us() const;
+
+private:
+    int input_sample_rate_ = 0;
+    int output_sample_rate_ = 0;
+    ResamplerQuality quality_ = kResamplerQualityHigh;
+    int up_ = 1;
+    int down_ = 1;
+    int taps_ = 1;
+    // taps_ coefficients per phase, each phase reversed so it lines up with the input in time order
+    std::vector<int16_t> coefficients_;
+    // taps_ - 1 samples of history followed by the input being processed
+    std::vector<int16_t> buffer_;
+    // Position of the next output sample, in 1 / up_ input samples from the first new input sample
+    uint32_t position_ = 0;
+};
+
+#endif // POLYPHASE_RESAMPLER_H
@@ -1,5 +1,9 @@
 #include "afe_audio_processor.h"
+#include "audio_latency_tracer.h"
+
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <algorithm>
 
 #define PROCESSOR_RUNNING 0x01
 
@@ -76,6 +80,10 @@ void AfeAudioProcessor::Initialize(AudioCodec* codec, int frame_duration_ms, srm
     }, "audio_communication", 4096, this, 3, NULL);
 }
 
+void AfeAudioProcessor::SetFrameDuration(int frame_duration_ms) {
+    frame_samples_ = frame_duration_ms * 16000 / 1000;
+}
+
 AfeAudioProcessor::~AfeAudioProcessor() {
     if (afe_data_ != nullptr) {
         afe_iface_->destroy(afe_data_);
@@ -152,23 +160,34 @@ void AfeAudioProcessor::AudioProcessorTask() {
         }
 
         if (output_callback_) {
+            // Copy the output straight into the frame being filled, a full frame is handed over as is
+            const int16_t* data = res->data;
             size_t samples = res->data_size / sizeof(int16_t);
-            
-            // Add data to buffer
-            output_buffer_.insert(output_buffer_.end(), res->data, res->data + samples);
-            
-            // Output complete frames when buffer has enough data
-            while (output_buffer_.size() >= frame_samples_) {
-                if (output_buffer_.size() == frame_samples_) {
-                    // If buffer size equals frame size, move the entire buffer
+            size_t frame_samples = frame_samples_;
+            int64_t fetch_time = esp_timer_get_time();
+            while (samples > 0 || output_buffer_.size() >= frame_samples) {
+                if (output_buffer_.empty()) {
+                    output_fetch_time_ = fetch_time;
+                }
+                size_t count = std::min(samples, frame_samples - std::min(frame_samples, output_buffer_.size()));
+                output_buffer_.insert(output_buffer_.end(), data, data + count);
+                data += count;
+                samples -= count;
+                if (output_buffer_.size() < frame_samples) {
+                    continue;
+                }
+
+                AudioLatencyTracer::GetInstance().Record(kAudioLatencyFraming, output_fetch_time_, esp_timer_get_time());
+                if (output_buffer_.size() == frame_samples) {
+                    // The callback swaps in a recycled buffer, so this does not allocate
                     output_callback_(std::move(output_buffer_));
                     output_buffer_.clear();
-                    output_buffer_.reserve(frame_samples_);
                 } else {
-                    // If buffer size exceeds frame size, copy one frame and remove it
-                    output_callback_(std::vector<int16_t>(output_buffer_.begin(), output_buffer_.begin() + frame_samples_));
-                    output_buffer_.erase(output_buffer_.begin(), output_buffer_.begin() + frame_samples_);
+                    // Only after SetFrameDuration() made the frames shorter
+                    output_callback_(std::vector<int16_t>(output_buffer_.begin(), output_buffer_.begin() + frame_samples));
+                    output_buffer_.erase(output_buffer_.begin(), output_buffer_.begin() + frame_samples);
                 }
+                output_buffer_.reserve(frame_samples);
             }
         }
     }
@@ -3,15 +3,24 @@
 
 #if CONFIG_USE_AUDIO_DEBUGGER
 #include <esp_log.h>
+#include <esp_heap_caps.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <errno.h>
 #include <cstring>
 #include <string>
+#include <algorithm>
 #endif
 
 #define TAG "AudioDebugger"
 
+#ifdef CONFIG_AUDIO_DEBUG_BUFFER_KB
+#define AUDIO_DEBUG_BUFFER_SIZE (CONFIG_AUDIO_DEBUG_BUFFER_KB * 1024)
+#else
+#define AUDIO_DEBUG_BUFFER_SIZE (64 * 1024)
+#endif
+#define AUDIO_DEBUG_TASK_STACK_SIZE 4096
+
 
 AudioDebugger::AudioDebugger() {
 #if CONFIG_USE_AUDIO_DEBUGGER
@@ -20,16 +29,16 @@ AudioDebugger::AudioDebugger() {
         // 解析配置的服务器地址 "IP:PORT"
         std::string server_addr = CONFIG_AUDIO_DEBUG_UDP_SERVER;
         size_t colon_pos = server_addr.find(':');
-        
+
         if (colon_pos != std::string::npos) {
             std::string ip = server_addr.substr(0, colon_pos);
             int port = std::stoi(server_addr.substr(colon_pos + 1));
-            
+
             memset(&udp_server_addr_, 0, sizeof(udp_server_addr_));
             udp_server_addr_.sin_family = AF_INET;
             udp_server_addr_.sin_port = htons(port);
             inet_pton(AF_INET, ip.c_str(), &udp_server_addr_.sin_addr);
-            
+
             ESP_LOGI(TAG, "Initialized server address: %s", CONFIG_AUDIO_DEBUG_UDP_SERVER);
         } else {
             ESP_LOGW(TAG, "Invalid server address: %s, should be IP:PORT", CONFIG_AUDIO_DEBUG_UDP_SERVER);
@@ -39,11 +48,44 @@ AudioDebugger::AudioDebugger() {
     } else {
         ESP_LOGW(TAG, "Failed to create UDP socket: %d", errno);
     }
+
+    if (udp_sockfd_ < 0) {
+        return;
+    }
+
+    // The ring lives in PSRAM when there is some, it is only touched by memcpy
+    ring_struct_ = (StaticRingbuffer_t*)heap_caps_malloc(sizeof(StaticRingbuffer_t), MALLOC_CAP_INTERNAL);
+    ring_storage_ = (uint8_t*)heap_caps_malloc(AUDIO_DEBUG_BUFFER_SIZE, MALLOC_CAP_SPIRAM);
+    if (ring_storage_ == nullptr) {
+        ring_storage_ = (uint8_t*)heap_caps_malloc(AUDIO_DEBUG_BUFFER_SIZE, MALLOC_CAP_8BIT);
+    }
+    if (ring_struct_ == nullptr || ring_storage_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate the %u bytes buffer", AUDIO_DEBUG_BUFFER_SIZE);
+        return;
+    }
+    ring_ = xRingbufferCreateStatic(AUDIO_DEBUG_BUFFER_SIZE, RINGBUF_TYPE_NOSPLIT, ring_storage_, ring_struct_);
+
+    xTaskCreate([](void* arg) {
+        auto this_ = (AudioDebugger*)arg;
+        this_->SenderTask();
+    }, "audio_debugger", AUDIO_DEBUG_TASK_STACK_SIZE, this, 1, &sender_task_);
 #endif
 }
 
 AudioDebugger::~AudioDebugger() {
 #if CONFIG_USE_AUDIO_DEBUGGER
+    if (sender_task_ != nullptr) {
+        vTaskDelete(sender_task_);
+    }
+    if (ring_ != nullptr) {
+        vRingbufferDelete(ring_);
+    }
+    if (ring_storage_ != nullptr) {
+        heap_caps_free(ring_storage_);
+    }
+    if (ring_struct_ != nullptr) {
+        heap_caps_free(ring_struct_);
+    }
     if (udp_sockfd_ >= 0) {
         close(udp_sockfd_);
         ESP_LOGI(TAG, "Closed UDP socket");
@@ -51,18 +93,113 @@ AudioDebugger::~AudioDebugger() {
 #endif
 }
 
-void AudioDebugger::Feed(const std::vector<int16_t>& data) {
+void AudioDebugger::Feed(const std::vector<int16_t>& data, int sample_rate, int channels) {
 #if CONFIG_USE_AUDIO_DEBUGGER
-    if (udp_sockfd_ >= 0) {
-        ssize_t sent = sendto(udp_sockfd_, data.data(), data.size() * sizeof(int16_t), 0,
-                             (struct sockaddr*)&udp_server_addr_, sizeof(udp_server_addr_));
+    if (ring_ == nullptr) {
+        return;
+    }
+
+    // Count the frame even if it is dropped, so the receiver sees the gap
+    FrameInfo info = { frame_++, (uint32_t)sample_rate, (uint32_t)channels };
+    size_t size = sizeof(info) + data.size() * sizeof(int16_t);
+    void* item = nullptr;
+    if (xRingbufferSendAcquire(ring_, &item, size, 0) != pdTRUE || item == nullptr) {
+        if (dropped_frames_++ % 50 == 0) {
+            ESP_LOGW(TAG, "Buffer full, %lu frames dropped", dropped_frames_);
+        }
+        return;
+    }
+    memcpy(item, &info, sizeof(info));
+    memcpy((uint8_t*)item + sizeof(info), data.data(), data.size() * sizeof(int16_t));
+    xRingbufferSendComplete(ring_, item);
+#endif
+}
+
+void AudioDebugger::SenderTask() {
+#if CONFIG_USE_AUDIO_DEBUGGER
+    datagram_.resize(AUDIO_DEBUG_MAX_DATAGRAM_SIZE);
+    while (true) {
+        size_t size = 0;
+        auto item = (uint8_t*)xRingbufferReceive(ring_, &size, portMAX_DELAY);
+        if (item == nullptr) {
+            continue;
+        }
+        FrameInfo info;
+        memcpy(&info, item, sizeof(info));
+        SendFrame(info, (const int16_t*)(item + sizeof(info)), (size - sizeof(info)) / sizeof(int16_t));
+        vRingbufferReturnItem(ring_, item);
+    }
+#endif
+}
+
+void AudioDebugger::SendFrame(const FrameInfo& info, const int16_t* samples, size_t count) {
+#if CONFIG_USE_AUDIO_DEBUGGER
+    uint8_t encoding = AUDIO_DEBUG_ENCODING_PCM16;
+    const uint8_t* payload = (const uint8_t*)samples;
+    size_t payload_size = count * sizeof(int16_t);
+#if CONFIG_AUDIO_DEBUG_COMPRESS
+    // Delta against the previous sample of the same channel, restarted every frame so frames decode alone
+    int32_t previous[8] = {};
+    size_t channels = info.channels;
+    size_t size = 0;
+    payload_.resize(count * 3);
+    for (size_t i = 0; i < count && channels >= 1 && channels <= 8; i++) {
+        int32_t delta = samples[i] - previous[i % channels];
+        previous[i % channels] = samples[i];
+        uint32_t value = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+        while (value >= 0x80) {
+            payload_[size++] = (value & 0x7F) | 0x80;
+            value >>= 7;
+        }
+        payload_[size++] = value;
+    }
+    // Noise may not compress, then the frame goes out as it is
+    if (size > 0 && size < payload_size) {
+        encoding = AUDIO_DEBUG_ENCODING_DELTA_VARINT;
+        payload = payload_.data();
+        payload_size = size;
+    }
+#endif
+
+    const size_t max_fragment = AUDIO_DEBUG_MAX_DATAGRAM_SIZE - sizeof(AudioDebugHeader);
+    size_t fragments = std::max<size_t>(1, (payload_size + max_fragment - 1) / max_fragment);
+    if (fragments > 255 || info.channels > 255 || count / std::max<uint32_t>(info.channels, 1) > 65535) {
+        ESP_LOGW(TAG, "Frame %lu is too large (%u bytes)", info.frame, payload_size);
+        return;
+    }
+
+    AudioDebugHeader header;
+    memcpy(header.magic, AUDIO_DEBUG_MAGIC, sizeof(header.magic));
+    header.version = AUDIO_DEBUG_VERSION;
+    header.encoding = encoding;
+    header.frame = info.frame;
+    header.sample_rate = info.sample_rate;
+    header.samples = count / std::max<uint32_t>(info.channels, 1);
+    header.channels = info.channels;
+    header.fragments = fragments;
+    memset(header.reserved, 0, sizeof(header.reserved));
+    for (size_t i = 0; i < fragments; i++) {
+        size_t offset = i * max_fragment;
+        size_t size = std::min(max_fragment, payload_size - offset);
+        header.sequence = sequence_++;
+        header.fragment = i;
+        memcpy(datagram_.data(), &header, sizeof(header));
+        memcpy(datagram_.data() + sizeof(header), payload + offset, size);
+        ssize_t sent;
+        int retries = 0;
+        do {
+            sent = sendto(udp_sockfd_, datagram_.data(), sizeof(header) + size, 0,
+                         (struct sockaddr*)&udp_server_addr_, sizeof(udp_server_addr_));
+            // lwIP is out of buffers for a moment, this task can wait
+            if (sent < 0 && errno == ENOMEM && retries++ < 5) {
+                vTaskDelay(pdMS_TO_TICKS(2));
+                continue;
+            }
+            break;
+        } while (true);
         if (sent < 0) {
             ESP_LOGW(TAG, "Failed to send audio data to %s: %d", CONFIG_AUDIO_DEBUG_UDP_SERVER, errno);
-        } else {
-            ESP_LOGD(TAG, "Sent %d bytes audio data to %s", sent, CONFIG_AUDIO_DEBUG_UDP_SERVER);
         }
     }
 #endif
 }
-
- 
\ No newline at end of file
@@ -4,19 +4,74 @@
 #include <vector>
 #include <cstdint>
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/ringbuf.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 
+// Datagram format, parsed by scripts/audio_debug_server.py
+#define AUDIO_DEBUG_MAGIC "AD"
+#define AUDIO_DEBUG_VERSION 1
+#define AUDIO_DEBUG_ENCODING_PCM16 0
+#define AUDIO_DEBUG_ENCODING_DELTA_VARINT 1    // Per-channel delta, zigzag, LEB128 varint; lossless
+#define AUDIO_DEBUG_MAX_DATAGRAM_SIZE 1400
+
+// Little-endian header in front of every datagram. A frame larger than one datagram is split in fragments
+struct __attribute__((packed)) AudioDebugHeader {
+    char magic[2];
+    uint8_t version;
+    uint8_t encoding;
+    uint32_t sequence;      // Datagram counter, a gap means datagrams were lost on the network
+    uint32_t frame;         // Frame counter, a gap means the device dropped frames because the buffer was full
+    uint32_t sample_rate;
+    uint16_t samples;       // Samples per channel in the whole frame
+    uint8_t channels;       // Interleaved
+    uint8_t fragment;
+    uint8_t fragments;
+    uint8_t reserved[3];
+};
+
+/*
+ * Streams the input audio to a UDP receiver, e.g. mic plus reference for AEC tuning.
+ *
+ * Feed() runs on the audio input task, so it only copies the frame into a bounded ring and never
+ * blocks; a frame that does not fit is dropped and shows up as a gap in the frame counter. A
+ * low-priority task encodes the frames and sends them.
+ */
 class AudioDebugger {
 public:
     AudioDebugger();
     ~AudioDebugger();
 
-    void Feed(const std::vector<int16_t>& data);
+    void Feed(const std::vector<int16_t>& data, int sample_rate, int channels);
 
 private:
+    // Ring item header, followed by the samples
+    struct FrameInfo {
+        uint32_t frame;
+        uint32_t sample_rate;
+        uint32_t channels;
+    };
+
     int udp_sockfd_ = -1;
     struct sockaddr_in udp_server_addr_;
+
+    RingbufHandle_t ring_ = nullptr;
+    StaticRingbuffer_t* ring_struct_ = nullptr;
+    uint8_t* ring_storage_ = nullptr;
+    TaskHandle_t sender_task_ = nullptr;
+
+    // Audio input task only
+    uint32_t frame_ = 0;
+    uint32_t dropped_frames_ = 0;
+    // Sender task only
+    uint32_t sequence_ = 0;
+    std::vector<uint8_t> payload_;
+    std::vector<uint8_t> datagram_;
+
+    void SenderTask();
+    void SendFrame(const FrameInfo& info, const int16_t* samples, size_t count);
 };
 
-#endif 
\ No newline at end of file
+#endif
@@ -0,0 +1,76 @@
+#include "energy_vad.h"
+
+#include <cstdlib>
+
+// Noise floor at start, and the lowest it may go, in mean absolute amplitude
+#define ENERGY_VAD_INITIAL_FLOOR 100
+#define ENERGY_VAD_MIN_FLOOR 16
+
+EnergyVad::EnergyVad(const EnergyVadConfig& config) {
+    SetConfig(config);
+    Reset();
+}
+
+void EnergyVad::SetConfig(const EnergyVadConfig& config) {
+    config_ = config;
+    int frame_ms = ENERGY_VAD_FRAME_SAMPLES * 1000 / 16000;
+    attack_frames_ = config_.attack_ms > frame_ms ? config_.attack_ms / frame_ms : 1;
+    hangover_frames_ = config_.hangover_ms > frame_ms ? config_.hangover_ms / frame_ms : 1;
+}
+
+void EnergyVad::Reset() {
+    noise_floor_ = ENERGY_VAD_INITIAL_FLOOR;
+    speech_count_ = 0;
+    silence_count_ = 0;
+    speaking_ = false;
+}
+
+bool EnergyVad::IsSpeechFrame(const int16_t* samples) {
+    int32_t sum = 0;
+    int zcr = 0;
+    int16_t previous = samples[0];
+    for (size_t i = 0; i < ENERGY_VAD_FRAME_SAMPLES; i++) {
+        int16_t sample = samples[i];
+        sum += abs(sample);
+        zcr += (sample ^ previous) < 0;
+        previous = sample;
+    }
+    int32_t level = sum / ENERGY_VAD_FRAME_SAMPLES;
+
+    int32_t threshold = noise_floor_ * config_.threshold_ratio / 16;
+    bool speech = level > config_.min_level && level > threshold;
+    if (speech && zcr > config_.max_zcr && level < threshold * 2) {
+        // Noise-like, e.g. fan hiss just above the floor
+        speech = false;
+    }
+
+    // The floor drops quickly and rises slowly, much slower during speech so that a louder
+    // background is still learned eventually instead of being reported as speech forever
+    if (level < noise_floor_) {
+        noise_floor_ -= (noise_floor_ - level) >> 2;
+    } else {
+        noise_floor_ += ((level - noise_floor_) >> (speech || speaking_ ? 11 : 6)) + 1;
+    }
+    if (noise_floor_ < ENERGY_VAD_MIN_FLOOR) {
+        noise_floor_ = ENERGY_VAD_MIN_FLOOR;
+    }
+    return speech;
+}
+
+bool EnergyVad::Process(const int16_t* samples, size_t count) {
+    bool was_speaking = speaking_;
+    for (size_t offset = 0; offset + ENERGY_VAD_FRAME_SAMPLES <= count; offset += ENERGY_VAD_FRAME_SAMPLES) {
+        if (IsSpeechFrame(samples + offset)) {
+            silence_count_ = 0;
+            if (!speaking_ && ++speech_count_ >= attack_frames_) {
+                speaking_ = true;
+            }
+        } else {
+            speech_count_ = 0;
+            if (speaking_ && ++silence_count_ >= hangover_frames_) {
+                speaking_ = false;
+            }
+        }
+    }
+    return speaking_ != was_speaking;
+}
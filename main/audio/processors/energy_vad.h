@@ -0,0 +1,51 @@
+#ifndef ENERGY_VAD_H
+#define ENERGY_VAD_H
+
+#include <cstdint>
+#include <cstddef>
+
+// 10 ms analysis frames at 16 kHz
+#define ENERGY_VAD_FRAME_SAMPLES 160
+
+struct EnergyVadConfig {
+    int threshold_ratio = 48;   // Q4, speech is this many times louder than the noise floor (3.0, about +10 dB)
+    int min_level = 150;        // Mean absolute amplitude below which nothing is speech
+    int max_zcr = 80;           // Zero crossings per frame above which quiet frames are treated as noise
+    int attack_ms = 30;         // Speech needed before speaking is reported
+    int hangover_ms = 500;      // Silence needed before the end of speech is reported
+};
+
+/*
+ * Fixed-point voice activity detector for boards without the esp-sr audio front end.
+ *
+ * Every 10 ms frame is reduced to its mean absolute amplitude and zero-crossing count. The level is
+ * compared with a noise floor that follows the quiet frames, and frames that are only slightly above
+ * it but cross zero like hiss are rejected. Attack and hangover counters smooth the decisions, so
+ * a few frames of noise or a short pause do not flip the state. It costs a couple of instructions
+ * per sample.
+ */
+class EnergyVad {
+public:
+    explicit EnergyVad(const EnergyVadConfig& config = EnergyVadConfig());
+
+    void SetConfig(const EnergyVadConfig& config);
+    void Reset();
+
+    // 16 kHz mono samples, returns true when the speaking state has changed
+    bool Process(const int16_t* samples, size_t count);
+    inline bool speaking() const { return speaking_; }
+    inline int32_t noise_floor() const { return noise_floor_; }
+
+private:
+    EnergyVadConfig config_;
+    int attack_frames_ = 0;
+    int hangover_frames_ = 0;
+    int32_t noise_floor_ = 0;
+    int speech_count_ = 0;
+    int silence_count_ = 0;
+    bool speaking_ = false;
+
+    bool IsSpeechFrame(const int16_t* samples);
+};
+
+#endif // ENERGY_VAD_H
@@ -1,4 +1,6 @@
 #include "no_audio_processor.h"
+#include "pcm_kernels.h"
+#include "settings.h"
 #include <esp_log.h>
 
 #define TAG "NoAudioProcessor"
@@ -6,6 +8,25 @@
 void NoAudioProcessor::Initialize(AudioCodec* codec, int frame_duration_ms, srmodel_list_t* models_list) {
     codec_ = codec;
     frame_samples_ = frame_duration_ms * 16000 / 1000;
+    LoadVadConfig();
+}
+
+void NoAudioProcessor::LoadVadConfig() {
+    // Tunable per device, the defaults suit a MEMS microphone at a normal gain
+    EnergyVadConfig config;
+    Settings settings("vad", false);
+    config.threshold_ratio = settings.GetInt("ratio", config.threshold_ratio);
+    config.min_level = settings.GetInt("min_level", config.min_level);
+    config.max_zcr = settings.GetInt("max_zcr", config.max_zcr);
+    config.attack_ms = settings.GetInt("attack_ms", config.attack_ms);
+    config.hangover_ms = settings.GetInt("hangover_ms", config.hangover_ms);
+    vad_.SetConfig(config);
+    ESP_LOGI(TAG, "VAD ratio %d/16, min level %d, max zcr %d, attack %d ms, hangover %d ms",
+        config.threshold_ratio, config.min_level, config.max_zcr, config.attack_ms, config.hangover_ms);
+}
+
+void NoAudioProcessor::SetFrameDuration(int frame_duration_ms) {
+    frame_samples_ = frame_duration_ms * 16000 / 1000;
 }
 
 void NoAudioProcessor::Feed(std::vector<int16_t>&& data) {
@@ -14,23 +35,30 @@ void NoAudioProcessor::Feed(std::vector<int16_t>&& data) {
     }
 
     if (codec_->input_channels() == 2) {
-        // If input channels is 2, we need to fetch the left channel data
-        auto mono_data = std::vector<int16_t>(data.size() / 2);
-        for (size_t i = 0, j = 0; i < mono_data.size(); ++i, j += 2) {
-            mono_data[i] = data[j];
-        }
-        output_callback_(std::move(mono_data));
-    } else {
-        output_callback_(std::move(data));
+        // If input channels is 2, we need to fetch the left channel data (in place)
+        PcmExtractLeft(data.data(), data.data(), data.size() / 2);
+        data.resize(data.size() / 2);
+    }
+
+    if (vad_.Process(data.data(), data.size()) && vad_state_change_callback_) {
+        vad_state_change_callback_(vad_.speaking());
     }
+    output_callback_(std::move(data));
 }
 
 void NoAudioProcessor::Start() {
+    vad_.Reset();
     is_running_ = true;
 }
 
 void NoAudioProcessor::Stop() {
     is_running_ = false;
+    if (vad_.speaking()) {
+        vad_.Reset();
+        if (vad_state_change_callback_) {
+            vad_state_change_callback_(false);
+        }
+    }
 }
 
 bool NoAudioProcessor::IsRunning() {
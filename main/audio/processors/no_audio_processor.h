@@ -3,9 +3,11 @@
 
 #include <vector>
 #include <functional>
+#include <atomic>
 
 #include "audio_processor.h"
 #include "audio_codec.h"
+#include "energy_vad.h"
 
 class NoAudioProcessor : public AudioProcessor {
 public:
@@ -13,6 +15,7 @@ public:
     ~NoAudioProcessor() = default;
 
     void Initialize(AudioCodec* codec, int frame_duration_ms, srmodel_list_t* models_list) override;
+    void SetFrameDuration(int frame_duration_ms) override;
     void Feed(std::vector<int16_t>&& data) override;
     void Start() override;
     void Stop() override;
@@ -24,10 +27,14 @@ public:
 
 private:
     AudioCodec* codec_ = nullptr;
-    int frame_samples_ = 0;
+    // Written by SetFrameDuration() on the main task, read by the input task
+    std::atomic<int> frame_samples_ = 0;
     std::function<void(std::vector<int16_t>&& data)> output_callback_;
     std::function<void(bool speaking)> vad_state_change_callback_;
     bool is_running_ = false;
+    EnergyVad vad_;
+
+    void LoadVadConfig();
 };
 
 #endif 
\ No newline at end of file
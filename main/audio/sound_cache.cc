@@ -0,0 +1,79 @@
+#include "sound_cache.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <cstring>
+
+#define TAG "SoundCache"
+
+CachedSound::CachedSound(const void* sound, int sample_rate, const int16_t* data, size_t samples)
+    : sound(sound), sample_rate(sample_rate), samples(samples) {
+    pcm = (int16_t*)heap_caps_malloc(bytes(), MALLOC_CAP_SPIRAM);
+    if (pcm == nullptr) {
+        pcm = (int16_t*)heap_caps_malloc(bytes(), MALLOC_CAP_8BIT);
+    }
+    if (pcm == nullptr) {
+        this->samples = 0;
+        return;
+    }
+    memcpy(pcm, data, bytes());
+}
+
+CachedSound::~CachedSound() {
+    if (pcm != nullptr) {
+        heap_caps_free(pcm);
+    }
+}
+
+SoundCache::SoundCache(size_t max_bytes) : max_bytes_(max_bytes) {
+}
+
+std::shared_ptr<const CachedSound> SoundCache::Find(const void* sound, int sample_rate) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+        if ((*it)->sound == sound && (*it)->sample_rate == sample_rate) {
+            entries_.splice(entries_.begin(), entries_, it);
+            return entries_.front();
+        }
+    }
+    return nullptr;
+}
+
+bool SoundCache::Insert(const void* sound, int sample_rate, const int16_t* pcm, size_t samples) {
+    size_t bytes = samples * sizeof(int16_t);
+    if (samples == 0 || bytes > max_bytes_) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& entry : entries_) {
+        if (entry->sound == sound && entry->sample_rate == sample_rate) {
+            return true;
+        }
+    }
+    while (!entries_.empty() && bytes_ + bytes > max_bytes_) {
+        bytes_ -= entries_.back()->bytes();
+        entries_.pop_back();
+    }
+
+    auto entry = std::make_shared<const CachedSound>(sound, sample_rate, pcm, samples);
+    if (entry->samples == 0) {
+        ESP_LOGW(TAG, "Failed to allocate %u bytes", bytes);
+        return false;
+    }
+    entries_.push_front(entry);
+    bytes_ += bytes;
+    ESP_LOGI(TAG, "Cached sound of %u samples at %d Hz, %u / %u bytes used", samples, sample_rate, bytes_, max_bytes_);
+    return true;
+}
+
+void SoundCache::Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+    bytes_ = 0;
+}
+
+size_t SoundCache::bytes() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytes_;
+}
@@ -0,0 +1,50 @@
+#ifndef SOUND_CACHE_H
+#define SOUND_CACHE_H
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+// Decoded sound, mono PCM at the codec output sample rate
+struct CachedSound {
+    const void* sound;      // Identity of the encoded sound (its data pointer)
+    int sample_rate;
+    int16_t* pcm;           // In PSRAM when available
+    size_t samples;
+
+    CachedSound(const void* sound, int sample_rate, const int16_t* data, size_t samples);
+    ~CachedSound();
+    CachedSound(const CachedSound&) = delete;
+    CachedSound& operator=(const CachedSound&) = delete;
+
+    inline size_t bytes() const { return samples * sizeof(int16_t); }
+};
+
+/*
+ * LRU cache of decoded system sounds, bounded by the PCM bytes it holds.
+ *
+ * Entries are shared pointers, so a sound being played stays valid when it is evicted.
+ */
+class SoundCache {
+public:
+    explicit SoundCache(size_t max_bytes);
+
+    // Returns nullptr on a miss, a hit becomes the most recently used entry
+    std::shared_ptr<const CachedSound> Find(const void* sound, int sample_rate);
+    // Copies the PCM into the cache, evicting the least recently used entries to make room
+    bool Insert(const void* sound, int sample_rate, const int16_t* pcm, size_t samples);
+    void Clear();
+
+    size_t bytes();
+    inline size_t max_bytes() const { return max_bytes_; }
+
+private:
+    std::mutex mutex_;
+    std::list<std::shared_ptr<const CachedSound>> entries_;    // Most recently used first
+    size_t max_bytes_;
+    size_t bytes_ = 0;
+};
+
+#endif // SOUND_CACHE_H
@@ -19,6 +19,7 @@ public:
     virtual void Stop() = 0;
     virtual size_t GetFeedSize() = 0;
     virtual void EncodeWakeWordData() = 0;
+    // The Opus data follows AUDIO_PACKET_HEADROOM free bytes for the transport header
     virtual bool GetWakeWordOpus(std::vector<uint8_t>& opus) = 0;
     virtual const std::string& GetLastDetectedWakeWord() const = 0;
 };
@@ -0,0 +1,141 @@
+#include "wake_word_preroll.h"
+#include "audio_service.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <algorithm>
+#include <cassert>
+
+#define TAG "WakeWordPreroll"
+
+#define WAKE_WORD_PREROLL_MS 2000
+#define WAKE_WORD_PREROLL_RING_FRAMES 4
+#define WAKE_WORD_ENCODER_STACK_SIZE (4096 * 7)
+
+WakeWordPreroll::WakeWordPreroll()
+    : frame_samples_(16000 / 1000 * OPUS_FRAME_DURATION_MS),
+      max_packets_(WAKE_WORD_PREROLL_MS / OPUS_FRAME_DURATION_MS) {
+    ring_.resize(frame_samples_ * WAKE_WORD_PREROLL_RING_FRAMES);
+}
+
+WakeWordPreroll::~WakeWordPreroll() {
+    if (encoder_task_ != nullptr) {
+        // Holding the mutex makes sure the task is not in the middle of a frame
+        std::lock_guard<std::mutex> lock(mutex_);
+        vTaskDelete(encoder_task_);
+    }
+
+    if (encoder_task_stack_ != nullptr) {
+        heap_caps_free(encoder_task_stack_);
+    }
+
+    if (encoder_task_buffer_ != nullptr) {
+        heap_caps_free(encoder_task_buffer_);
+    }
+}
+
+void WakeWordPreroll::Start() {
+    if (encoder_task_ == nullptr) {
+        encoder_ = std::make_unique<OpusFrameEncoder>(16000, 1, OPUS_FRAME_DURATION_MS);
+        encoder_->SetComplexity(0); // 0 is the fastest
+
+        encoder_task_stack_ = (StackType_t*)heap_caps_malloc(WAKE_WORD_ENCODER_STACK_SIZE, MALLOC_CAP_SPIRAM);
+        assert(encoder_task_stack_ != nullptr);
+        encoder_task_buffer_ = (StaticTask_t*)heap_caps_malloc(sizeof(StaticTask_t), MALLOC_CAP_INTERNAL);
+        assert(encoder_task_buffer_ != nullptr);
+        encoder_task_ = xTaskCreateStatic([](void* arg) {
+            auto this_ = (WakeWordPreroll*)arg;
+            this_->EncoderTask();
+        }, "encode_wake_word", WAKE_WORD_ENCODER_STACK_SIZE, this, 2, encoder_task_stack_, encoder_task_buffer_);
+    }
+
+    // Feed() is not running yet, so the ring can be emptied here
+    std::lock_guard<std::mutex> lock(mutex_);
+    packets_.clear();
+    encoder_->ResetState();
+    read_pos_.store(write_pos_.load());
+    finishing_ = false;
+    finished_ = false;
+}
+
+void WakeWordPreroll::Feed(const int16_t* data, size_t samples) {
+    if (encoder_task_ == nullptr || finishing_) {
+        return;
+    }
+
+    size_t write = write_pos_.load(std::memory_order_relaxed);
+    if (write - read_pos_.load(std::memory_order_acquire) + samples > ring_.size()) {
+        // The encoder task fell behind, this leaves a gap in the pre-roll
+        overruns_++;
+        return;
+    }
+    size_t offset = write % ring_.size();
+    size_t first = std::min(samples, ring_.size() - offset);
+    std::copy(data, data + first, ring_.begin() + offset);
+    std::copy(data + first, data + samples, ring_.begin());
+    write_pos_.store(write + samples, std::memory_order_release);
+    xTaskNotifyGive(encoder_task_);
+}
+
+void WakeWordPreroll::Finish() {
+    finishing_ = true;
+    if (encoder_task_ != nullptr) {
+        xTaskNotifyGive(encoder_task_);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    finished_ = true;
+    packets_.push_back(std::vector<uint8_t>());
+    cv_.notify_all();
+}
+
+bool WakeWordPreroll::PopPacket(std::vector<uint8_t>& opus) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this]() {
+        return !packets_.empty();
+    });
+    opus.swap(packets_.front());
+    packets_.pop_front();
+    return !opus.empty();
+}
+
+void WakeWordPreroll::EncoderTask() {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        // Read the flag first, the frames fed before Finish() must still be encoded
+        bool finishing = finishing_;
+        std::lock_guard<std::mutex> lock(mutex_);
+        while (!finished_) {
+            size_t read = read_pos_.load(std::memory_order_relaxed);
+            if (write_pos_.load(std::memory_order_acquire) - read < frame_samples_) {
+                break;
+            }
+            frame_.resize(frame_samples_);
+            size_t offset = read % ring_.size();
+            size_t first = std::min(frame_samples_, ring_.size() - offset);
+            std::copy(ring_.begin() + offset, ring_.begin() + offset + first, frame_.begin());
+            std::copy(ring_.begin(), ring_.begin() + (frame_samples_ - first), frame_.begin() + first);
+            read_pos_.store(read + frame_samples_, std::memory_order_release);
+
+            // Keep about WAKE_WORD_PREROLL_MS, the buffer of the oldest packet is reused
+            std::vector<uint8_t> opus;
+            if (packets_.size() >= max_packets_) {
+                opus.swap(packets_.front());
+                packets_.pop_front();
+            }
+            if (encoder_->Encode(frame_, opus, AUDIO_PACKET_HEADROOM)) {
+                packets_.push_back(std::move(opus));
+                cv_.notify_all();
+            }
+        }
+
+        if (finishing && !finished_) {
+            ESP_LOGI(TAG, "Wake word pre-roll: %u packets, %lu overruns", packets_.size(), overruns_);
+            finished_ = true;
+            packets_.push_back(std::vector<uint8_t>());
+            cv_.notify_all();
+        }
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef WAKE_WORD_PREROLL_H
+#define WAKE_WORD_PREROLL_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "opus_frame_encoder.h"
+
+#include <deque>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+/*
+ * The audio before and during a wake word, sent to the server for voice recognition.
+ *
+ * The detection task feeds 16 kHz mono PCM into a small preallocated ring. A background task
+ * encodes each complete frame right away and keeps about WAKE_WORD_PREROLL_MS of Opus packets.
+ * When the wake word is detected, Finish() only has to wait for the frames still in the ring,
+ * so the packets are ready for PopPacket() almost immediately. Like the uplink, each packet starts
+ * with AUDIO_PACKET_HEADROOM free bytes for the transport header.
+ */
+class WakeWordPreroll {
+public:
+    WakeWordPreroll();
+    ~WakeWordPreroll();
+
+    // Drops the previous pre-roll and starts a new stream, called before detection starts
+    void Start();
+    // Called by the detection task only
+    void Feed(const int16_t* data, size_t samples);
+    // Ends the stream after the wake word, the frames left in the ring are still encoded
+    void Finish();
+    // Blocks until a packet is ready, returns false after the last packet of the stream.
+    // The Opus data follows AUDIO_PACKET_HEADROOM free bytes
+    bool PopPacket(std::vector<uint8_t>& opus);
+
+private:
+    TaskHandle_t encoder_task_ = nullptr;
+    StaticTask_t* encoder_task_buffer_ = nullptr;
+    StackType_t* encoder_task_stack_ = nullptr;
+    std::unique_ptr<OpusFrameEncoder> encoder_;
+
+    // PCM ring, single producer (Feed) and single consumer (the encoder task)
+    std::vector<int16_t> ring_;
+    size_t frame_samples_;
+    std::atomic<size_t> write_pos_ = 0;
+    std::atomic<size_t> read_pos_ = 0;
+    std::atomic<bool> finishing_ = false;
+    uint32_t overruns_ = 0;
+
+    // Encoder state, the packets and the frame being encoded are guarded by the mutex
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::vector<uint8_t>> packets_;
+    size_t max_packets_;
+    std::vector<int16_t> frame_;
+    bool finished_ = false;
+
+    void EncoderTask();
+};
+
+#endif // WAKE_WORD_PREROLL_H
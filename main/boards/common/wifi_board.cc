@@ -202,7 +202,7 @@ std::string WifiBoard::GetDeviceStatusJson() {
 
     // Audio speaker
     auto audio_speaker = cJSON_CreateObject();
-    auto audio_codec = board.GetAudioCodec();
+    auto audio_codec = Application::GetInstance().GetAudioService().codec();
     if (audio_codec) {
         cJSON_AddNumberToObject(audio_speaker, "volume", audio_codec->output_volume());
     }
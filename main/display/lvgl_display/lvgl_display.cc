@@ -100,7 +100,7 @@ void LvglDisplay::ShowNotification(const char* notification, int duration_ms) {
 void LvglDisplay::UpdateStatusBar(bool update_all) {
     auto& app = Application::GetInstance();
     auto& board = Board::GetInstance();
-    auto codec = board.GetAudioCodec();
+    auto codec = app.GetAudioService().codec();
 
     // Update mute icon
     {
@@ -109,11 +109,12 @@ void LvglDisplay::UpdateStatusBar(bool update_all) {
             return;
         }
 
-        // 如果静音状态改变，则更新图标
-        if (codec->output_volume() == 0 && !muted_) {
+        // 如果静音状态改变，则更新图标 (the codec is set once the audio service is initialized)
+        int volume = codec != nullptr ? codec->output_volume() : -1;
+        if (volume == 0 && !muted_) {
             muted_ = true;
             lv_label_set_text(mute_label_, FONT_AWESOME_VOLUME_XMARK);
-        } else if (codec->output_volume() > 0 && muted_) {
+        } else if (volume > 0 && muted_) {
             muted_ = false;
             lv_label_set_text(mute_label_, "");
         }
@@ -59,8 +59,8 @@ void McpServer::AddCommonTools() {
         PropertyList({
             Property("volume", kPropertyTypeInteger, 0, 100)
         }), 
-        [&board](const PropertyList& properties) -> ReturnValue {
-            auto codec = board.GetAudioCodec();
+        [](const PropertyList& properties) -> ReturnValue {
+            auto codec = Application::GetInstance().GetAudioService().codec();
             codec->SetOutputVolume(properties["volume"].value<int>());
             return true;
         });
@@ -134,6 +134,39 @@ void McpServer::AddUserOnlyTools() {
             return board.GetSystemInfoJson();
         });
 
+    AddUserOnlyTool("self.audio.get_latency_stats",
+        "Get the latency histograms of the audio pipeline stages (capture to send, receive to playback, "
+        "wake word to first packet, reply to sound). Set `reset` to clear them after reading.",
+        PropertyList({
+            Property("reset", kPropertyTypeBoolean, false)
+        }),
+        [](const PropertyList& properties) -> ReturnValue {
+            auto& tracer = AudioLatencyTracer::GetInstance();
+            auto json = tracer.GetReportJson();
+            if (properties["reset"].value<bool>()) {
+                tracer.Reset();
+            }
+            return json;
+        });
+
+    AddUserOnlyTool("self.audio.measure_latency",
+        "Play a chirp and capture it to measure the speaker to mic latency, with the I2S DMA buffering of each "
+        "direction and the input resampler delay included in it. Only works while the device is idle.",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            RoundTripLatency latency;
+            if (!Application::GetInstance().GetAudioService().MeasureRoundTripLatency(latency)) {
+                throw std::runtime_error("Failed to measure the latency, audio is busy or the chirp was not heard");
+            }
+            cJSON* json = cJSON_CreateObject();
+            cJSON_AddNumberToObject(json, "latency_ms", latency.latency_us / 1000.0);
+            cJSON_AddNumberToObject(json, "output_dma_ms", latency.output_dma_us / 1000.0);
+            cJSON_AddNumberToObject(json, "input_dma_ms", latency.input_dma_us / 1000.0);
+            cJSON_AddNumberToObject(json, "resampler_ms", latency.resampler_us / 1000.0);
+            cJSON_AddNumberToObject(json, "correlation", latency.correlation / 1000.0);
+            return json;
+        });
+
     AddUserOnlyTool("self.reboot", "Reboot the system",
         PropertyList(),
         [this](const PropertyList& properties) -> ReturnValue {
@@ -0,0 +1,165 @@
+#include "loopback_protocol.h"
+#include "audio_service.h"
+
+#include <cstring>
+#include <cJSON.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/task.h>
+
+#define TAG "LoopbackProtocol"
+
+LoopbackProtocol::LoopbackProtocol() {
+    event_group_handle_ = xEventGroupCreate();
+    server_sample_rate_ = 16000;
+    server_frame_duration_ = OPUS_FRAME_DURATION_MS;
+
+    xTaskCreate([](void* arg) {
+        auto protocol = (LoopbackProtocol*)arg;
+        protocol->ReplyTask();
+        vTaskDelete(NULL);
+    }, "loopback_reply", 4096, this, 2, NULL);
+}
+
+LoopbackProtocol::~LoopbackProtocol() {
+    vEventGroupDelete(event_group_handle_);
+}
+
+bool LoopbackProtocol::Start() {
+    if (on_connected_ != nullptr) {
+        on_connected_();
+    }
+    return true;
+}
+
+bool LoopbackProtocol::OpenAudioChannel() {
+    ESP_LOGI(TAG, "Opening loopback audio channel");
+    session_id_ = "loopback";
+    error_occurred_ = false;
+    channel_opened_ = true;
+    last_incoming_time_ = std::chrono::steady_clock::now();
+    if (on_audio_channel_opened_ != nullptr) {
+        on_audio_channel_opened_();
+    }
+    return true;
+}
+
+void LoopbackProtocol::CloseAudioChannel() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        channel_opened_ = false;
+        listening_ = false;
+        turn_packets_.clear();
+        turn_duration_ms_ = 0;
+    }
+    if (on_audio_channel_closed_ != nullptr) {
+        on_audio_channel_closed_();
+    }
+}
+
+bool LoopbackProtocol::IsAudioChannelOpened() const {
+    return channel_opened_ && !error_occurred_;
+}
+
+bool LoopbackProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!channel_opened_ || !listening_) {
+        return channel_opened_;
+    }
+    turn_duration_ms_ += packet->frame_duration;
+    // The packets are decoded like a reply, without the transport headroom
+    packet->RemoveHeadroom();
+    turn_packets_.push_back(std::move(packet));
+    if (turn_duration_ms_ >= LOOPBACK_MAX_TURN_MS) {
+        EndTurn();
+    }
+    return true;
+}
+
+bool LoopbackProtocol::SendText(const std::string& text) {
+    cJSON* root = cJSON_Parse(text.c_str());
+    if (root == nullptr) {
+        return false;
+    }
+
+    auto type = cJSON_GetObjectItem(root, "type");
+    auto state = cJSON_GetObjectItem(root, "state");
+    if (cJSON_IsString(type)) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (strcmp(type->valuestring, "listen") == 0 && cJSON_IsString(state)) {
+            if (strcmp(state->valuestring, "start") == 0) {
+                listening_ = true;
+                aborted_ = false;
+            } else if (strcmp(state->valuestring, "stop") == 0) {
+                EndTurn();
+            }
+        } else if (strcmp(type->valuestring, "abort") == 0) {
+            aborted_ = true;
+        }
+    }
+    cJSON_Delete(root);
+    return true;
+}
+
+void LoopbackProtocol::EndTurn() {
+    // Called with mutex_ held
+    listening_ = false;
+    turn_duration_ms_ = 0;
+    xEventGroupSetBits(event_group_handle_, LOOPBACK_PROTOCOL_REPLY_EVENT);
+}
+
+void LoopbackProtocol::SendTtsState(const char* state) {
+    if (on_incoming_json_ == nullptr) {
+        return;
+    }
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "type", "tts");
+    cJSON_AddStringToObject(root, "state", state);
+    on_incoming_json_(root);
+    cJSON_Delete(root);
+}
+
+void LoopbackProtocol::ReplyTask() {
+    while (true) {
+        xEventGroupWaitBits(event_group_handle_, LOOPBACK_PROTOCOL_REPLY_EVENT, pdTRUE, pdFALSE, portMAX_DELAY);
+
+        std::deque<std::unique_ptr<AudioStreamPacket>> packets;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            packets.swap(turn_packets_);
+        }
+        if (packets.empty()) {
+            continue;
+        }
+
+        ESP_LOGI(TAG, "Replying %u packets", packets.size());
+        SendTtsState("start");
+        // Give the application one frame to enter the speaking state
+        vTaskDelay(pdMS_TO_TICKS(packets.front()->frame_duration));
+
+        uint32_t sequence = 0;
+        int64_t start_time = esp_timer_get_time();
+        int64_t elapsed_ms = 0;
+        for (auto& packet : packets) {
+            if (aborted_ || !channel_opened_) {
+                break;
+            }
+            packet->sequence = ++sequence;
+            packet->timestamp = 0;
+            packet->origin_time = esp_timer_get_time();
+            packet->stage_time = 0;
+            elapsed_ms += packet->frame_duration;
+            last_incoming_time_ = std::chrono::steady_clock::now();
+            if (on_incoming_audio_ != nullptr) {
+                on_incoming_audio_(std::move(packet));
+            }
+
+            // Real-time pace, like a server streaming TTS
+            int64_t remaining_ms = start_time / 1000 + elapsed_ms - esp_timer_get_time() / 1000;
+            if (remaining_ms > 0) {
+                vTaskDelay(pdMS_TO_TICKS(remaining_ms));
+            }
+        }
+        SendTtsState("stop");
+    }
+}
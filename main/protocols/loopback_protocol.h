@@ -0,0 +1,52 @@
+#ifndef _LOOPBACK_PROTOCOL_H_
+#define _LOOPBACK_PROTOCOL_H_
+
+
+#include "protocol.h"
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+
+#define LOOPBACK_PROTOCOL_REPLY_EVENT (1 << 0)
+// A turn is replied when listening stops, or when it gets this long (auto and realtime modes)
+#define LOOPBACK_MAX_TURN_MS 6000
+
+/*
+ * Stand-in for the server, used to benchmark the audio pipeline without a network.
+ *
+ * The audio sent during a listening turn is played back as the reply: when the turn ends the
+ * protocol sends "tts start", feeds the recorded packets back as incoming audio at real-time pace,
+ * and sends "tts stop". In auto mode the device then starts listening again, so a conversation
+ * runs without any user input.
+ */
+class LoopbackProtocol : public Protocol {
+public:
+    LoopbackProtocol();
+    ~LoopbackProtocol();
+
+    bool Start() override;
+    bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) override;
+    bool OpenAudioChannel() override;
+    void CloseAudioChannel() override;
+    bool IsAudioChannelOpened() const override;
+
+private:
+    EventGroupHandle_t event_group_handle_;
+    std::mutex mutex_;
+    std::deque<std::unique_ptr<AudioStreamPacket>> turn_packets_;
+    int turn_duration_ms_ = 0;
+    bool listening_ = false;
+    // Also read by the reply task for every packet, without mutex_
+    std::atomic<bool> channel_opened_ = false;
+    std::atomic<bool> aborted_ = false;
+
+    bool SendText(const std::string& text) override;
+    void EndTurn();
+    void ReplyTask();
+    void SendTtsState(const char* state);
+};
+
+#endif
@@ -5,6 +5,7 @@
 
 #include <esp_log.h>
 #include <cstring>
+#include <cstdlib>
 #include <arpa/inet.h>
 #include "assets/lang_config.h"
 
@@ -28,6 +29,17 @@ MqttProtocol::MqttProtocol() {
         .arg = this,
     };
     esp_timer_create(&reconnect_timer_args, &reconnect_timer_);
+
+    esp_timer_create_args_t stats_timer_args = {
+        .callback = [](void* arg) {
+            MqttProtocol* protocol = (MqttProtocol*)arg;
+            Application::GetInstance().Schedule([protocol]() {
+                protocol->SendReceiveStats();
+            });
+        },
+        .arg = this,
+    };
+    esp_timer_create(&stats_timer_args, &stats_timer_);
 }
 
 MqttProtocol::~MqttProtocol() {
@@ -36,6 +48,10 @@ MqttProtocol::~MqttProtocol() {
         esp_timer_stop(reconnect_timer_);
         esp_timer_delete(reconnect_timer_);
     }
+    if (stats_timer_ != nullptr) {
+        esp_timer_stop(stats_timer_);
+        esp_timer_delete(stats_timer_);
+    }
 
     udp_.reset();
     mqtt_.reset();
@@ -158,24 +174,21 @@ bool MqttProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
         return false;
     }
 
-    std::string nonce(aes_nonce_);
-    *(uint16_t*)&nonce[2] = htons(packet->payload.size());
-    *(uint32_t*)&nonce[8] = htonl(packet->timestamp);
-    *(uint32_t*)&nonce[12] = htonl(++local_sequence_);
-
-    std::string encrypted;
-    encrypted.resize(aes_nonce_.size() + packet->payload.size());
-    memcpy(encrypted.data(), nonce.data(), nonce.size());
-
-    size_t nc_off = 0;
-    uint8_t stream_block[16] = {0};
-    if (mbedtls_aes_crypt_ctr(&aes_ctx_, packet->payload.size(), &nc_off, (uint8_t*)nonce.c_str(), stream_block,
-        (uint8_t*)packet->payload.data(), (uint8_t*)&encrypted[nonce.size()]) != 0) {
+    // The nonce goes in the headroom the encoder left in front of the payload, which is encrypted in
+    // place, so the datagram is built inside the packet
+    size_t payload_size = packet->payload_size();
+    auto datagram = MqttUdpEncryptPacket(&aes_ctx_, (const uint8_t*)aes_nonce_.data(), ++local_sequence_, *packet);
+    if (datagram == nullptr) {
         ESP_LOGE(TAG, "Failed to encrypt audio data");
         return false;
     }
 
-    return udp_->Send(encrypted) > 0;
+    // Udp comes from the esp-ml307 component, and Send(const std::string&) is its only way to send, for
+    // both the lwIP socket and the ML307 modem. A pointer overload has to be added there, to the interface
+    // and both implementations. Until then the datagram is copied once into a string that keeps its
+    // capacity: one memcpy of the datagram per packet, no allocation
+    udp_send_buffer_.assign((const char*)datagram, MQTT_AES_NONCE_SIZE + payload_size);
+    return udp_->Send(udp_send_buffer_) > 0;
 }
 
 void MqttProtocol::CloseAudioChannel() {
@@ -183,6 +196,8 @@ void MqttProtocol::CloseAudioChannel() {
         std::lock_guard<std::mutex> lock(channel_mutex_);
         udp_.reset();
     }
+    esp_timer_stop(stats_timer_);
+    SendReceiveStats();
 
     std::string message = "{";
     message += "\"session_id\":\"" + session_id_ + "\",";
@@ -229,47 +244,36 @@ bool MqttProtocol::OpenAudioChannel() {
          * |type 1u|flags 1u|payload_len 2u|ssrc 4u|timestamp 4u|sequence 4u|
          * |payload payload_len|
          */
-        if (data.size() < sizeof(aes_nonce_)) {
-            ESP_LOGE(TAG, "Invalid audio packet size: %u", data.size());
+        auto datagram = (const uint8_t*)data.data();
+        uint32_t timestamp, sequence;
+        if (!MqttUdpParseHeader(datagram, data.size(), timestamp, sequence)) {
+            ESP_LOGE(TAG, "Invalid audio packet of %u bytes, type: %x", data.size(), data.empty() ? 0 : data[0]);
             return;
         }
-        if (data[0] != 0x01) {
-            ESP_LOGE(TAG, "Invalid audio packet type: %x", data[0]);
+        int64_t receive_time = esp_timer_get_time();
+        if (!AcceptRemoteSequence(sequence, receive_time)) {
             return;
         }
-        uint32_t timestamp = ntohl(*(uint32_t*)&data[8]);
-        uint32_t sequence = ntohl(*(uint32_t*)&data[12]);
-        if (sequence < remote_sequence_) {
-            ESP_LOGW(TAG, "Received audio packet with old sequence: %lu, expected: %lu", sequence, remote_sequence_);
-            return;
-        }
-        if (sequence != remote_sequence_ + 1) {
-            ESP_LOGW(TAG, "Received audio packet with wrong sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
-        }
 
-        size_t decrypted_size = data.size() - aes_nonce_.size();
-        size_t nc_off = 0;
-        uint8_t stream_block[16] = {0};
-        auto nonce = (uint8_t*)data.data();
-        auto encrypted = (uint8_t*)data.data() + aes_nonce_.size();
-        auto packet = std::make_unique<AudioStreamPacket>();
+        // The payload is decrypted straight into the pooled packet
+        auto packet = NewAudioStreamPacket();
+        packet->origin_time = receive_time;
         packet->sample_rate = server_sample_rate_;
         packet->frame_duration = server_frame_duration_;
         packet->timestamp = timestamp;
-        packet->payload.resize(decrypted_size);
-        int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, nonce, stream_block, encrypted, (uint8_t*)packet->payload.data());
-        if (ret != 0) {
-            ESP_LOGE(TAG, "Failed to decrypt audio data, ret: %d", ret);
+        packet->sequence = sequence;
+        if (!MqttUdpDecryptPayload(&aes_ctx_, datagram, data.size(), packet->payload)) {
+            ESP_LOGE(TAG, "Failed to decrypt audio data");
             return;
         }
         if (on_incoming_audio_ != nullptr) {
             on_incoming_audio_(std::move(packet));
         }
-        remote_sequence_ = sequence;
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
     udp_->Connect(udp_server_, udp_port_);
+    esp_timer_start_periodic(stats_timer_, MQTT_UDP_STATS_INTERVAL_MS * 1000);
 
     if (on_audio_channel_opened_ != nullptr) {
         on_audio_channel_opened_();
@@ -286,8 +290,12 @@ std::string MqttProtocol::GetHelloMessage() {
     cJSON* features = cJSON_CreateObject();
 #if CONFIG_USE_SERVER_AEC
     cJSON_AddBoolToObject(features, "aec", true);
+#endif
+#if CONFIG_USE_UPLINK_DTX
+    cJSON_AddBoolToObject(features, "dtx", true);
 #endif
     cJSON_AddBoolToObject(features, "mcp", true);
+    cJSON_AddBoolToObject(features, "udp_stats", true);
     cJSON_AddItemToObject(root, "features", features);
     cJSON* audio_params = cJSON_CreateObject();
     cJSON_AddStringToObject(audio_params, "format", "opus");
@@ -326,6 +334,9 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
         if (cJSON_IsNumber(frame_duration)) {
             server_frame_duration_ = frame_duration->valueint;
         }
+        // frame_duration is the downlink, the uplink only changes if the server asks for it
+        auto uplink_frame_duration = cJSON_GetObjectItem(audio_params, "uplink_frame_duration");
+        server_uplink_frame_duration_ = cJSON_IsNumber(uplink_frame_duration) ? uplink_frame_duration->valueint : 0;
     }
 
     auto udp = cJSON_GetObjectItem(root, "udp");
@@ -340,14 +351,137 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
 
     // auto encryption = cJSON_GetObjectItem(udp, "encryption")->valuestring;
     // ESP_LOGI(TAG, "UDP server: %s, port: %d, encryption: %s", udp_server_.c_str(), udp_port_, encryption);
+    auto aes_key = DecodeHexString(key);
     aes_nonce_ = DecodeHexString(nonce);
+    if (aes_key.size() != 16 || aes_nonce_.size() != MQTT_AES_NONCE_SIZE) {
+        ESP_LOGE(TAG, "Invalid UDP key or nonce size: %u, %u", aes_key.size(), aes_nonce_.size());
+        return;
+    }
     mbedtls_aes_init(&aes_ctx_);
-    mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)DecodeHexString(key).c_str(), 128);
+    mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)aes_key.c_str(), 128);
     local_sequence_ = 0;
-    remote_sequence_ = 0;
+    ResetReceiveStats();
     xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 }
 
+void MqttProtocol::ResetReceiveStats() {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    remote_sequence_ = 0;
+    remote_window_ = 0;
+    base_sequence_ = 0;
+    expected_prior_ = 0;
+    bad_sequence_ = 0;
+    last_transit_us_ = 0;
+    last_arrival_us_ = 0;
+    jitter_us_x16_ = 0;
+    reported_expected_ = 0;
+    reported_received_ = 0;
+    receive_stats_ = UdpReceiveStats();
+}
+
+// Duplicates and packets behind the reorder window are dropped, everything else is counted and
+// handed to the jitter buffer, which plays it in sequence order
+bool MqttProtocol::AcceptRemoteSequence(uint32_t sequence, int64_t now_us) {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    auto& stats = receive_stats_;
+    bool restart = false;
+    if (stats.received == 0 && stats.late == 0) {
+        restart = true;
+    } else {
+        int32_t offset = (int32_t)(sequence - remote_sequence_);
+        // Distance behind the highest sequence, computed unsigned so any datagram is well defined
+        uint32_t back = remote_sequence_ - sequence;
+        if (offset > 0) {
+            if (offset > 1) {
+                ESP_LOGW(TAG, "Audio packets missing: %lu, expected: %lu", sequence, remote_sequence_ + 1);
+            }
+            remote_window_ = offset < 64 ? (remote_window_ << offset) | 1 : 1;
+            remote_sequence_ = sequence;
+        } else if (back < MQTT_UDP_REORDER_WINDOW) {
+            uint64_t bit = 1ULL << back;
+            if (remote_window_ & bit) {
+                stats.duplicates++;
+                return false;
+            }
+            remote_window_ |= bit;
+            stats.reordered++;
+        } else if (sequence == bad_sequence_) {
+            // Two packets in a row far behind, the server started the sequence over (RFC 3550 A.1)
+            ESP_LOGW(TAG, "Audio sequence restarted from %lu to %lu", remote_sequence_, sequence);
+            expected_prior_ += remote_sequence_ - base_sequence_ + 1;
+            restart = true;
+        } else {
+            ESP_LOGW(TAG, "Audio packet too late: %lu, highest: %lu", sequence, remote_sequence_);
+            stats.late++;
+            bad_sequence_ = sequence + 1;
+            return false;
+        }
+    }
+    if (restart) {
+        base_sequence_ = sequence;
+        remote_sequence_ = sequence;
+        remote_window_ = 1;
+    }
+    stats.received++;
+    stats.expected = expected_prior_ + remote_sequence_ - base_sequence_ + 1;
+
+    // Interarrival jitter (RFC 3550 A.8). The send time is derived from the sequence number like in
+    // the jitter buffer, as the header timestamp is not guaranteed to be a media clock. The sequence
+    // does not advance while the server pauses between replies, so such a gap would be taken for
+    // jitter; the first packet after a gap only sets the new reference
+    int64_t frame_us = (int64_t)server_frame_duration_ * 1000;
+    int64_t transit = now_us - (int64_t)sequence * frame_us;
+    bool gap = now_us - last_arrival_us_ > MQTT_UDP_JITTER_GAP_FRAMES * frame_us;
+    last_arrival_us_ = now_us;
+    if (!restart && !gap) {
+        int64_t d = std::llabs(transit - last_transit_us_);
+        jitter_us_x16_ += d - ((jitter_us_x16_ + 8) >> 4);
+    }
+    last_transit_us_ = transit;
+    stats.jitter_ms = (jitter_us_x16_ >> 4) / 1000;
+    return true;
+}
+
+void MqttProtocol::SendReceiveStats() {
+    UdpReceiveStats stats;
+    uint32_t interval_expected, interval_received;
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats = receive_stats_;
+        interval_expected = stats.expected - reported_expected_;
+        interval_received = stats.received + stats.late - reported_received_;
+        reported_expected_ = stats.expected;
+        reported_received_ = stats.received + stats.late;
+    }
+    // A failed publish would be reported as a server error, so the report is skipped while disconnected
+    if (stats.received == 0 || session_id_.empty() || mqtt_ == nullptr || !mqtt_->IsConnected()) {
+        return;
+    }
+
+    // Late packets did arrive, so like in RFC 3550 they are not counted as lost
+    uint32_t received = stats.received + stats.late;
+    uint32_t lost = stats.expected > received ? stats.expected - received : 0;
+    uint32_t interval_lost = interval_expected > interval_received ? interval_expected - interval_received : 0;
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "session_id", session_id_.c_str());
+    cJSON_AddStringToObject(root, "type", "stats");
+    cJSON* udp = cJSON_CreateObject();
+    cJSON_AddNumberToObject(udp, "received", stats.received);
+    cJSON_AddNumberToObject(udp, "expected", stats.expected);
+    cJSON_AddNumberToObject(udp, "lost", lost);
+    cJSON_AddNumberToObject(udp, "fraction_lost", interval_expected > 0 ? interval_lost * 256 / interval_expected : 0);
+    cJSON_AddNumberToObject(udp, "late", stats.late);
+    cJSON_AddNumberToObject(udp, "duplicates", stats.duplicates);
+    cJSON_AddNumberToObject(udp, "reordered", stats.reordered);
+    cJSON_AddNumberToObject(udp, "jitter_ms", stats.jitter_ms);
+    cJSON_AddItemToObject(root, "udp", udp);
+    auto json_str = cJSON_PrintUnformatted(root);
+    std::string message(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    SendText(message);
+}
+
 static const char hex_chars[] = "0123456789ABCDEF";
 // 辅助函数，将单个十六进制字符转换为对应的数值
 static inline uint8_t CharToHex(char c) {
@@ -3,6 +3,7 @@
 
 
 #include "protocol.h"
+#include "mqtt_udp_packet.h"
 #include <mqtt.h>
 #include <udp.h>
 #include <cJSON.h>
@@ -20,6 +21,23 @@
 #define MQTT_RECONNECT_INTERVAL_MS 60000
 
 #define MQTT_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
+// Sequences accepted behind the highest one received (at most 64), older ones are dropped as late.
+// Accepted packets are put back in order by the jitter buffer
+#define MQTT_UDP_REORDER_WINDOW 32
+#define MQTT_UDP_STATS_INTERVAL_MS 5000
+// An arrival gap longer than this many frames is a pause of the server (silence between replies),
+// not network jitter, so the jitter estimate starts again from the next packet
+#define MQTT_UDP_JITTER_GAP_FRAMES 4
+
+// Downlink UDP receive statistics of the session, after RFC 3550 section 6.4.1 and appendix A
+struct UdpReceiveStats {
+    uint32_t received = 0;      // Packets accepted, without duplicates
+    uint32_t expected = 0;      // Sequence range seen so far
+    uint32_t late = 0;          // Arrived behind the reorder window, dropped
+    uint32_t duplicates = 0;
+    uint32_t reordered = 0;     // Arrived after a higher sequence, within the window
+    uint32_t jitter_ms = 0;     // Interarrival jitter
+};
 
 class MqttProtocol : public Protocol {
 public:
@@ -42,15 +60,34 @@ private:
     std::unique_ptr<Udp> udp_;
     mbedtls_aes_context aes_ctx_;
     std::string aes_nonce_;
+    // Guarded by channel_mutex_. Udp::Send() takes a string, see SendAudio()
+    std::string udp_send_buffer_;
     std::string udp_server_;
     int udp_port_;
     uint32_t local_sequence_;
-    uint32_t remote_sequence_;
     esp_timer_handle_t reconnect_timer_;
+    esp_timer_handle_t stats_timer_;
+
+    // Receive side, written by the UDP task; stats_mutex_ guards them for the report
+    std::mutex stats_mutex_;
+    uint32_t remote_sequence_ = 0;      // Highest sequence received
+    uint64_t remote_window_ = 0;        // Bit n set: remote_sequence_ - n was received
+    uint32_t base_sequence_ = 0;        // First sequence since the stream (re)started
+    uint32_t expected_prior_ = 0;       // Expected before the stream restarted
+    uint32_t bad_sequence_ = 0;         // Next sequence if a far older packet was a restart
+    int64_t last_transit_us_ = 0;
+    int64_t last_arrival_us_ = 0;
+    int64_t jitter_us_x16_ = 0;         // Scaled by 16 like in RFC 3550 A.8
+    uint32_t reported_expected_ = 0;
+    uint32_t reported_received_ = 0;
+    UdpReceiveStats receive_stats_;
 
     bool StartMqttClient(bool report_error=false);
     void ParseServerHello(const cJSON* root);
     std::string DecodeHexString(const std::string& hex_string);
+    void ResetReceiveStats();
+    bool AcceptRemoteSequence(uint32_t sequence, int64_t now_us);
+    void SendReceiveStats();
 
     bool SendText(const std::string& text) override;
     std::string GetHelloMessage();
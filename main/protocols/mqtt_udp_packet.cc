@@ -0,0 +1,56 @@
+#include "mqtt_udp_packet.h"
+
+#include <cstring>
+#include <arpa/inet.h>
+
+uint8_t* MqttUdpEncryptPacket(mbedtls_aes_context* aes, const uint8_t* session_nonce, uint32_t sequence,
+    AudioStreamPacket& packet) {
+    size_t payload_size = packet.payload_size();
+    uint8_t* nonce = packet.PrependHeader(MQTT_AES_NONCE_SIZE);
+    memcpy(nonce, session_nonce, MQTT_AES_NONCE_SIZE);
+    uint16_t size_field = htons(payload_size);
+    uint32_t timestamp_field = htonl(packet.timestamp);
+    uint32_t sequence_field = htonl(sequence);
+    memcpy(nonce + 2, &size_field, sizeof(size_field));
+    memcpy(nonce + 8, &timestamp_field, sizeof(timestamp_field));
+    memcpy(nonce + 12, &sequence_field, sizeof(sequence_field));
+
+    // mbedtls advances the counter block, so it works on a copy of the nonce
+    uint8_t nonce_counter[MQTT_AES_NONCE_SIZE];
+    memcpy(nonce_counter, nonce, sizeof(nonce_counter));
+    size_t nc_off = 0;
+    uint8_t stream_block[16] = {0};
+    if (mbedtls_aes_crypt_ctr(aes, payload_size, &nc_off, nonce_counter, stream_block,
+        packet.payload_data(), packet.payload_data()) != 0) {
+        return nullptr;
+    }
+    return nonce;
+}
+
+bool MqttUdpParseHeader(const uint8_t* data, size_t size, uint32_t& timestamp, uint32_t& sequence) {
+    if (size < MQTT_AES_NONCE_SIZE || data[0] != MQTT_UDP_PACKET_TYPE_AUDIO) {
+        return false;
+    }
+    // The received data may be unaligned
+    memcpy(&timestamp, data + 8, sizeof(timestamp));
+    memcpy(&sequence, data + 12, sizeof(sequence));
+    timestamp = ntohl(timestamp);
+    sequence = ntohl(sequence);
+    return true;
+}
+
+bool MqttUdpDecryptPayload(mbedtls_aes_context* aes, const uint8_t* data, size_t size, std::vector<uint8_t>& payload) {
+    if (size < MQTT_AES_NONCE_SIZE) {
+        return false;
+    }
+    // mbedtls advances the counter block and the received data is not ours to modify, so the nonce
+    // is copied to the stack. The payload is decrypted straight into the caller's buffer
+    uint8_t nonce[MQTT_AES_NONCE_SIZE];
+    memcpy(nonce, data, sizeof(nonce));
+    size_t nc_off = 0;
+    uint8_t stream_block[16] = {0};
+    size_t payload_size = size - MQTT_AES_NONCE_SIZE;
+    payload.resize(payload_size);
+    return mbedtls_aes_crypt_ctr(aes, payload_size, &nc_off, nonce, stream_block,
+        data + MQTT_AES_NONCE_SIZE, payload.data()) == 0;
+}
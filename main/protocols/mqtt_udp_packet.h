@@ -0,0 +1,35 @@
+#ifndef MQTT_UDP_PACKET_H
+#define MQTT_UDP_PACKET_H
+
+#include "protocol.h"
+#include <mbedtls/aes.h>
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// The UDP audio header is the AES-CTR nonce of the packet
+#define MQTT_AES_NONCE_SIZE 16
+#define MQTT_UDP_PACKET_TYPE_AUDIO 0x01
+
+/*
+ * MQTT/UDP audio datagrams, see docs/mqtt-udp.md:
+ * |type 1u|flags 1u|payload_len 2u|ssrc 4u|timestamp 4u|sequence 4u|payload payload_len|
+ *
+ * The 16-byte header is also the AES-128-CTR counter block of the encrypted payload. The session
+ * nonce from the server hello gives the type, flags and ssrc, the other fields are set per packet.
+ */
+
+// Builds the datagram inside the packet: the header goes in its headroom and the payload is
+// encrypted in place. Returns the start of the datagram, MQTT_AES_NONCE_SIZE + payload bytes long,
+// or nullptr if the encryption failed
+uint8_t* MqttUdpEncryptPacket(mbedtls_aes_context* aes, const uint8_t* session_nonce, uint32_t sequence,
+    AudioStreamPacket& packet);
+
+// Reads the header of a received datagram, false if it is too short or not audio
+bool MqttUdpParseHeader(const uint8_t* data, size_t size, uint32_t& timestamp, uint32_t& sequence);
+
+// Decrypts the payload of a received datagram into payload, without modifying the datagram
+bool MqttUdpDecryptPayload(mbedtls_aes_context* aes, const uint8_t* data, size_t size, std::vector<uint8_t>& payload);
+
+#endif // MQTT_UDP_PACKET_H
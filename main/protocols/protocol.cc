@@ -1,9 +1,150 @@
 #include "protocol.h"
 
 #include <esp_log.h>
+#include <cstddef>
+#include <cstring>
+#include <arpa/inet.h>
 
 #define TAG "Protocol"
 
+// The received data may be unaligned and is not ours to byte-swap, so the fields are read byte by byte
+static inline uint16_t ReadBigEndian16(const uint8_t* data) {
+    return (data[0] << 8) | data[1];
+}
+
+static inline uint32_t ReadBigEndian32(const uint8_t* data) {
+    return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+}
+
+bool ParseBinaryFrame(int version, const uint8_t* data, size_t size, BinaryFrame& frame) {
+    size_t header_size = 0;
+    size_t payload_size = 0;
+    if (version == 2) {
+        header_size = sizeof(BinaryProtocol2);
+        if (size < header_size) {
+            return false;
+        }
+        frame.type = ReadBigEndian16(data + offsetof(BinaryProtocol2, type));
+        frame.timestamp = ReadBigEndian32(data + offsetof(BinaryProtocol2, timestamp));
+        payload_size = ReadBigEndian32(data + offsetof(BinaryProtocol2, payload_size));
+    } else if (version == 3) {
+        header_size = sizeof(BinaryProtocol3);
+        if (size < header_size) {
+            return false;
+        }
+        frame.type = data[offsetof(BinaryProtocol3, type)];
+        frame.timestamp = 0;
+        payload_size = ReadBigEndian16(data + offsetof(BinaryProtocol3, payload_size));
+    } else {
+        frame.type = 0;
+        frame.timestamp = 0;
+        payload_size = size;
+    }
+    // Bytes after the declared payload are ignored, a payload running past the frame is an error
+    if (payload_size > size - header_size) {
+        return false;
+    }
+    frame.payload = data + header_size;
+    frame.payload_size = payload_size;
+    return true;
+}
+
+int ParseBinaryFrames(int version, const uint8_t* data, size_t size, BinaryFrame* frames, int max_frames) {
+    if (version != 4) {
+        return max_frames >= 1 && ParseBinaryFrame(version, data, size, frames[0]) ? 1 : -1;
+    }
+    if (size < sizeof(BinaryProtocol4)) {
+        return -1;
+    }
+    uint8_t type = data[offsetof(BinaryProtocol4, type)];
+    int count = data[offsetof(BinaryProtocol4, frame_count)];
+    if (count > max_frames) {
+        return -1;
+    }
+    size_t offset = sizeof(BinaryProtocol4);
+    for (int i = 0; i < count; i++) {
+        if (size - offset < sizeof(BinaryProtocol4Frame)) {
+            return -1;
+        }
+        const uint8_t* header = data + offset;
+        size_t payload_size = ReadBigEndian16(header + offsetof(BinaryProtocol4Frame, payload_size));
+        offset += sizeof(BinaryProtocol4Frame);
+        if (payload_size > size - offset) {
+            return -1;
+        }
+        frames[i].type = type;
+        frames[i].timestamp = ReadBigEndian32(header + offsetof(BinaryProtocol4Frame, timestamp));
+        frames[i].payload = data + offset;
+        frames[i].payload_size = payload_size;
+        offset += payload_size;
+    }
+    return count;
+}
+
+uint8_t* PrependBinaryFrameHeader(int version, AudioStreamPacket& packet, size_t& message_size) {
+    size_t payload_size = packet.payload_size();
+    if (version == 2) {
+        auto bp2 = (BinaryProtocol2*)packet.PrependHeader(sizeof(BinaryProtocol2));
+        bp2->version = htons(version);
+        bp2->type = 0;
+        bp2->reserved = 0;
+        bp2->timestamp = htonl(packet.timestamp);
+        bp2->payload_size = htonl(payload_size);
+        message_size = sizeof(BinaryProtocol2) + payload_size;
+        return (uint8_t*)bp2;
+    } else if (version == 3) {
+        auto bp3 = (BinaryProtocol3*)packet.PrependHeader(sizeof(BinaryProtocol3));
+        bp3->type = 0;
+        bp3->reserved = 0;
+        bp3->payload_size = htons(payload_size);
+        message_size = sizeof(BinaryProtocol3) + payload_size;
+        return (uint8_t*)bp3;
+    } else if (version == 4) {
+        // A message of one frame, both headers fit in the headroom
+        auto bp4 = (BinaryProtocol4*)packet.PrependHeader(sizeof(BinaryProtocol4) + sizeof(BinaryProtocol4Frame));
+        bp4->type = 0;
+        bp4->frame_count = 1;
+        bp4->reserved = 0;
+        auto frame = (BinaryProtocol4Frame*)bp4->frames;
+        frame->timestamp = htonl(packet.timestamp);
+        frame->payload_size = htons(payload_size);
+        message_size = sizeof(BinaryProtocol4) + sizeof(BinaryProtocol4Frame) + payload_size;
+        return (uint8_t*)bp4;
+    }
+    message_size = payload_size;
+    return packet.payload_data();
+}
+
+void BuildBinaryProtocol4Message(const std::vector<std::unique_ptr<AudioStreamPacket>>& packets,
+    std::vector<uint8_t>& message) {
+    size_t size = sizeof(BinaryProtocol4);
+    for (auto& packet : packets) {
+        size += sizeof(BinaryProtocol4Frame) + packet->payload_size();
+    }
+    message.resize(size);
+    auto bp4 = (BinaryProtocol4*)message.data();
+    bp4->type = 0;
+    bp4->frame_count = packets.size();
+    bp4->reserved = 0;
+    size_t offset = sizeof(BinaryProtocol4);
+    for (auto& packet : packets) {
+        auto frame = (BinaryProtocol4Frame*)(message.data() + offset);
+        frame->timestamp = htonl(packet->timestamp);
+        frame->payload_size = htons(packet->payload_size());
+        memcpy(frame->payload, packet->payload_data(), packet->payload_size());
+        offset += sizeof(BinaryProtocol4Frame) + packet->payload_size();
+    }
+}
+
+bool Protocol::SendAudioBatch(std::vector<std::unique_ptr<AudioStreamPacket>>& packets) {
+    for (auto& packet : packets) {
+        if (!SendAudio(std::move(packet))) {
+            return false;
+        }
+    }
+    return true;
+}
+
 void Protocol::OnIncomingJson(std::function<void(const cJSON* root)> callback) {
     on_incoming_json_ = callback;
 }
@@ -6,13 +6,67 @@
 #include <functional>
 #include <chrono>
 #include <vector>
+#include <memory>
+
+// Bytes the encoder leaves free in front of uplink Opus data, for the largest transport header:
+// BinaryProtocol2 and the MQTT/UDP nonce are both 16 bytes
+#define AUDIO_PACKET_HEADROOM 16
 
 struct AudioStreamPacket {
     int sample_rate = 0;
     int frame_duration = 0;
     uint32_t timestamp = 0;
+    uint32_t sequence = 0;  // Transport sequence number, 0 if the transport has none
+    int64_t origin_time = 0;    // Uplink: mic capture, downlink: network receive (esp_timer us, 0 if not traced)
+    int64_t stage_time = 0;     // End of the last pipeline stage, for the latency tracer
     std::vector<uint8_t> payload;
+    // The first headroom bytes of payload are free for the transport header, the Opus data follows them
+    size_t headroom = 0;
+
+    uint8_t* payload_data() { return payload.data() + headroom; }
+    size_t payload_size() const { return payload.size() - headroom; }
+
+    // Returns where a transport header of this size goes, right in front of the Opus data. The encoder
+    // leaves AUDIO_PACKET_HEADROOM in sent packets. A packet without enough headroom (e.g. one recorded
+    // in audio testing mode) is moved back to make room, which costs a copy
+    uint8_t* PrependHeader(size_t size) {
+        if (headroom < size) {
+            payload.insert(payload.begin(), size - headroom, 0);
+            headroom = size;
+        }
+        return payload.data() + headroom - size;
+    }
+
+    // Drops the headroom, for an uplink packet that is decoded locally
+    void RemoveHeadroom() {
+        payload.erase(payload.begin(), payload.begin() + headroom);
+        headroom = 0;
+    }
+
+    // Called when the packet goes back to the pool, the payload keeps its capacity
+    void Reset() {
+        sample_rate = 0;
+        frame_duration = 0;
+        timestamp = 0;
+        sequence = 0;
+        origin_time = 0;
+        stage_time = 0;
+        payload.clear();
+        headroom = 0;
+    }
+};
+
+// Packets are recycled through a fixed-capacity pool (see audio_service.cc),
+// so releasing a std::unique_ptr<AudioStreamPacket> returns the packet to the pool.
+namespace std {
+template <>
+struct default_delete<AudioStreamPacket> {
+    void operator()(AudioStreamPacket* packet) const;
 };
+}
+
+// Take a packet from the pool, allocates a new one if the pool is empty
+std::unique_ptr<AudioStreamPacket> NewAudioStreamPacket();
 
 struct BinaryProtocol2 {
     uint16_t version;
@@ -30,6 +84,45 @@ struct BinaryProtocol3 {
     uint8_t payload[];
 } __attribute__((packed));
 
+// Version 4 packs up to BINARY_PROTOCOL4_MAX_FRAMES Opus frames in one message, each behind its own
+// BinaryProtocol4Frame header
+#define BINARY_PROTOCOL4_MAX_FRAMES 8
+
+struct BinaryProtocol4 {
+    uint8_t type;           // 0: OPUS
+    uint8_t frame_count;
+    uint16_t reserved;
+    uint8_t frames[];
+} __attribute__((packed));
+
+struct BinaryProtocol4Frame {
+    uint32_t timestamp;     // Timestamp in milliseconds (used for server-side AEC)
+    uint16_t payload_size;
+    uint8_t payload[];
+} __attribute__((packed));
+
+// Header fields of a received binary frame, the payload points into the received data
+struct BinaryFrame {
+    uint16_t type = 0;          // 0: OPUS
+    uint32_t timestamp = 0;
+    const uint8_t* payload = nullptr;
+    size_t payload_size = 0;
+};
+
+// Decodes a binary frame of protocol version 1 (bare Opus), 2 or 3 without modifying it. Returns false
+// if the frame is shorter than its header, or than the payload size its header declares
+bool ParseBinaryFrame(int version, const uint8_t* data, size_t size, BinaryFrame& frame);
+// Same for any version, including the messages of several frames of version 4. Returns the number of
+// frames, or -1 if the message is malformed or holds more than max_frames
+int ParseBinaryFrames(int version, const uint8_t* data, size_t size, BinaryFrame* frames, int max_frames);
+// Writes the header of a single-frame message of any version in the headroom of the packet, right in front of
+// its Opus data. Returns where the message starts in the packet, and its size in message_size
+uint8_t* PrependBinaryFrameHeader(int version, AudioStreamPacket& packet, size_t& message_size);
+// Copies the packets, at most BINARY_PROTOCOL4_MAX_FRAMES, into one version 4 message. The message
+// keeps its capacity, so a reused buffer is only allocated once
+void BuildBinaryProtocol4Message(const std::vector<std::unique_ptr<AudioStreamPacket>>& packets,
+    std::vector<uint8_t>& message);
+
 enum AbortReason {
     kAbortReasonNone,
     kAbortReasonWakeWordDetected
@@ -51,6 +144,10 @@ public:
     inline int server_frame_duration() const {
         return server_frame_duration_;
     }
+    // Uplink frame duration chosen by the server (audio_params.uplink_frame_duration), 0 if it keeps ours
+    inline int server_uplink_frame_duration() const {
+        return server_uplink_frame_duration_;
+    }
     inline const std::string& session_id() const {
         return session_id_;
     }
@@ -68,6 +165,10 @@ public:
     virtual void CloseAudioChannel() = 0;
     virtual bool IsAudioChannelOpened() const = 0;
     virtual bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) = 0;
+    // Sends the packets in order, in as few messages as the protocol version allows (max_audio_batch()
+    // packets per message). The packets are left to the caller, possibly moved from
+    virtual bool SendAudioBatch(std::vector<std::unique_ptr<AudioStreamPacket>>& packets);
+    virtual size_t max_audio_batch() const { return 1; }
     virtual void SendWakeWordDetected(const std::string& wake_word);
     virtual void SendStartListening(ListeningMode mode);
     virtual void SendStopListening();
@@ -85,6 +186,7 @@ protected:
 
     int server_sample_rate_ = 24000;
     int server_frame_duration_ = 60;
+    int server_uplink_frame_duration_ = 0;
     bool error_occurred_ = false;
     std::string session_id_;
     std::chrono::time_point<std::chrono::steady_clock> last_incoming_time_;
@@ -7,7 +7,6 @@
 #include <cstring>
 #include <cJSON.h>
 #include <esp_log.h>
-#include <arpa/inet.h>
 #include "assets/lang_config.h"
 
 #define TAG "WS"
@@ -30,31 +29,26 @@ bool WebsocketProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
         return false;
     }
 
-    if (version_ == 2) {
-        std::string serialized;
-        serialized.resize(sizeof(BinaryProtocol2) + packet->payload.size());
-        auto bp2 = (BinaryProtocol2*)serialized.data();
-        bp2->version = htons(version_);
-        bp2->type = 0;
-        bp2->reserved = 0;
-        bp2->timestamp = htonl(packet->timestamp);
-        bp2->payload_size = htonl(packet->payload.size());
-        memcpy(bp2->payload, packet->payload.data(), packet->payload.size());
-
-        return websocket_->Send(serialized.data(), serialized.size(), true);
-    } else if (version_ == 3) {
-        std::string serialized;
-        serialized.resize(sizeof(BinaryProtocol3) + packet->payload.size());
-        auto bp3 = (BinaryProtocol3*)serialized.data();
-        bp3->type = 0;
-        bp3->reserved = 0;
-        bp3->payload_size = htons(packet->payload.size());
-        memcpy(bp3->payload, packet->payload.data(), packet->payload.size());
-
-        return websocket_->Send(serialized.data(), serialized.size(), true);
-    } else {
-        return websocket_->Send(packet->payload.data(), packet->payload.size(), true);
+    // The header is written in the headroom the encoder left in front of the payload
+    size_t message_size;
+    uint8_t* message = PrependBinaryFrameHeader(version_, *packet, message_size);
+    return websocket_->Send(message, message_size, true);
+}
+
+bool WebsocketProtocol::SendAudioBatch(std::vector<std::unique_ptr<AudioStreamPacket>>& packets) {
+    if (version_ != 4 || packets.size() > BINARY_PROTOCOL4_MAX_FRAMES) {
+        return Protocol::SendAudioBatch(packets);
+    }
+    if (packets.size() == 1) {
+        return SendAudio(std::move(packets.front()));
+    }
+    if (websocket_ == nullptr || !websocket_->IsConnected()) {
+        return false;
     }
+
+    // Several frames are copied into one message, only when packets queued up (e.g. the wake word audio)
+    BuildBinaryProtocol4Message(packets, batch_buffer_);
+    return websocket_->Send(batch_buffer_.data(), batch_buffer_.size(), true);
 }
 
 bool WebsocketProtocol::SendText(const std::string& text) {
@@ -83,10 +77,9 @@ bool WebsocketProtocol::OpenAudioChannel() {
     Settings settings("websocket", false);
     std::string url = settings.GetString("url");
     std::string token = settings.GetString("token");
+    // The server may have switched the last session to version 4, start again from the configured one
     int version = settings.GetInt("version");
-    if (version != 0) {
-        version_ = version;
-    }
+    version_ = version != 0 ? version : 1;
 
     error_occurred_ = false;
 
@@ -110,43 +103,28 @@ bool WebsocketProtocol::OpenAudioChannel() {
 
     websocket_->OnData([this](const char* data, size_t len, bool binary) {
         if (binary) {
-            if (on_incoming_audio_ != nullptr) {
-                if (version_ == 2) {
-                    BinaryProtocol2* bp2 = (BinaryProtocol2*)data;
-                    bp2->version = ntohs(bp2->version);
-                    bp2->type = ntohs(bp2->type);
-                    bp2->timestamp = ntohl(bp2->timestamp);
-                    bp2->payload_size = ntohl(bp2->payload_size);
-                    auto payload = (uint8_t*)bp2->payload;
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = bp2->timestamp,
-                        .payload = std::vector<uint8_t>(payload, payload + bp2->payload_size)
-                    }));
-                } else if (version_ == 3) {
-                    BinaryProtocol3* bp3 = (BinaryProtocol3*)data;
-                    bp3->type = bp3->type;
-                    bp3->payload_size = ntohs(bp3->payload_size);
-                    auto payload = (uint8_t*)bp3->payload;
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = 0,
-                        .payload = std::vector<uint8_t>(payload, payload + bp3->payload_size)
-                    }));
-                } else {
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = 0,
-                        .payload = std::vector<uint8_t>((uint8_t*)data, (uint8_t*)data + len)
-                    }));
+            BinaryFrame frames[BINARY_PROTOCOL4_MAX_FRAMES];
+            int count = ParseBinaryFrames(version_, (const uint8_t*)data, len, frames, BINARY_PROTOCOL4_MAX_FRAMES);
+            if (count < 0) {
+                ESP_LOGW(TAG, "Invalid binary frame of %u bytes for protocol version %d", len, version_);
+            } else if (count > 0 && frames[0].type != 0) {
+                ESP_LOGW(TAG, "Unsupported binary frame type: %u", frames[0].type);
+            } else if (on_incoming_audio_ != nullptr) {
+                int64_t receive_time = esp_timer_get_time();
+                for (int i = 0; i < count; i++) {
+                    // The only copy of the payload, into a pooled packet that keeps its capacity
+                    auto packet = NewAudioStreamPacket();
+                    packet->origin_time = receive_time;
+                    packet->sample_rate = server_sample_rate_;
+                    packet->frame_duration = server_frame_duration_;
+                    packet->timestamp = frames[i].timestamp;
+                    packet->payload.assign(frames[i].payload, frames[i].payload + frames[i].payload_size);
+                    on_incoming_audio_(std::move(packet));
                 }
             }
         } else {
-            // Parse JSON data
-            auto root = cJSON_Parse(data);
+            // Parse JSON data, the text is not null-terminated
+            auto root = cJSON_ParseWithLength(data, len);
             auto type = cJSON_GetObjectItem(root, "type");
             if (cJSON_IsString(type)) {
                 if (strcmp(type->valuestring, "hello") == 0) {
@@ -157,7 +135,7 @@ bool WebsocketProtocol::OpenAudioChannel() {
                     }
                 }
             } else {
-                ESP_LOGE(TAG, "Missing message type, data: %s", data);
+                ESP_LOGE(TAG, "Missing message type, data: %.*s", (int)len, data);
             }
             cJSON_Delete(root);
         }
@@ -207,8 +185,13 @@ std::string WebsocketProtocol::GetHelloMessage() {
     cJSON* features = cJSON_CreateObject();
 #if CONFIG_USE_SERVER_AEC
     cJSON_AddBoolToObject(features, "aec", true);
+#endif
+#if CONFIG_USE_UPLINK_DTX
+    cJSON_AddBoolToObject(features, "dtx", true);
 #endif
     cJSON_AddBoolToObject(features, "mcp", true);
+    // Version 4 is supported, with up to this many frames per message
+    cJSON_AddNumberToObject(features, "audio_batch", BINARY_PROTOCOL4_MAX_FRAMES);
     cJSON_AddItemToObject(root, "features", features);
     cJSON_AddStringToObject(root, "transport", "websocket");
     cJSON* audio_params = cJSON_CreateObject();
@@ -247,6 +230,16 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
         if (cJSON_IsNumber(frame_duration)) {
             server_frame_duration_ = frame_duration->valueint;
         }
+        // frame_duration is the downlink, the uplink only changes if the server asks for it
+        auto uplink_frame_duration = cJSON_GetObjectItem(audio_params, "uplink_frame_duration");
+        server_uplink_frame_duration_ = cJSON_IsNumber(uplink_frame_duration) ? uplink_frame_duration->valueint : 0;
+    }
+
+    // The server opts in to version 4 (announced in features.audio_batch) for this session
+    auto version = cJSON_GetObjectItem(root, "version");
+    if (cJSON_IsNumber(version) && version->valueint == 4 && version_ != 4) {
+        ESP_LOGI(TAG, "Server switched to protocol version 4");
+        version_ = 4;
     }
 
     xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
@@ -17,6 +17,8 @@ public:
 
     bool Start() override;
     bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) override;
+    bool SendAudioBatch(std::vector<std::unique_ptr<AudioStreamPacket>>& packets) override;
+    size_t max_audio_batch() const override { return version_ == 4 ? BINARY_PROTOCOL4_MAX_FRAMES : 1; }
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
@@ -25,6 +27,8 @@ private:
     EventGroupHandle_t event_group_handle_;
     std::unique_ptr<WebSocket> websocket_;
     int version_ = 1;
+    // Version 4 messages of several packets are assembled here
+    std::vector<uint8_t> batch_buffer_;
 
     void ParseServerHello(const cJSON* root);
     bool SendText(const std::string& text) override;
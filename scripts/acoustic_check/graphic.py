@@ -37,6 +37,12 @@ class UDPServerProtocol(asyncio.DatagramProtocol):
         
         # 只处理来自已记录客户端的数据
         if addr == self.client_address:
+            # 新固件的数据带 24 字节包头 (见 scripts/audio_debug_server.py)，这里只支持未压缩的 PCM
+            if len(data) >= 24 and data[:2] == b'AD':
+                if data[3] != 0:
+                    print("不支持压缩的调试音频流，请关闭 AUDIO_DEBUG_COMPRESS")
+                    return
+                data = data[24:]
             # 将接收到的音频数据添加到队列
             self.data_queue.extend(data)
         else:
@@ -1,54 +1,222 @@
 import socket
+import struct
 import wave
 import argparse
+import time
 
 
 '''
-  Create a UDP socket and bind it to the server's IP:8000.
-  Listen for incoming messages and print them to the console.
-  Save the audio to a WAV file.
+  Receive the audio debugger stream (CONFIG_USE_AUDIO_DEBUGGER) on UDP and save it to WAV files.
+
+  Every datagram starts with the 24-byte header of main/audio/processors/audio_debugger.h.
+  Fragments are reassembled into frames and frames are written in order. A frame that never
+  arrives is written as silence, so the timeline (e.g. mic vs reference for AEC tuning) stays
+  aligned. Missing frames (frame counter gaps: dropped on the device when its buffer was full,
+  unless datagrams were lost too) and datagrams lost on the network (sequence gaps) are counted
+  separately.
+
+  Datagrams without the header (older firmware) are written as raw PCM with --samplerate/--channels.
 '''
-def main(samplerate, channels):
-    # Create a UDP socket
-    server_socket = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
-    server_socket.bind(('0.0.0.0', 8000))
 
-    # Create WAV file with parameters
-    filename = f"{samplerate}_{channels}.wav"
-    wav_file = wave.open(filename, "wb")
-    wav_file.setnchannels(channels)     # channels parameter
-    wav_file.setsampwidth(2)            # 2 bytes per sample (16-bit)
-    wav_file.setframerate(samplerate)   # samplerate parameter
+HEADER = struct.Struct('<2sBBIIIHBBB3x')
+MAGIC = b'AD'
+ENCODING_PCM16 = 0
+ENCODING_DELTA_VARINT = 1
+# Frames kept waiting for missing fragments before they are given up
+REORDER_WINDOW = 32
+
+
+def decode_delta_varint(payload, channels):
+    samples = []
+    previous = [0] * channels
+    value = 0
+    shift = 0
+    for byte in payload:
+        value |= (byte & 0x7F) << shift
+        if byte & 0x80:
+            shift += 7
+            continue
+        delta = (value >> 1) ^ -(value & 1)
+        channel = len(samples) % channels
+        sample = (previous[channel] + delta + 0x8000) % 0x10000 - 0x8000
+        previous[channel] = sample
+        samples.append(sample)
+        value = 0
+        shift = 0
+    return struct.pack(f'<{len(samples)}h', *samples)
+
+
+class WavWriter:
+    def __init__(self, prefix):
+        self.prefix = prefix
+        self.wav_file = None
+        self.format = None
+        self.files = 0
+
+    def write(self, sample_rate, channels, pcm):
+        if self.format != (sample_rate, channels):
+            self.close()
+            self.files += 1
+            suffix = '' if self.files == 1 else f'_{self.files}'
+            filename = f"{self.prefix}_{sample_rate}_{channels}{suffix}.wav"
+            self.wav_file = wave.open(filename, "wb")
+            self.wav_file.setnchannels(channels)
+            self.wav_file.setsampwidth(2)
+            self.wav_file.setframerate(sample_rate)
+            self.format = (sample_rate, channels)
+            print(f"Saving {sample_rate} Hz, {channels} channel(s) to {filename}")
+        self.wav_file.writeframes(pcm)
+
+    def close(self):
+        if self.wav_file is not None:
+            self.wav_file.close()
+            self.wav_file = None
+
+
+class Reassembler:
+    def __init__(self, writer, fill_gaps):
+        self.writer = writer
+        self.fill_gaps = fill_gaps
+        self.pending = {}
+        self.next_frame = None
+        self.first_sequence = None
+        self.last_sequence = None
+        self.datagrams = 0
+        self.lost_before = 0
+        self.last_format = None
+        self.frames = 0
+        self.frames_missing = 0
+        self.frames_incomplete = 0
+
+    def add(self, header, payload):
+        _, version, encoding, sequence, frame, sample_rate, samples, channels, fragment, fragments = header
+        if self.next_frame is not None and frame + REORDER_WINDOW * 4 < self.next_frame:
+            # The device restarted, its counters start over
+            self.finish()
+            self.next_frame = None
+            self.lost_before += self.datagrams_lost()
+            self.first_sequence = None
+        # Datagrams may arrive out of order, so losses are counted against the sequence range
+        if self.first_sequence is None:
+            self.first_sequence = self.last_sequence = sequence
+            self.datagrams = 0
+        self.first_sequence = min(self.first_sequence, sequence)
+        self.last_sequence = max(self.last_sequence, sequence)
+        self.datagrams += 1
+        if self.next_frame is None:
+            self.next_frame = frame
+        if frame < self.next_frame or fragment >= fragments:
+            return
+
+        entry = self.pending.setdefault(frame, {
+            'format': (sample_rate, channels, samples, encoding),
+            'fragments': [None] * fragments,
+        })
+        entry['fragments'][fragment] = payload
+        self.flush(frame - REORDER_WINDOW)
+
+    def flush(self, give_up_before):
+        while True:
+            entry = self.pending.pop(self.next_frame, None)
+            if entry is not None and None not in entry['fragments']:
+                self.write_frame(entry)
+            elif self.next_frame < give_up_before:
+                # Nothing of a missing frame arrived: dropped on the device, or all its datagrams were lost
+                if entry is None:
+                    self.frames_missing += 1
+                else:
+                    self.frames_incomplete += 1
+                self.write_silence(entry)
+            else:
+                if entry is not None:
+                    self.pending[self.next_frame] = entry
+                break
+            self.next_frame += 1
+
+    def write_frame(self, entry):
+        sample_rate, channels, samples, encoding = entry['format']
+        payload = b''.join(entry['fragments'])
+        if encoding == ENCODING_DELTA_VARINT:
+            pcm = decode_delta_varint(payload, channels)
+        else:
+            pcm = payload
+        self.writer.write(sample_rate, channels, pcm)
+        self.last_format = entry['format']
+        self.frames += 1
+
+    def write_silence(self, entry):
+        fmt = entry['format'] if entry is not None else self.last_format
+        if not self.fill_gaps or fmt is None:
+            return
+        sample_rate, channels, samples, _ = fmt
+        self.writer.write(sample_rate, channels, b'\x00\x00' * samples * channels)
+
+    def finish(self):
+        if self.pending:
+            self.flush(max(self.pending) + 1)
+
+    def datagrams_lost(self):
+        if self.first_sequence is None:
+            return 0
+        return max(0, self.last_sequence - self.first_sequence + 1 - self.datagrams)
+
+    def summary(self):
+        return (f"frames {self.frames}, missing {self.frames_missing}, "
+                f"incomplete {self.frames_incomplete}, datagrams lost {self.lost_before + self.datagrams_lost()}")
+
 
-    print(f"Start saving audio from 0.0.0.0:8000 to {filename}...")
+def main(port, prefix, samplerate, channels, fill_gaps):
+    server_socket = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    server_socket.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4 * 1024 * 1024)
+    server_socket.bind(('0.0.0.0', port))
+    server_socket.settimeout(1.0)
+
+    writer = WavWriter(prefix)
+    reassembler = Reassembler(writer, fill_gaps)
+    raw_datagrams = 0
+    last_report = time.time()
+    print(f"Listening for audio on 0.0.0.0:{port}...")
 
     try:
         while True:
-            # Receive a message from the client
-            message, address = server_socket.recvfrom(8000)
-            
-            # Write PCM data to WAV file
-            wav_file.writeframes(message)
-
-            # Print length of the message
-            print(f"Received {len(message)} bytes from {address}")
-    
+            try:
+                message, address = server_socket.recvfrom(65536)
+            except socket.timeout:
+                continue
+
+            if len(message) >= HEADER.size and message[:2] == MAGIC:
+                header = HEADER.unpack_from(message)
+                reassembler.add(header, message[HEADER.size:])
+            else:
+                writer.write(samplerate, channels, message)
+                raw_datagrams += 1
+
+            if time.time() - last_report >= 5:
+                last_report = time.time()
+                print(f"{address[0]}: {reassembler.summary()}, raw datagrams {raw_datagrams}")
+
     except KeyboardInterrupt:
         print("\nStopping recording...")
-    
+
     finally:
-        # Close files and socket
-        wav_file.close()
+        reassembler.finish()
+        writer.close()
         server_socket.close()
-        print(f"WAV file '{filename}' saved successfully")
+        print(f"Done: {reassembler.summary()}, raw datagrams {raw_datagrams}")
 
 
 if __name__ == "__main__":
-    parser = argparse.ArgumentParser(description='UDP音频数据接收器，保存为WAV文件')
-    parser.add_argument('--samplerate', '-s', type=int, default=16000, 
-                        help='采样率 (默认: 16000)')
-    parser.add_argument('--channels', '-c', type=int, default=2, 
-                        help='声道数 (默认: 2)')
-    
+    parser = argparse.ArgumentParser(description='UDP音频调试数据接收器，重组分片并保存为多声道WAV文件')
+    parser.add_argument('--port', '-p', type=int, default=8000,
+                        help='UDP端口 (默认: 8000)')
+    parser.add_argument('--output', '-o', type=str, default='audio_debug',
+                        help='输出文件名前缀 (默认: audio_debug)')
+    parser.add_argument('--no-fill', action='store_true',
+                        help='丢失的帧不补静音')
+    parser.add_argument('--samplerate', '-s', type=int, default=16000,
+                        help='旧固件（无包头）的采样率 (默认: 16000)')
+    parser.add_argument('--channels', '-c', type=int, default=2,
+                        help='旧固件（无包头）的声道数 (默认: 2)')
+
     args = parser.parse_args()
-    main(args.samplerate, args.channels)
+    main(args.port, args.output, args.samplerate, args.channels, not args.no_fill)
@@ -0,0 +1,246 @@
+// Handoff latency and wakeups per frame of AudioQueue against the previous design, where all the
+// queues shared one mutex and one condition variable notified with notify_all().
+//
+// Two streams run at once like the uplink (input -> encoder) and the downlink (decoder -> output):
+// a producer thread pushes a timestamped frame every millisecond and a consumer thread blocks until
+// it arrives. The wakeups of the consumers are counted, a wakeup that finds nothing to pop is wasted.
+
+#include "audio_queue.h"
+#include "host_test.h"
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <condition_variable>
+#include <esp_timer.h>
+
+#define STREAMS 2
+#define FRAME_INTERVAL_US 1000
+
+struct BenchmarkResult {
+    std::vector<int64_t> handoff_us;
+    uint64_t wakeups = 0;
+    uint64_t frames = 0;
+    bool in_order = true;
+};
+
+static void Pace(int64_t start, long frame) {
+    int64_t due = start + frame * FRAME_INTERVAL_US;
+    while (esp_timer_get_time() < due) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+static void Report(const char* name, BenchmarkResult& result) {
+    auto& handoff = result.handoff_us;
+    std::sort(handoff.begin(), handoff.end());
+    int64_t total = 0;
+    for (auto us : handoff) {
+        total += us;
+    }
+    printf("%-22s frames %6llu, handoff avg %5lld us, p99 %5lld us, wakeups per frame %.2f\n", name,
+        (unsigned long long)result.frames, handoff.empty() ? 0 : (long long)(total / (int64_t)handoff.size()),
+        handoff.empty() ? 0 : (long long)handoff[handoff.size() * 99 / 100], (double)result.wakeups / result.frames);
+}
+
+static BenchmarkResult RunSharedLock(long frames) {
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<int64_t> queues[STREAMS];
+    std::mutex result_mutex;
+    BenchmarkResult result;
+
+    auto consumer = [&](int stream) {
+        std::vector<int64_t> handoff;
+        uint64_t wakeups = 0;
+        int64_t last = 0;
+        bool in_order = true;
+        std::unique_lock<std::mutex> lock(mutex);
+        for (long received = 0; received < frames;) {
+            if (queues[stream].empty()) {
+                condition.wait(lock);
+                wakeups++;
+                continue;
+            }
+            int64_t pushed = queues[stream].front();
+            queues[stream].pop_front();
+            handoff.push_back(esp_timer_get_time() - pushed);
+            in_order = in_order && pushed >= last;
+            last = pushed;
+            received++;
+        }
+        std::lock_guard<std::mutex> result_lock(result_mutex);
+        result.handoff_us.insert(result.handoff_us.end(), handoff.begin(), handoff.end());
+        result.wakeups += wakeups;
+        result.frames += frames;
+        result.in_order = result.in_order && in_order;
+    };
+    auto producer = [&](int stream) {
+        int64_t start = esp_timer_get_time();
+        for (long i = 0; i < frames; i++) {
+            Pace(start, i);
+            std::lock_guard<std::mutex> lock(mutex);
+            queues[stream].push_back(esp_timer_get_time());
+            condition.notify_all();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < STREAMS; i++) {
+        threads.emplace_back(consumer, i);
+        threads.emplace_back(producer, i);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return result;
+}
+
+static BenchmarkResult RunAudioQueue(long frames) {
+    std::vector<std::unique_ptr<AudioQueue<int64_t>>> queues;
+    for (int i = 0; i < STREAMS; i++) {
+        queues.push_back(std::make_unique<AudioQueue<int64_t>>(16));
+    }
+    std::mutex result_mutex;
+    std::atomic<int> ready = 0;
+    BenchmarkResult result;
+
+    auto consumer = [&](int stream) {
+        auto& queue = *queues[stream];
+        queue.SetDataWaiter(xTaskGetCurrentTaskHandle());
+        ready++;
+        std::vector<int64_t> handoff;
+        uint64_t wakeups = 0;
+        int64_t last = 0;
+        bool in_order = true;
+        for (long received = 0; received < frames;) {
+            int64_t pushed;
+            if (!queue.Pop(pushed)) {
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+                wakeups++;
+                continue;
+            }
+            handoff.push_back(esp_timer_get_time() - pushed);
+            in_order = in_order && pushed >= last;
+            last = pushed;
+            received++;
+        }
+        queue.SetDataWaiter(nullptr);
+        std::lock_guard<std::mutex> result_lock(result_mutex);
+        result.handoff_us.insert(result.handoff_us.end(), handoff.begin(), handoff.end());
+        result.wakeups += wakeups;
+        result.frames += frames;
+        result.in_order = result.in_order && in_order;
+    };
+    auto producer = [&](int stream) {
+        while (ready < STREAMS) {
+            std::this_thread::yield();
+        }
+        int64_t start = esp_timer_get_time();
+        for (long i = 0; i < frames; i++) {
+            Pace(start, i);
+            int64_t now = esp_timer_get_time();
+            while (!queues[stream]->Push(std::move(now))) {
+                queues[stream]->WaitForSpace(pdMS_TO_TICKS(10));
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < STREAMS; i++) {
+        threads.emplace_back(consumer, i);
+        threads.emplace_back(producer, i);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return result;
+}
+
+// A producer blocked on a full queue with no timeout, like the input task on the encode queue:
+// every Pop() has to wake it, a lost wakeup hangs the test
+static void TestBlockedProducer() {
+    const int items = 2000;
+    AudioQueue<int> queue(2);
+    std::atomic<bool> ready = false;
+    queue.SetDataWaiter(xTaskGetCurrentTaskHandle());
+
+    std::thread producer([&]() {
+        ready = true;
+        for (int i = 0; i < items; i++) {
+            int item = i;
+            while (!queue.Push(std::move(item))) {
+                queue.WaitForSpace(portMAX_DELAY);
+            }
+        }
+    });
+    while (!ready) {
+        std::this_thread::yield();
+    }
+
+    int last = -1;
+    int received = 0;
+    while (received < items) {
+        int item;
+        if (!queue.Pop(item)) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        CHECK_EQ(item, last + 1);
+        last = item;
+        received++;
+    }
+    producer.join();
+    CHECK_EQ(received, items);
+    CHECK(queue.Empty());
+}
+
+static void TestClearAndCapacity() {
+    AudioQueue<int> queue(8);
+    CHECK_EQ(queue.max_capacity(), 8);
+    queue.SetCapacity(3);
+    CHECK_EQ(queue.Space(), 3);
+    for (int i = 0; i < 3; i++) {
+        int item = i;
+        CHECK(queue.Push(std::move(item)));
+    }
+    int item = 3;
+    CHECK(!queue.Push(std::move(item)));
+    CHECK(queue.Full());
+    CHECK_EQ(queue.Space(), 0);
+    CHECK_EQ(queue.high_water(), 3);
+
+    // Dropped items keep their slots until the consumer releases them
+    queue.Clear();
+    CHECK(queue.Empty());
+    CHECK(queue.Full());
+    CHECK_EQ(queue.Space(), 0);
+    queue.ReleaseDropped();
+    CHECK(!queue.Full());
+    CHECK_EQ(queue.Space(), 3);
+    item = 4;
+    CHECK(queue.Push(std::move(item)));
+    CHECK(queue.Pop(item));
+    CHECK_EQ(item, 4);
+    CHECK(!queue.Pop(item));
+}
+
+int main(int argc, char** argv) {
+    long frames = HostTestIterations(argc, argv, 300);
+
+    TestClearAndCapacity();
+    TestBlockedProducer();
+
+    auto shared = RunSharedLock(frames);
+    auto ring = RunAudioQueue(frames);
+    Report("shared mutex + cv", shared);
+    Report("AudioQueue", ring);
+    CHECK(shared.in_order && ring.in_order);
+    CHECK_EQ(ring.frames, STREAMS * frames);
+    // Only the producer of its own stream wakes a consumer
+    CHECK(ring.wakeups <= ring.frames);
+    return HostTestResult("audio_queue_benchmark");
+}
@@ -0,0 +1,447 @@
+// AudioService on host threads, with WavAudioCodec as microphone and speaker, in three scenarios:
+//   - conversation: auto listening mode against LoopbackProtocol, which plays every listening turn
+//     back as the reply. The argument is its simulated length in seconds, 1800 for 30 minutes
+//   - burst TTS downlink: a server that sends a whole reply as fast as the network goes, instead of
+//     in real time
+//   - audio testing: records the microphone into the testing queue, then plays it back
+//   - codec override: the service plays through its own codec while the board's codec has another
+//     output rate, like CONFIG_USE_WAV_AUDIO_CODEC on a real board
+// The stubs run on a clock SIMULATOR_CLOCK_SPEED times faster than real time. The pipeline measures
+// itself in that time (esp_timer), so to it the host looks that many times slower. Each scenario
+// reports the frame drops, the queue high water marks and the host CPU time per frame of each task.
+
+#include "audio_service.h"
+#include "system_info.h"
+#include "codecs/wav_audio_codec.h"
+#include "loopback_protocol.h"
+#include "board.h"
+#include "host_test.h"
+
+#include <map>
+#include <cstdio>
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <cstring>
+
+#define SIMULATOR_CLOCK_SPEED 10
+#define SIMULATOR_OUTPUT_SAMPLE_RATE 24000
+// Simulated, the time a stopped service gets for its tasks to return
+#define SIMULATOR_STOP_TIMEOUT_MS 5000
+#define BURST_FRAME_DURATION_MS 60
+// The reply arrives this many times faster than it plays
+#define BURST_NETWORK_SPEED 30
+#define AUDIO_TESTING_RECORD_MS 4000
+#define BOARD_OUTPUT_SAMPLE_RATE 16000
+#define CODEC_OVERRIDE_FRAMES 20
+
+#define APP_EVENT_SEND_AUDIO (1 << 0)
+#define APP_EVENT_TTS_START (1 << 1)
+#define APP_EVENT_TTS_STOP (1 << 2)
+#define APP_EVENT_STOP (1 << 3)
+
+static const std::string kMicrophoneWav = std::string(XIAOZHI_VAD_CORPUS_DIR) + "/quiet_room.wav";
+
+// Chip tier of the encoder governor
+std::string SystemInfo::GetChipModelName() {
+    return "esp32s3";
+}
+
+class HostBoard : public Board {
+public:
+    AudioCodec* codec = nullptr;
+
+    AudioCodec* GetAudioCodec() override { return codec; }
+};
+
+void* create_board() {
+    return new HostBoard();
+}
+
+static void SetBoardCodec(AudioCodec* codec) {
+    static_cast<HostBoard&>(Board::GetInstance()).codec = codec;
+}
+
+/*
+ * The audio part of Application in auto listening mode: the main task sends the uplink, plays the
+ * replies and starts listening again after each one. Like the application it lives until exit,
+ * because the loopback reply task may still call it.
+ */
+class HostApplication {
+public:
+    HostApplication(Protocol& protocol) : protocol_(protocol) {
+        event_group_ = xEventGroupCreate();
+        protocol_.OnIncomingAudio([this](std::unique_ptr<AudioStreamPacket> packet) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (audio_service_ != nullptr && speaking_) {
+                downlink_frames_++;
+                audio_service_->PushPacketToDecodeQueue(std::move(packet));
+            }
+        });
+        protocol_.OnIncomingJson([this](const cJSON* root) {
+            auto type = cJSON_GetObjectItem(root, "type");
+            auto state = cJSON_GetObjectItem(root, "state");
+            if (cJSON_IsString(type) && strcmp(type->valuestring, "tts") == 0 && cJSON_IsString(state)) {
+                if (strcmp(state->valuestring, "start") == 0) {
+                    xEventGroupSetBits(event_group_, APP_EVENT_TTS_START);
+                } else if (strcmp(state->valuestring, "stop") == 0) {
+                    xEventGroupSetBits(event_group_, APP_EVENT_TTS_STOP);
+                }
+            }
+        });
+    }
+
+    void Start(AudioService* audio_service) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            audio_service_ = audio_service;
+            speaking_ = false;
+        }
+        AudioServiceCallbacks callbacks;
+        callbacks.on_send_queue_available = [this]() {
+            xEventGroupSetBits(event_group_, APP_EVENT_SEND_AUDIO);
+        };
+        audio_service->SetCallbacks(callbacks);
+        xEventGroupClearBits(event_group_, APP_EVENT_STOP);
+        xTaskCreate([](void* arg) {
+            ((HostApplication*)arg)->MainTask();
+            vTaskDelete(NULL);
+        }, "main", 4096, this, 3, nullptr);
+
+        protocol_.OpenAudioChannel();
+        protocol_.SendStartListening(kListeningModeAutoStop);
+        audio_service->EnableVoiceProcessing(true);
+    }
+
+    // The main task returns soon after, before the audio service may be deleted
+    void Stop() {
+        xEventGroupSetBits(event_group_, APP_EVENT_STOP);
+        protocol_.CloseAudioChannel();
+        std::lock_guard<std::mutex> lock(mutex_);
+        audio_service_ = nullptr;
+    }
+
+    int turns() const { return turns_; }
+    long uplink_frames() const { return uplink_frames_; }
+    long downlink_frames() const { return downlink_frames_; }
+
+private:
+    Protocol& protocol_;
+    EventGroupHandle_t event_group_;
+    std::mutex mutex_;
+    AudioService* audio_service_ = nullptr;    // Guarded by mutex_, so no audio is pushed after Stop()
+    bool speaking_ = false;
+    int turns_ = 0;
+    long uplink_frames_ = 0;
+    long downlink_frames_ = 0;
+
+    void MainTask() {
+        while (true) {
+            auto bits = xEventGroupWaitBits(event_group_, APP_EVENT_SEND_AUDIO | APP_EVENT_TTS_START |
+                APP_EVENT_TTS_STOP | APP_EVENT_STOP, pdTRUE, pdFALSE, portMAX_DELAY);
+            if (bits & APP_EVENT_STOP) {
+                break;
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (bits & APP_EVENT_SEND_AUDIO) {
+                while (auto packet = audio_service_->PopPacketFromSendQueue()) {
+                    uplink_frames_++;
+                    protocol_.SendAudio(std::move(packet));
+                }
+            }
+            if ((bits & APP_EVENT_TTS_START) && !speaking_) {
+                speaking_ = true;
+                turns_++;
+                audio_service_->EnableVoiceProcessing(false);
+                audio_service_->ResetDecoder();
+            }
+            if ((bits & APP_EVENT_TTS_STOP) && speaking_) {
+                speaking_ = false;
+                protocol_.SendStartListening(kListeningModeAutoStop);
+                audio_service_->EnableVoiceProcessing(true);
+            }
+        }
+    }
+};
+
+// Host CPU time of each task so far, in us
+static std::map<std::string, uint32_t> GetTaskCpuTimes() {
+    TaskStatus_t status[16];
+    UBaseType_t count = uxTaskGetSystemState(status, 16, nullptr);
+    std::map<std::string, uint32_t> times;
+    for (UBaseType_t i = 0; i < count; i++) {
+        times[status[i].pcTaskName] = status[i].ulRunTimeCounter;
+    }
+    return times;
+}
+
+static double PerFrame(uint32_t us, uint32_t frames) {
+    return frames > 0 ? (double)us / frames : 0;
+}
+
+static void Report(const char* scenario, const AudioPipelineStatistics& stats, const std::map<std::string, uint32_t>& cpu) {
+    auto& debug = stats.debug;
+    auto& jitter = stats.jitter;
+    printf("%s: drops: decode queue %lu, jitter buffer late %lu, lost %lu, concealed %lu, underruns %lu\n",
+        scenario, (unsigned long)debug.decode_drop_count, (unsigned long)jitter.late_packets,
+        (unsigned long)jitter.lost_packets, (unsigned long)jitter.concealed_frames, (unsigned long)jitter.underruns);
+    printf("%s: queue high water: encode %zu/%zu, send %zu/%zu, testing %zu/%zu, decode %zu/%zu, playback %zu/%zu\n",
+        scenario, stats.encode_queue.high_water, stats.encode_queue.capacity,
+        stats.send_queue.high_water, stats.send_queue.capacity,
+        stats.testing_queue.high_water, stats.testing_queue.capacity,
+        stats.decode_queue.high_water, stats.decode_queue.capacity,
+        stats.playback_queue.high_water, stats.playback_queue.capacity);
+    auto time = [&](const char* task) {
+        auto it = cpu.find(task);
+        return it != cpu.end() ? it->second : 0;
+    };
+    printf("%s: host CPU per frame: input %.0f us (%lu frames), encoder %.0f us (%lu), decoder %.0f us (%lu), output %.0f us (%lu)\n",
+        scenario, PerFrame(time("audio_input"), debug.input_count), (unsigned long)debug.input_count,
+        PerFrame(time("opus_encoder"), debug.encode_count), (unsigned long)debug.encode_count,
+        PerFrame(time("opus_decoder"), debug.decode_count), (unsigned long)debug.decode_count,
+        PerFrame(time("audio_output"), debug.playback_count), (unsigned long)debug.playback_count);
+}
+
+// Stops the service and waits until only other_tasks are left, so it can be deleted
+static void StopService(AudioService* audio_service, UBaseType_t other_tasks) {
+    audio_service->Stop();
+    int64_t deadline = esp_timer_get_time() + SIMULATOR_STOP_TIMEOUT_MS * 1000;
+    while (uxTaskGetNumberOfTasks() > other_tasks && esp_timer_get_time() < deadline) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    CHECK_EQ(uxTaskGetNumberOfTasks(), other_tasks);
+}
+
+// Waits until the service has played everything queued, false after timeout_ms
+static bool WaitForIdle(AudioService* audio_service, int timeout_ms) {
+    for (int waited = 0; waited < timeout_ms; waited += 20) {
+        if (audio_service->IsIdle()) {
+            // Give the output task the last frame it popped
+            vTaskDelay(pdMS_TO_TICKS(120));
+            return true;
+        }
+        vTaskDelay(pdMS_TO_TICKS(20));
+    }
+    return false;
+}
+
+static void RunConversation(long seconds) {
+    // Like the application, the protocol and its reply task live until exit
+    static LoopbackProtocol* protocol = new LoopbackProtocol();
+    static HostApplication* application = new HostApplication(*protocol);
+    UBaseType_t other_tasks = uxTaskGetNumberOfTasks();
+
+    WavAudioCodec codec(kMicrophoneWav, "", SIMULATOR_OUTPUT_SAMPLE_RATE);
+    SetBoardCodec(&codec);
+    auto audio_service = new AudioService();
+    audio_service->Initialize(&codec);
+    audio_service->Start();
+    protocol->Start();
+    application->Start(audio_service);
+
+    auto start = std::chrono::steady_clock::now();
+    vTaskDelay(pdMS_TO_TICKS(seconds * 1000));
+    auto stats = audio_service->GetPipelineStatistics();
+    auto cpu = GetTaskCpuTimes();
+    application->Stop();
+    StopService(audio_service, other_tasks);
+    double real_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    delete audio_service;
+
+    printf("conversation: %ld s simulated in %.1f s, %d turns, %ld frames sent, %ld frames received\n",
+        seconds, real_seconds, application->turns(), application->uplink_frames(), application->downlink_frames());
+    Report("conversation", stats, cpu);
+    // A turn is LOOPBACK_MAX_TURN_MS of listening, then the same length of reply
+    CHECK(application->turns() >= seconds * 1000 / (2 * LOOPBACK_MAX_TURN_MS) - 1);
+    CHECK(application->downlink_frames() <= application->uplink_frames());
+    CHECK_EQ(stats.debug.decode_drop_count, 0);
+    CHECK(stats.send_queue.high_water < stats.send_queue.capacity);
+}
+
+// Encodes frames of the microphone recording, like the TTS of a server. The source is read without waiting
+static std::vector<std::unique_ptr<AudioStreamPacket>> EncodeReply(int frames) {
+    WavAudioCodec source(kMicrophoneWav, "", 16000, 1e6);
+    OpusFrameEncoder encoder(16000, 1, BURST_FRAME_DURATION_MS);
+    std::vector<std::unique_ptr<AudioStreamPacket>> packets;
+    std::vector<int16_t> pcm(16000 * BURST_FRAME_DURATION_MS / 1000);
+    for (int i = 0; i < frames; i++) {
+        source.InputData(pcm);
+        auto packet = NewAudioStreamPacket();
+        packet->sample_rate = 16000;
+        packet->frame_duration = BURST_FRAME_DURATION_MS;
+        packet->sequence = i + 1;
+        CHECK(encoder.Encode(pcm, packet->payload));
+        packets.push_back(std::move(packet));
+    }
+    return packets;
+}
+
+// The whole reply arrives at network speed, the decode queue and the jitter buffer take what they can
+static void RunBurstDownlink(int burst_ms) {
+    char scenario[32];
+    snprintf(scenario, sizeof(scenario), "burst %d ms", burst_ms);
+    int frames = burst_ms / BURST_FRAME_DURATION_MS;
+    auto packets = EncodeReply(frames);
+    UBaseType_t other_tasks = uxTaskGetNumberOfTasks();
+
+    WavAudioCodec codec(kMicrophoneWav, "", SIMULATOR_OUTPUT_SAMPLE_RATE);
+    SetBoardCodec(&codec);
+    auto audio_service = new AudioService();
+    audio_service->Initialize(&codec);
+    audio_service->Start();
+    audio_service->ResetDecoder();
+
+    int64_t start = esp_timer_get_time();
+    int accepted = 0;
+    for (auto& packet : packets) {
+        packet->origin_time = esp_timer_get_time();
+        accepted += audio_service->PushPacketToDecodeQueue(std::move(packet));
+        vTaskDelay(pdMS_TO_TICKS(BURST_FRAME_DURATION_MS / BURST_NETWORK_SPEED));
+    }
+    CHECK(WaitForIdle(audio_service, burst_ms + 5000));
+    int64_t played_ms = (esp_timer_get_time() - start) / 1000;
+    auto stats = audio_service->GetPipelineStatistics();
+    auto cpu = GetTaskCpuTimes();
+    StopService(audio_service, other_tasks);
+    delete audio_service;
+
+    printf("%s: %d frames pushed, %d accepted, played in %lld ms\n", scenario, frames, accepted, (long long)played_ms);
+    Report(scenario, stats, cpu);
+    CHECK_EQ((int)stats.debug.decode_drop_count, frames - accepted);
+    // Every accepted frame is decoded once, none is late or lost in the jitter buffer
+    CHECK_EQ((int)(stats.debug.decode_count - stats.jitter.concealed_frames), accepted);
+    if (burst_ms <= MAX_DECODE_DURATION_MS) {
+        CHECK_EQ(accepted, frames);
+    }
+}
+
+static void RunAudioTesting() {
+    UBaseType_t other_tasks = uxTaskGetNumberOfTasks();
+    WavAudioCodec codec(kMicrophoneWav, "", SIMULATOR_OUTPUT_SAMPLE_RATE);
+    SetBoardCodec(&codec);
+    auto audio_service = new AudioService();
+    audio_service->Initialize(&codec);
+    audio_service->Start();
+
+    audio_service->EnableAudioTesting(true);
+    vTaskDelay(pdMS_TO_TICKS(AUDIO_TESTING_RECORD_MS));
+    audio_service->EnableAudioTesting(false);
+    CHECK(WaitForIdle(audio_service, AUDIO_TESTING_RECORD_MS + 5000));
+    auto stats = audio_service->GetPipelineStatistics();
+    auto cpu = GetTaskCpuTimes();
+    StopService(audio_service, other_tasks);
+    delete audio_service;
+
+    printf("audio testing: %lu frames recorded, %lu played back\n",
+        (unsigned long)stats.debug.encode_count, (unsigned long)stats.debug.decode_count);
+    Report("audio testing", stats, cpu);
+    CHECK(stats.debug.encode_count >= AUDIO_TESTING_RECORD_MS / OPUS_FRAME_DURATION_MS - 2);
+    CHECK_EQ(stats.debug.decode_count, stats.debug.encode_count);
+}
+
+// Samples in the data chunk of a WAV file written by WavAudioCodec, -1 if it cannot be read
+static long ReadWavSamples(const std::string& path) {
+    uint8_t header[44];
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return -1;
+    }
+    size_t read = fread(header, 1, sizeof(header), file);
+    fclose(file);
+    if (read != sizeof(header)) {
+        return -1;
+    }
+    uint32_t data_size = header[40] | (header[41] << 8) | (header[42] << 16) | ((uint32_t)header[43] << 24);
+    return data_size / sizeof(int16_t);
+}
+
+static void WriteLe32(uint8_t* p, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+// The input loops over the data chunk only, a LIST chunk after it is not played as audio
+static void RunWavTrailingChunk() {
+    const std::string path = "audio_service_simulator_input.wav";
+    const int samples = 100;
+    uint8_t header[44] = {'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E', 'f', 'm', 't', ' ', 16, 0, 0, 0,
+        1, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 16, 0, 'd', 'a', 't', 'a'};
+    const char list[] = "LIST\x0c\0\0\0INFOISFT\0\0\0\0";
+    WriteLe32(header + 4, sizeof(header) - 8 + samples * sizeof(int16_t) + sizeof(list) - 1);
+    WriteLe32(header + 24, 16000);
+    WriteLe32(header + 28, 16000 * sizeof(int16_t));
+    WriteLe32(header + 40, samples * sizeof(int16_t));
+    std::vector<int16_t> data(samples);
+    for (int i = 0; i < samples; i++) {
+        data[i] = i + 1;
+    }
+    FILE* file = fopen(path.c_str(), "wb");
+    CHECK(file != nullptr);
+    fwrite(header, 1, sizeof(header), file);
+    fwrite(data.data(), sizeof(int16_t), samples, file);
+    fwrite(list, 1, sizeof(list) - 1, file);
+    fclose(file);
+
+    std::vector<int16_t> pcm(samples * 5 / 2);
+    {
+        WavAudioCodec codec(path, "", SIMULATOR_OUTPUT_SAMPLE_RATE, 1e6);
+        codec.InputData(pcm);
+        codec.InputData(pcm);
+    }
+    remove(path.c_str());
+    // The second read starts at sample 250 of the looped input
+    int mismatches = 0;
+    for (size_t i = 0; i < pcm.size(); i++) {
+        mismatches += pcm[i] != (int16_t)((pcm.size() + i) % samples + 1);
+    }
+    printf("wav trailing chunk: %d of %zu samples not from the data chunk\n", mismatches, pcm.size());
+    CHECK_EQ(mismatches, 0);
+}
+
+// The downlink is resampled to the rate of the codec the service was initialized with, not the board's
+static void RunCodecOverride() {
+    const std::string output_path = "audio_service_simulator_output.wav";
+    auto packets = EncodeReply(CODEC_OVERRIDE_FRAMES);
+    UBaseType_t other_tasks = uxTaskGetNumberOfTasks();
+
+    WavAudioCodec board_codec("", "", BOARD_OUTPUT_SAMPLE_RATE);
+    SetBoardCodec(&board_codec);
+    auto codec = new WavAudioCodec("", output_path, SIMULATOR_OUTPUT_SAMPLE_RATE);
+    auto audio_service = new AudioService();
+    audio_service->Initialize(codec);
+    audio_service->Start();
+    audio_service->ResetDecoder();
+
+    for (auto& packet : packets) {
+        packet->origin_time = esp_timer_get_time();
+        CHECK(audio_service->PushPacketToDecodeQueue(std::move(packet)));
+    }
+    CHECK(WaitForIdle(audio_service, CODEC_OVERRIDE_FRAMES * BURST_FRAME_DURATION_MS + 5000));
+    auto stats = audio_service->GetPipelineStatistics();
+    StopService(audio_service, other_tasks);
+    delete audio_service;
+    delete codec;
+
+    long samples = ReadWavSamples(output_path);
+    remove(output_path.c_str());
+    long expected = (long)stats.debug.decode_count * SIMULATOR_OUTPUT_SAMPLE_RATE * BURST_FRAME_DURATION_MS / 1000;
+    printf("codec override: %lu frames decoded at 16000 Hz, %ld samples written at %d Hz, %ld expected\n",
+        (unsigned long)stats.debug.decode_count, samples, SIMULATOR_OUTPUT_SAMPLE_RATE, expected);
+    CHECK_EQ(stats.debug.decode_count, CODEC_OVERRIDE_FRAMES);
+    // The resampler may hold back a few samples of its filter history
+    CHECK(samples > expected - SIMULATOR_OUTPUT_SAMPLE_RATE / 100 && samples <= expected);
+}
+
+int main(int argc, char** argv) {
+    long seconds = HostTestIterations(argc, argv, 30);
+    HostSetClockSpeed(SIMULATOR_CLOCK_SPEED);
+
+    RunBurstDownlink(MAX_DECODE_DURATION_MS);
+    RunBurstDownlink(4 * MAX_DECODE_DURATION_MS);
+    RunAudioTesting();
+    RunCodecOverride();
+    RunWavTrailingChunk();
+    RunConversation(seconds);
+    return HostTestResult("audio_service_simulator");
+}
@@ -0,0 +1,225 @@
+// ParseBinaryFrame() / ParseBinaryFrames(): round trip of well-formed frames of every protocol version,
+// every truncation of them, and random and mutated frames, which must never be read out of bounds or
+// modified. Then the parse time per frame against the previous in-place byte swap of version 2.
+
+#include "protocol.h"
+#include "host_test.h"
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <random>
+#include <vector>
+
+typedef std::vector<uint8_t> Bytes;
+
+struct TestFrame {
+    uint16_t type;
+    uint32_t timestamp;
+    Bytes payload;
+};
+
+static void PutBigEndian16(Bytes& data, uint16_t value) {
+    data.push_back(value >> 8);
+    data.push_back(value & 0xFF);
+}
+
+static void PutBigEndian32(Bytes& data, uint32_t value) {
+    PutBigEndian16(data, value >> 16);
+    PutBigEndian16(data, value & 0xFFFF);
+}
+
+// The message a server sends, written field by field from the protocol documentation
+static Bytes Encode(int version, const std::vector<TestFrame>& frames) {
+    Bytes data;
+    if (version == 2) {
+        PutBigEndian16(data, 2);
+        PutBigEndian16(data, frames[0].type);
+        PutBigEndian32(data, 0);
+        PutBigEndian32(data, frames[0].timestamp);
+        PutBigEndian32(data, frames[0].payload.size());
+    } else if (version == 3) {
+        data.push_back(frames[0].type);
+        data.push_back(0);
+        PutBigEndian16(data, frames[0].payload.size());
+    } else if (version == 4) {
+        data.push_back(frames.empty() ? 0 : frames[0].type);
+        data.push_back(frames.size());
+        PutBigEndian16(data, 0);
+        for (auto& frame : frames) {
+            PutBigEndian32(data, frame.timestamp);
+            PutBigEndian16(data, frame.payload.size());
+            data.insert(data.end(), frame.payload.begin(), frame.payload.end());
+        }
+        return data;
+    }
+    data.insert(data.end(), frames[0].payload.begin(), frames[0].payload.end());
+    return data;
+}
+
+static std::vector<TestFrame> RandomFrames(std::mt19937& random, int version) {
+    int count = version == 4 ? random() % (BINARY_PROTOCOL4_MAX_FRAMES + 1) : 1;
+    std::vector<TestFrame> frames(count);
+    for (auto& frame : frames) {
+        frame.type = 0;
+        frame.timestamp = version == 2 || version == 4 ? random() : 0;
+        frame.payload.resize(random() % 400);
+        for (auto& byte : frame.payload) {
+            byte = random();
+        }
+    }
+    return frames;
+}
+
+// Parses a copy in an allocation of exactly size bytes, so a read past it is caught by ASan, and
+// checks that every payload lies inside the message and that the message is not modified
+static int CheckedParse(int version, const Bytes& message, BinaryFrame* frames) {
+    std::unique_ptr<uint8_t[]> data(new uint8_t[message.size() + (message.empty() ? 1 : 0)]);
+    std::copy(message.begin(), message.end(), data.get());
+    int count = ParseBinaryFrames(version, data.get(), message.size(), frames, BINARY_PROTOCOL4_MAX_FRAMES);
+    CHECK(count >= -1 && count <= BINARY_PROTOCOL4_MAX_FRAMES);
+    const uint8_t* end = data.get() + message.size();
+    for (int i = 0; i < count; i++) {
+        CHECK(frames[i].payload >= data.get() && frames[i].payload <= end);
+        CHECK(frames[i].payload_size <= (size_t)(end - frames[i].payload));
+        // Payloads follow each other in the message
+        if (i > 0) {
+            CHECK(frames[i].payload >= frames[i - 1].payload + frames[i - 1].payload_size);
+        }
+    }
+    // Point back into the caller's copy for the comparisons
+    for (int i = 0; i < count; i++) {
+        frames[i].payload = message.data() + (frames[i].payload - data.get());
+    }
+    CHECK(std::equal(message.begin(), message.end(), data.get()));
+    return count;
+}
+
+static void TestRoundTrip(std::mt19937& random) {
+    BinaryFrame frames[BINARY_PROTOCOL4_MAX_FRAMES];
+    for (int version = 1; version <= 4; version++) {
+        for (int n = 0; n < 200; n++) {
+            auto expected = RandomFrames(random, version);
+            auto message = Encode(version, expected);
+            int count = CheckedParse(version, message, frames);
+            CHECK_EQ(count, expected.size());
+            for (int i = 0; i < count && i < (int)expected.size(); i++) {
+                CHECK_EQ(frames[i].type, expected[i].type);
+                CHECK_EQ(frames[i].timestamp, expected[i].timestamp);
+                CHECK(Bytes(frames[i].payload, frames[i].payload + frames[i].payload_size) == expected[i].payload);
+            }
+
+            // Every truncation is rejected, except for version 1 which has no header
+            for (size_t size = 0; size < message.size(); size++) {
+                Bytes truncated(message.begin(), message.begin() + size);
+                count = CheckedParse(version, truncated, frames);
+                if (version == 1) {
+                    CHECK_EQ(count, 1);
+                    CHECK_EQ(frames[0].payload_size, size);
+                } else if (version == 4 && expected.empty() && size >= sizeof(BinaryProtocol4)) {
+                    CHECK_EQ(count, 0);
+                } else {
+                    CHECK_EQ(count, -1);
+                }
+            }
+
+            // Bytes after the declared payload are ignored by versions 2 and 3
+            if (version == 2 || version == 3) {
+                message.push_back(0xAA);
+                count = CheckedParse(version, message, frames);
+                CHECK_EQ(count, 1);
+                CHECK_EQ(frames[0].payload_size, expected[0].payload.size());
+            }
+        }
+    }
+
+    // More frames than the caller has room for
+    BinaryFrame one;
+    std::vector<TestFrame> two(2, TestFrame{ 0, 1, Bytes(10, 1) });
+    auto message = Encode(4, two);
+    CHECK_EQ(ParseBinaryFrames(4, message.data(), message.size(), &one, 1), -1);
+    CHECK_EQ(ParseBinaryFrames(2, message.data(), message.size(), &one, 0), -1);
+}
+
+static void TestFuzz(std::mt19937& random, long iterations) {
+    BinaryFrame frames[BINARY_PROTOCOL4_MAX_FRAMES];
+    long parsed = 0;
+    for (long n = 0; n < iterations; n++) {
+        int version = 1 + random() % 4;
+        Bytes message;
+        if (random() % 2) {
+            // Random bytes
+            message.resize(random() % 64);
+            for (auto& byte : message) {
+                byte = random();
+            }
+        } else {
+            // A valid message with a few bytes flipped, often in the size fields
+            message = Encode(version, RandomFrames(random, version));
+            int flips = 1 + random() % 4;
+            for (int i = 0; i < flips && !message.empty(); i++) {
+                size_t position = random() % 4 == 0 ? random() % message.size() : random() % std::min<size_t>(message.size(), 16);
+                message[position] ^= 1 << (random() % 8);
+            }
+            if (random() % 4 == 0) {
+                message.resize(random() % (message.size() + 1));
+            }
+        }
+        if (CheckedParse(version, message, frames) >= 0) {
+            parsed++;
+        }
+    }
+    printf("binary_frame_fuzz: %ld of %ld random and mutated messages parsed\n", parsed, iterations);
+}
+
+// The websocket handler before ParseBinaryFrame(): the header was swapped in the received buffer
+static size_t LegacyParseVersion2(uint8_t* data, uint32_t& timestamp) {
+    BinaryProtocol2* bp2 = (BinaryProtocol2*)data;
+    bp2->version = ntohs(bp2->version);
+    bp2->type = ntohs(bp2->type);
+    bp2->timestamp = ntohl(bp2->timestamp);
+    bp2->payload_size = ntohl(bp2->payload_size);
+    timestamp = bp2->timestamp;
+    return bp2->payload_size;
+}
+
+static void Benchmark(long iterations) {
+    std::vector<TestFrame> frames(1, TestFrame{ 0, 123456, Bytes(180, 7) });
+    auto message = Encode(2, frames);
+    auto batch = Encode(4, std::vector<TestFrame>(BINARY_PROTOCOL4_MAX_FRAMES, frames[0]));
+    BinaryFrame parsed[BINARY_PROTOCOL4_MAX_FRAMES];
+    volatile size_t sink = 0;
+    iterations *= 1000;
+
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; i++) {
+        ParseBinaryFrame(2, message.data(), message.size(), parsed[0]);
+        sink = sink + parsed[0].payload_size;
+    }
+    auto middle = std::chrono::steady_clock::now();
+    // The legacy parse swaps the header in place, so it gets a fresh copy of the header every time
+    Bytes scratch = message;
+    for (long i = 0; i < iterations; i++) {
+        std::copy(message.begin(), message.begin() + sizeof(BinaryProtocol2), scratch.begin());
+        uint32_t timestamp;
+        sink = sink + LegacyParseVersion2(scratch.data(), timestamp) + timestamp;
+    }
+    auto batch_start = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; i++) {
+        sink = sink + ParseBinaryFrames(4, batch.data(), batch.size(), parsed, BINARY_PROTOCOL4_MAX_FRAMES);
+    }
+    auto end = std::chrono::steady_clock::now();
+    auto ns = [iterations](auto from, auto to) {
+        return std::chrono::duration<double, std::nano>(to - from).count() / iterations;
+    };
+    printf("binary_frame_fuzz: version 2 frame %.1f ns (in-place swap with header copy %.1f ns), version 4 message of %d frames %.1f ns\n",
+        ns(start, middle), ns(middle, batch_start), BINARY_PROTOCOL4_MAX_FRAMES, ns(batch_start, end));
+}
+
+int main(int argc, char** argv) {
+    long iterations = HostTestIterations(argc, argv, 100000);
+    std::mt19937 random(1);
+    TestRoundTrip(random);
+    TestFuzz(random, iterations);
+    Benchmark(iterations / 1000);
+    return HostTestResult("binary_frame_fuzz");
+}
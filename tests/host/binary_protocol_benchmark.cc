@@ -0,0 +1,276 @@
+// Version 4 messages of several frames against the single-frame messages of versions 2 and 3, through
+// a stand-in server on a local TCP connection, in both directions:
+//   - uplink: the device thread writes the messages of PrependBinaryFrameHeader() and
+//     BuildBinaryProtocol4Message(), like WebsocketProtocol::SendAudio() / SendAudioBatch(), and the
+//     server thread reads and checks them
+//   - downlink: the server writes the messages, the device thread reads each one, parses it with
+//     ParseBinaryFrames() and copies the frames into packets, like the websocket OnData handler
+// Every message goes out in one send and is read with one receive behind a 4-byte length, which stands
+// in for the WebSocket framing. There is no TLS here; on target each message is also a TLS record, so
+// the saving per message is larger. Reports messages per second and the CPU time of the device thread
+// per frame.
+
+#include "protocol.h"
+#include "host_test.h"
+
+#include <ctime>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <cstring>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// Opus frames of 60 ms: 16 kHz speech up, 24 kHz TTS down
+#define UPLINK_PAYLOAD_SIZE 120
+#define DOWNLINK_PAYLOAD_SIZE 180
+
+typedef std::vector<uint8_t> Bytes;
+
+struct Config {
+    int version;
+    int frames_per_message;
+};
+
+static const Config kConfigs[] = {
+    { 2, 1 },
+    { 3, 1 },
+    { 4, 1 },
+    { 4, 4 },
+    { 4, BINARY_PROTOCOL4_MAX_FRAMES },
+};
+
+struct Result {
+    long frames = 0;
+    long messages = 0;
+    double seconds = 0;
+    double device_cpu_seconds = 0;
+};
+
+static double ThreadCpuSeconds() {
+    timespec time;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+// A connected pair of TCP sockets on the loopback interface, without Nagle like the websocket client
+static bool Connect(int& device, int& server) {
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (listener < 0 || bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 1) != 0 ||
+        getsockname(listener, (sockaddr*)&address, &length) != 0) {
+        perror("listen");
+        return false;
+    }
+    device = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(device, (sockaddr*)&address, sizeof(address)) != 0) {
+        perror("connect");
+        return false;
+    }
+    server = accept(listener, nullptr, nullptr);
+    close(listener);
+    int one = 1;
+    setsockopt(device, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(server, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return server >= 0;
+}
+
+static bool SendMessage(int socket, const uint8_t* message, size_t size) {
+    uint32_t length = htonl(size);
+    iovec parts[2] = { { &length, sizeof(length) }, { (void*)message, size } };
+    return writev(socket, parts, 2) == (ssize_t)(sizeof(length) + size);
+}
+
+static bool ReceiveMessage(int socket, Bytes& message) {
+    uint32_t length;
+    if (recv(socket, &length, sizeof(length), MSG_WAITALL) != sizeof(length)) {
+        return false;
+    }
+    message.resize(ntohl(length));
+    return recv(socket, message.data(), message.size(), MSG_WAITALL) == (ssize_t)message.size();
+}
+
+// The frame number goes in the timestamp and the first payload bytes, version 3 has no timestamp
+static void FillPayload(uint8_t* payload, size_t size, uint32_t frame) {
+    memset(payload, (uint8_t)frame, size);
+    memcpy(payload, &frame, sizeof(frame));
+}
+
+static bool CheckFrame(const BinaryFrame& frame, int version, size_t payload_size, uint32_t expected) {
+    uint32_t number;
+    if (frame.payload_size != payload_size) {
+        return false;
+    }
+    memcpy(&number, frame.payload, sizeof(number));
+    return number == expected && (version == 3 || frame.timestamp == expected);
+}
+
+// Reads the messages until all the frames arrived, returns how many were in order and intact
+static long ReceiveFrames(int socket, int version, size_t payload_size, long frames, long& messages, bool copy) {
+    Bytes message;
+    BinaryFrame parsed[BINARY_PROTOCOL4_MAX_FRAMES];
+    std::unique_ptr<AudioStreamPacket> packet(new AudioStreamPacket());
+    long received = 0;
+    long good = 0;
+    while (received < frames && ReceiveMessage(socket, message)) {
+        messages++;
+        int count = ParseBinaryFrames(version, message.data(), message.size(), parsed, BINARY_PROTOCOL4_MAX_FRAMES);
+        for (int i = 0; i < count; i++) {
+            if (copy) {
+                // Like OnData: the only copy of the payload, into a packet that keeps its capacity
+                packet->timestamp = parsed[i].timestamp;
+                packet->payload.assign(parsed[i].payload, parsed[i].payload + parsed[i].payload_size);
+            }
+            good += CheckFrame(parsed[i], version, payload_size, received);
+            received++;
+        }
+        if (count < 0) {
+            break;
+        }
+    }
+    return good;
+}
+
+static Result RunUplink(const Config& config, long frames) {
+    Result result;
+    int device, server;
+    if (!Connect(device, server)) {
+        return result;
+    }
+    long good = 0;
+    long server_messages = 0;
+    std::thread server_thread([&]() {
+        good = ReceiveFrames(server, config.version, UPLINK_PAYLOAD_SIZE, frames, server_messages, false);
+    });
+
+    // Packets from the encoder, with the headroom; the batch buffer is reused like batch_buffer_
+    std::vector<std::unique_ptr<AudioStreamPacket>> batch;
+    std::vector<std::unique_ptr<AudioStreamPacket>> packets;
+    for (int i = 0; i < config.frames_per_message; i++) {
+        packets.emplace_back(new AudioStreamPacket());
+        packets.back()->headroom = AUDIO_PACKET_HEADROOM;
+    }
+    Bytes batch_buffer;
+    auto start = std::chrono::steady_clock::now();
+    double cpu_start = ThreadCpuSeconds();
+    for (long frame = 0; frame < frames;) {
+        batch.clear();
+        for (auto& packet : packets) {
+            if (frame == frames) {
+                break;
+            }
+            packet->payload.resize(AUDIO_PACKET_HEADROOM + UPLINK_PAYLOAD_SIZE);
+            packet->timestamp = frame;
+            FillPayload(packet->payload_data(), UPLINK_PAYLOAD_SIZE, frame++);
+            batch.push_back(std::move(packet));
+        }
+        bool sent;
+        if (batch.size() == 1) {
+            size_t size;
+            uint8_t* message = PrependBinaryFrameHeader(config.version, *batch[0], size);
+            sent = SendMessage(device, message, size);
+        } else {
+            BuildBinaryProtocol4Message(batch, batch_buffer);
+            sent = SendMessage(device, batch_buffer.data(), batch_buffer.size());
+        }
+        CHECK(sent);
+        result.messages++;
+        for (size_t i = 0; i < batch.size(); i++) {
+            packets[i] = std::move(batch[i]);
+        }
+    }
+    result.device_cpu_seconds = ThreadCpuSeconds() - cpu_start;
+    server_thread.join();
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.frames = frames;
+    close(device);
+    close(server);
+    CHECK_EQ(good, frames);
+    CHECK_EQ(server_messages, result.messages);
+    return result;
+}
+
+// The server sends as fast as the device reads, its own cost is not measured
+static Result RunDownlink(const Config& config, long frames) {
+    Result result;
+    int device, server;
+    if (!Connect(device, server)) {
+        return result;
+    }
+    std::thread server_thread([&]() {
+        std::vector<std::unique_ptr<AudioStreamPacket>> batch;
+        Bytes message;
+        for (long frame = 0; frame < frames;) {
+            batch.clear();
+            for (int i = 0; i < config.frames_per_message && frame < frames; i++) {
+                std::unique_ptr<AudioStreamPacket> packet(new AudioStreamPacket());
+                packet->headroom = AUDIO_PACKET_HEADROOM;
+                packet->payload.resize(AUDIO_PACKET_HEADROOM + DOWNLINK_PAYLOAD_SIZE);
+                packet->timestamp = frame;
+                FillPayload(packet->payload_data(), DOWNLINK_PAYLOAD_SIZE, frame++);
+                batch.push_back(std::move(packet));
+            }
+            if (config.version == 4 && batch.size() > 1) {
+                BuildBinaryProtocol4Message(batch, message);
+                SendMessage(server, message.data(), message.size());
+            } else {
+                size_t size;
+                uint8_t* data = PrependBinaryFrameHeader(config.version, *batch[0], size);
+                SendMessage(server, data, size);
+            }
+        }
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    double cpu_start = ThreadCpuSeconds();
+    long good = ReceiveFrames(device, config.version, DOWNLINK_PAYLOAD_SIZE, frames, result.messages, true);
+    result.device_cpu_seconds = ThreadCpuSeconds() - cpu_start;
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.frames = frames;
+    server_thread.join();
+    close(device);
+    close(server);
+    CHECK_EQ(good, frames);
+    CHECK_EQ(result.messages, (frames + config.frames_per_message - 1) / config.frames_per_message);
+    return result;
+}
+
+static void Report(const char* direction, const Config& config, const Result& result, const Result& baseline) {
+    if (result.frames == 0 || result.seconds <= 0) {
+        return;
+    }
+    double cpu_us = result.device_cpu_seconds * 1e6 / result.frames;
+    double baseline_us = baseline.device_cpu_seconds * 1e6 / baseline.frames;
+    printf("%-8s version %d, %d frame(s) per message: %8.0f messages/s, %8.0f frames/s, device CPU %.2f us per frame (%+.0f%% vs version 2)\n",
+        direction, config.version, config.frames_per_message, result.messages / result.seconds,
+        result.frames / result.seconds, cpu_us, baseline_us > 0 ? (cpu_us / baseline_us - 1) * 100 : 0);
+}
+
+int main(int argc, char** argv) {
+    long frames = HostTestIterations(argc, argv, 4000);
+
+    Result uplink_baseline;
+    for (auto& config : kConfigs) {
+        auto result = RunUplink(config, frames);
+        if (&config == &kConfigs[0]) {
+            uplink_baseline = result;
+        }
+        Report("uplink", config, result, uplink_baseline);
+    }
+    Result downlink_baseline;
+    for (auto& config : kConfigs) {
+        auto result = RunDownlink(config, frames);
+        if (&config == &kConfigs[0]) {
+            downlink_baseline = result;
+        }
+        Report("downlink", config, result, downlink_baseline);
+    }
+    return HostTestResult("binary_protocol_benchmark");
+}
@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+"""Builds the VAD corpus for energy_vad_test from the recorded voice prompts in main/assets.
+
+Each WAV is 16 kHz mono, like the input of NoAudioProcessor: prompts placed over a synthetic
+steady background, like a quiet room or a fan. The speech segments go in a .txt file of the same
+name, one "start_ms end_ms" line per segment, from the first to the last 10 ms frame of the prompt
+that is above 5% of its loudest frame. Needs PyAV and numpy:
+
+    pip install av numpy
+    python3 tests/host/data/vad/make_corpus.py
+"""
+
+import os
+import wave
+
+import av
+import numpy as np
+
+RATE = 16000
+FRAME = RATE // 100
+HERE = os.path.dirname(os.path.abspath(__file__))
+LOCALES = os.path.join(HERE, '..', '..', '..', '..', 'main', 'assets', 'locales')
+# Prompts are mastered loud, a microphone at the default gain picks speech up about this much lower
+SPEECH_GAIN = 0.4
+
+
+def load_prompt(name):
+    container = av.open(os.path.join(LOCALES, name + '.ogg'))
+    resampler = av.AudioResampler(format='s16', layout='mono', rate=RATE)
+    chunks = []
+    for frame in container.decode(container.streams.audio[0]):
+        chunks += [f.to_ndarray().reshape(-1) for f in resampler.resample(frame)]
+    chunks += [f.to_ndarray().reshape(-1) for f in resampler.resample(None)]
+    return np.concatenate(chunks).astype(np.float64) * SPEECH_GAIN
+
+
+def voiced_span_ms(samples):
+    frames = np.abs(samples[:len(samples) // FRAME * FRAME]).reshape(-1, FRAME).mean(axis=1)
+    voiced = np.where(frames > frames.max() * 0.05)[0]
+    return voiced[0] * 10, voiced[-1] * 10 + 10
+
+
+def background(random, samples, level, lowpass):
+    """White noise through a one-pole low-pass, scaled to a mean absolute amplitude of level"""
+    noise = random.standard_normal(samples)
+    out = np.empty_like(noise)
+    state = 0.0
+    for i, x in enumerate(noise):
+        state += (x - state) * lowpass
+        out[i] = state
+    return out * level / np.abs(out).mean()
+
+
+def build(name, seed, noise_level, lowpass, layout):
+    """layout is a list of pauses in seconds and prompt names, in order"""
+    random = np.random.default_rng(seed)
+    parts, labels, position = [], [], 0
+    for item in layout:
+        if isinstance(item, str):
+            speech = load_prompt(item)
+            start, end = voiced_span_ms(speech)
+            labels.append((position * 1000 // RATE + start, position * 1000 // RATE + end))
+        else:
+            speech = np.zeros(int(item * RATE))
+        parts.append(speech)
+        position += len(speech)
+    signal = np.concatenate(parts) + background(random, position, noise_level, lowpass)
+    pcm = np.clip(np.round(signal), -32768, 32767).astype('<i2')
+
+    with wave.open(os.path.join(HERE, name + '.wav'), 'wb') as wav:
+        wav.setnchannels(1)
+        wav.setsampwidth(2)
+        wav.setframerate(RATE)
+        wav.writeframes(pcm.tobytes())
+    with open(os.path.join(HERE, name + '.txt'), 'w') as text:
+        text.write('# Speech segments of %s.wav: start_ms end_ms\n' % name)
+        for start, end in labels:
+            text.write('%d %d\n' % (start, end))
+
+
+if __name__ == '__main__':
+    build('quiet_room', 1, 15, 0.5, [1.5, 'en-US/welcome', 1.5, 'zh-CN/wificonfig', 1.0, 'en-US/err_pin', 1.5])
+    build('fan_noise', 2, 250, 0.2, [2.0, 'en-US/7', 1.2, 'ja-JP/welcome', 1.5])
+    build('noise_only', 3, 250, 0.2, [4.0])
@@ -0,0 +1,228 @@
+// NoAudioProcessor VAD on the corpus in data/vad (see make_corpus.py): the OnVadStateChange
+// transitions against the labelled speech segments, the exact attack and hangover timing, the
+// overrides from Settings, then the cost of EnergyVad per 10 ms frame
+
+#include "processors/no_audio_processor.h"
+#include "settings.h"
+#include "host_test.h"
+
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iterator>
+
+#define SAMPLE_RATE 16000
+// The frame duration the audio service feeds NoAudioProcessor with by default
+#define FEED_FRAME_MS 60
+
+struct Segment {
+    int start_ms;
+    int end_ms;
+};
+
+struct Transition {
+    int time_ms;    // End of the frame that changed the state
+    bool speaking;
+};
+
+class HostCodec : public AudioCodec {
+public:
+    HostCodec() {
+        input_sample_rate_ = SAMPLE_RATE;
+        output_sample_rate_ = SAMPLE_RATE;
+    }
+
+protected:
+    int Read(int16_t* dest, int samples) override { return 0; }
+    int Write(const int16_t* data, int samples) override { return samples; }
+};
+
+static uint32_t ReadLittleEndian(const uint8_t* data, int bytes) {
+    uint32_t value = 0;
+    for (int i = bytes - 1; i >= 0; i--) {
+        value = (value << 8) | data[i];
+    }
+    return value;
+}
+
+// 16 kHz mono 16-bit PCM only, like the corpus
+static std::vector<int16_t> LoadWav(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    std::vector<int16_t> samples;
+    if (data.size() < 12 || memcmp(data.data(), "RIFF", 4) != 0 || memcmp(data.data() + 8, "WAVE", 4) != 0) {
+        fprintf(stderr, "%s: not a WAV file\n", path.c_str());
+        return samples;
+    }
+    bool format_ok = false;
+    for (size_t offset = 12; offset + 8 <= data.size();) {
+        const uint8_t* chunk = data.data() + offset;
+        size_t size = ReadLittleEndian(chunk + 4, 4);
+        if (offset + 8 + size > data.size()) {
+            break;
+        }
+        if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16) {
+            format_ok = ReadLittleEndian(chunk + 8, 2) == 1 && ReadLittleEndian(chunk + 10, 2) == 1 &&
+                ReadLittleEndian(chunk + 12, 4) == SAMPLE_RATE && ReadLittleEndian(chunk + 22, 2) == 16;
+        } else if (memcmp(chunk, "data", 4) == 0 && format_ok) {
+            samples.resize(size / 2);
+            for (size_t i = 0; i < samples.size(); i++) {
+                samples[i] = (int16_t)ReadLittleEndian(chunk + 8 + i * 2, 2);
+            }
+            return samples;
+        }
+        offset += 8 + size + (size & 1);
+    }
+    fprintf(stderr, "%s: no 16 kHz mono 16-bit data\n", path.c_str());
+    return samples;
+}
+
+static std::vector<Segment> LoadLabels(const std::string& path) {
+    std::ifstream file(path);
+    std::vector<Segment> segments;
+    std::string line;
+    while (std::getline(file, line)) {
+        Segment segment;
+        if (line.empty() || line[0] == '#' || sscanf(line.c_str(), "%d %d", &segment.start_ms, &segment.end_ms) != 2) {
+            continue;
+        }
+        segments.push_back(segment);
+    }
+    return segments;
+}
+
+// Feeds the samples like the input task, in frames of frame_ms
+static std::vector<Transition> RunProcessor(const std::vector<int16_t>& samples, int frame_ms) {
+    HostCodec codec;
+    NoAudioProcessor processor;
+    std::vector<Transition> transitions;
+    size_t position = 0;
+    processor.Initialize(&codec, frame_ms, nullptr);
+    processor.OnOutput([](std::vector<int16_t>&& data) {});
+    processor.OnVadStateChange([&](bool speaking) {
+        transitions.push_back({(int)(position * 1000 / SAMPLE_RATE), speaking});
+    });
+    processor.Start();
+    size_t frame = processor.GetFeedSize();
+    for (; position + frame <= samples.size();) {
+        std::vector<int16_t> data(samples.begin() + position, samples.begin() + position + frame);
+        position += frame;
+        processor.Feed(std::move(data));
+    }
+    processor.Stop();
+    return transitions;
+}
+
+// One transition to speaking per segment, reported within the attack time plus a frame of the first
+// voiced frame, and the end within the hangover plus a frame of the last one
+static void TestCorpus(const char* name) {
+    std::string base = std::string(XIAOZHI_VAD_CORPUS_DIR) + "/" + name;
+    auto samples = LoadWav(base + ".wav");
+    auto labels = LoadLabels(base + ".txt");
+    CHECK(!samples.empty());
+    EnergyVadConfig config;
+    auto transitions = RunProcessor(samples, FEED_FRAME_MS);
+
+    CHECK_EQ(transitions.size(), labels.size() * 2);
+    if (transitions.size() != labels.size() * 2) {
+        for (auto& transition : transitions) {
+            fprintf(stderr, "%s: %s at %d ms\n", name, transition.speaking ? "speech" : "silence", transition.time_ms);
+        }
+        return;
+    }
+    for (size_t i = 0; i < labels.size(); i++) {
+        auto& start = transitions[i * 2];
+        auto& end = transitions[i * 2 + 1];
+        CHECK(start.speaking && !end.speaking);
+        int onset_ms = start.time_ms - labels[i].start_ms;
+        int release_ms = end.time_ms - labels[i].end_ms;
+        printf("%s: segment %d-%d ms, speech reported after %d ms, silence after %d ms\n", name,
+            labels[i].start_ms, labels[i].end_ms, onset_ms, release_ms);
+        CHECK(onset_ms >= config.attack_ms);
+        CHECK(onset_ms <= config.attack_ms + 2 * FEED_FRAME_MS);
+        CHECK(release_ms >= config.hangover_ms - FEED_FRAME_MS);
+        CHECK(release_ms <= config.hangover_ms + 2 * FEED_FRAME_MS);
+    }
+}
+
+// A 1 kHz tone over a quiet background, in 10 ms frames so every VAD frame is reported when it ends
+static std::vector<int16_t> MakeToneBursts(const std::vector<Segment>& bursts, int total_ms) {
+    std::vector<int16_t> samples(total_ms * SAMPLE_RATE / 1000);
+    uint32_t noise = 1;
+    for (size_t i = 0; i < samples.size(); i++) {
+        noise = noise * 1664525 + 1013904223;
+        samples[i] = (int16_t)((int32_t)(noise >> 16) % 40 - 20);
+        int ms = i * 1000 / SAMPLE_RATE;
+        for (auto& burst : bursts) {
+            if (ms >= burst.start_ms && ms < burst.end_ms) {
+                samples[i] += (int16_t)(3000 * sin(2 * M_PI * 1000 * i / SAMPLE_RATE));
+            }
+        }
+    }
+    return samples;
+}
+
+static void TestAttackAndHangover() {
+    EnergyVadConfig config;
+    // A click shorter than the attack, then a pause shorter than the hangover inside speech
+    auto samples = MakeToneBursts({{500, 500 + config.attack_ms - 10}, {1000, 1500}, {1800, 2500}}, 4000);
+    auto transitions = RunProcessor(samples, 10);
+    CHECK_EQ(transitions.size(), 2);
+    if (transitions.size() == 2) {
+        CHECK_EQ(transitions[0].time_ms, 1000 + config.attack_ms);
+        CHECK(transitions[0].speaking);
+        CHECK_EQ(transitions[1].time_ms, 2500 + config.hangover_ms);
+        CHECK(!transitions[1].speaking);
+    }
+}
+
+// The VAD is tuned per device through the "vad" settings namespace
+static void TestSettings() {
+    {
+        Settings settings("vad", true);
+        settings.SetInt("attack_ms", 100);
+        settings.SetInt("hangover_ms", 300);
+    }
+    auto transitions = RunProcessor(MakeToneBursts({{1000, 2000}}, 3000), 10);
+    CHECK_EQ(transitions.size(), 2);
+    if (transitions.size() == 2) {
+        CHECK_EQ(transitions[0].time_ms, 1100);
+        CHECK_EQ(transitions[1].time_ms, 2300);
+    }
+    Settings settings("vad", true);
+    settings.EraseAll();
+}
+
+static void BenchmarkCost(long iterations) {
+    auto samples = LoadWav(std::string(XIAOZHI_VAD_CORPUS_DIR) + "/quiet_room.wav");
+    size_t frames = samples.size() / ENERGY_VAD_FRAME_SAMPLES;
+    if (frames == 0) {
+        return;
+    }
+    EnergyVad vad;
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; i++) {
+        vad.Reset();
+        vad.Process(samples.data(), frames * ENERGY_VAD_FRAME_SAMPLES);
+    }
+    // The corpus ends in silence
+    CHECK(!vad.speaking());
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double ns_per_frame = seconds * 1e9 / (frames * iterations);
+    // Each frame is 10 ms of audio, the share of one core is the processing time over that
+    printf("EnergyVad: %.0f ns per 10 ms frame, %.4f%% of one host core\n", ns_per_frame, ns_per_frame / 1e7 * 100);
+}
+
+int main(int argc, char** argv) {
+    long iterations = HostTestIterations(argc, argv, 20);
+
+    TestCorpus("quiet_room");
+    TestCorpus("fan_noise");
+    TestCorpus("noise_only");
+    TestAttackAndHangover();
+    TestSettings();
+    BenchmarkCost(iterations);
+    return HostTestResult("energy_vad_test");
+}
@@ -0,0 +1,11 @@
+// The packet pool lives in audio_service.cc, the host tests allocate packets directly
+
+#include "protocol.h"
+
+void std::default_delete<AudioStreamPacket>::operator()(AudioStreamPacket* packet) const {
+    delete packet;
+}
+
+std::unique_ptr<AudioStreamPacket> NewAudioStreamPacket() {
+    return std::unique_ptr<AudioStreamPacket>(new AudioStreamPacket());
+}
@@ -0,0 +1,43 @@
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Minimal checks for the host tests: a failed CHECK is printed and makes the test exit non-zero
+
+inline int host_test_failures = 0;
+
+#define CHECK(condition) do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+            host_test_failures++; \
+        } \
+    } while (0)
+
+#define CHECK_EQ(actual, expected) do { \
+        long long actual_value = (long long)(actual); \
+        long long expected_value = (long long)(expected); \
+        if (actual_value != expected_value) { \
+            fprintf(stderr, "%s:%d: CHECK failed: %s == %s (%lld vs %lld)\n", __FILE__, __LINE__, \
+                #actual, #expected, actual_value, expected_value); \
+            host_test_failures++; \
+        } \
+    } while (0)
+
+inline int HostTestResult(const char* name) {
+    if (host_test_failures > 0) {
+        printf("%s: %d check(s) failed\n", name, host_test_failures);
+        return EXIT_FAILURE;
+    }
+    printf("%s: passed\n", name);
+    return EXIT_SUCCESS;
+}
+
+// Benchmarks take the iteration count from the command line, ctest runs them short
+inline long HostTestIterations(int argc, char** argv, long default_iterations) {
+    return argc > 1 ? strtol(argv[1], nullptr, 10) : default_iterations;
+}
+
+#endif // HOST_TEST_H
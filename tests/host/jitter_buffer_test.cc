@@ -0,0 +1,142 @@
+// JitterBuffer ordering, late packets and target depth with paced, jittered and paused streams
+
+#include "jitter_buffer.h"
+#include "host_test.h"
+
+#define FRAME_MS 60
+
+static std::unique_ptr<AudioStreamPacket> MakePacket(uint32_t sequence) {
+    auto packet = NewAudioStreamPacket();
+    packet->sample_rate = 24000;
+    packet->frame_duration = FRAME_MS;
+    packet->sequence = sequence;
+    packet->timestamp = sequence;
+    packet->payload.assign(10, (uint8_t)sequence);
+    return packet;
+}
+
+// Pops everything that is due at now_ms, returns the sequence numbers, 0 for a concealed frame
+static std::vector<uint32_t> PopDue(JitterBuffer& buffer, int64_t now_ms) {
+    std::vector<uint32_t> popped;
+    std::unique_ptr<AudioStreamPacket> packet;
+    while (buffer.Pop(packet, now_ms)) {
+        popped.push_back(packet->payload.empty() ? 0 : packet->sequence);
+    }
+    return popped;
+}
+
+static void TestReorderBeforePlayout() {
+    JitterBuffer buffer(16);
+    buffer.Push(MakePacket(2), 0);
+    buffer.Push(MakePacket(1), 5);
+    buffer.Push(MakePacket(3), 10);
+    auto popped = PopDue(buffer, 1000);
+    CHECK_EQ(popped.size(), 3);
+    if (popped.size() == 3) {
+        CHECK_EQ(popped[0], 1);
+        CHECK_EQ(popped[1], 2);
+        CHECK_EQ(popped[2], 3);
+    }
+    CHECK_EQ(buffer.GetStats().late_packets, 0);
+}
+
+// After an underrun, a packet whose slot was already played must not move the playout back
+static void TestLateAfterUnderrun() {
+    JitterBuffer buffer(16);
+    buffer.Push(MakePacket(1), 0);
+    buffer.Push(MakePacket(2), 60);
+    auto popped = PopDue(buffer, 200);
+    CHECK_EQ(popped.size(), 2);
+    CHECK(PopDue(buffer, 260).empty());
+    CHECK_EQ(buffer.GetStats().underruns, 1);
+
+    buffer.Push(MakePacket(4), 300);
+    popped = PopDue(buffer, 1000);
+    // 3 is missing, concealed once playout restarts
+    CHECK_EQ(popped.size(), 2);
+    if (popped.size() == 2) {
+        CHECK_EQ(popped[0], 0);
+        CHECK_EQ(popped[1], 4);
+    }
+    buffer.Push(MakePacket(3), 1010);
+    buffer.Push(MakePacket(2), 1020);
+    CHECK(PopDue(buffer, 2000).empty());
+    CHECK_EQ(buffer.GetStats().late_packets, 2);
+    CHECK(buffer.Empty());
+}
+
+static void TestDuplicateAndResync() {
+    JitterBuffer buffer(16);
+    buffer.Push(MakePacket(10), 0);
+    buffer.Push(MakePacket(10), 1);
+    CHECK_EQ(buffer.GetStats().depth, 1);
+    // A jump beyond the buffer restarts the stream instead of concealing the gap
+    buffer.Push(MakePacket(1000), 2);
+    auto popped = PopDue(buffer, 1000);
+    CHECK_EQ(popped.size(), 1);
+    if (popped.size() == 1) {
+        CHECK_EQ(popped[0], 1000);
+    }
+}
+
+// The slot index must not jump when the sequence wraps, with a slot count that is no power of two
+static void TestSequenceWrap() {
+    JitterBuffer buffer(120);
+    uint32_t sequence = 0xFFFFFFF0;
+    for (int i = 0; i < 32; i++) {
+        buffer.Push(MakePacket(sequence++), i);
+    }
+    CHECK_EQ(buffer.GetStats().depth, 32);
+    auto popped = PopDue(buffer, 1000);
+    CHECK_EQ(popped.size(), 32);
+    for (size_t i = 0; i < popped.size(); i++) {
+        CHECK_EQ(popped[i], (uint32_t)(0xFFFFFFF0 + i));
+    }
+    CHECK_EQ(buffer.GetStats().late_packets, 0);
+}
+
+// A realtime stream with pauses between sentences, like TTS over websocket: the target depth stays at
+// one frame instead of growing with the pauses
+static void TestPausesDoNotCountAsJitter() {
+    JitterBuffer buffer(40);
+    uint32_t sequence = 1;
+    int64_t now = 0;
+    for (int sentence = 0; sentence < 5; sentence++) {
+        for (int i = 0; i < 20; i++) {
+            buffer.Push(MakePacket(sequence++), now);
+            PopDue(buffer, now);
+            now += FRAME_MS;
+        }
+        // Drain, then pause
+        PopDue(buffer, now);
+        now += 2000;
+    }
+    auto stats = buffer.GetStats();
+    CHECK_EQ(stats.jitter_ms, 0);
+    CHECK_EQ(stats.target_depth, 1);
+}
+
+// Arrivals alternating 40 ms early and late around the frame clock: the target depth grows, but
+// stays within the configured maximum
+static void TestJitterRaisesTargetDepth() {
+    JitterBuffer buffer(40);
+    for (uint32_t sequence = 1; sequence <= 100; sequence++) {
+        int64_t now = sequence * FRAME_MS + (sequence % 2 == 0 ? 40 : -40);
+        buffer.Push(MakePacket(sequence), now);
+        PopDue(buffer, now);
+    }
+    auto stats = buffer.GetStats();
+    CHECK(stats.jitter_ms > 40);
+    CHECK(stats.target_depth > 1);
+    CHECK(stats.target_depth <= JITTER_BUFFER_MAX_TARGET_MS / FRAME_MS);
+}
+
+int main() {
+    TestReorderBeforePlayout();
+    TestLateAfterUnderrun();
+    TestDuplicateAndResync();
+    TestSequenceWrap();
+    TestPausesDoNotCountAsJitter();
+    TestJitterRaisesTargetDepth();
+    return HostTestResult("jitter_buffer_test");
+}
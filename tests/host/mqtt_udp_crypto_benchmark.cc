@@ -0,0 +1,151 @@
+// MQTT/UDP audio datagrams: AES-128-CTR against the NIST test vector, the round trip of the header
+// and payload in the encoder headroom, rejected datagrams, then packets per second of the
+// MqttProtocol::SendAudio() and receive paths. mbedtls is replaced by OpenSSL (stubs/mbedtls/aes.h).
+
+#include "mqtt_udp_packet.h"
+#include "host_test.h"
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+typedef std::vector<uint8_t> Bytes;
+
+static const uint8_t kKey[16] = {
+    0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c,
+};
+
+// NIST SP 800-38A F.5.1, CTR-AES128: the counter block is the datagram header
+static void TestKnownAnswer(mbedtls_aes_context* aes) {
+    Bytes datagram = {
+        0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff,
+        0x87, 0x4d, 0x61, 0x91, 0xb6, 0x20, 0xe3, 0x26, 0x1b, 0xef, 0x68, 0x64, 0x99, 0x0d, 0xb6, 0xce,
+        0x98, 0x06, 0xf6, 0x6b, 0x79, 0x70, 0xfd, 0xff, 0x86, 0x17, 0x18, 0x7b, 0xb9, 0xff, 0xfd, 0xff,
+        0x5a, 0xe4, 0xdf, 0x3e, 0xdb, 0xd5, 0xd3, 0x5e, 0x5b, 0x4f, 0x09, 0x02, 0x0d, 0xb0, 0x3e, 0xab,
+        0x1e, 0x03, 0x1d, 0xda, 0x2f, 0xbe, 0x03, 0xd1, 0x79, 0x21, 0x70, 0xa0, 0xf3, 0x00, 0x9c, 0xee,
+    };
+    const Bytes plaintext = {
+        0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+        0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+        0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+        0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17, 0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10,
+    };
+    Bytes received = datagram;
+    Bytes payload;
+    CHECK(MqttUdpDecryptPayload(aes, received.data(), received.size(), payload));
+    CHECK(payload == plaintext);
+    // The counter block is copied, the received datagram stays as it is
+    CHECK(received == datagram);
+}
+
+static void FillPacket(AudioStreamPacket& packet, const Bytes& opus, uint32_t timestamp,
+    size_t headroom = AUDIO_PACKET_HEADROOM) {
+    packet.Reset();
+    packet.headroom = headroom;
+    packet.payload.assign(headroom, 0);
+    packet.payload.insert(packet.payload.end(), opus.begin(), opus.end());
+    packet.timestamp = timestamp;
+}
+
+static void TestRoundTrip(mbedtls_aes_context* aes, const Bytes& session_nonce) {
+    std::mt19937 random(1);
+    AudioStreamPacket packet;
+    Bytes payload;
+    for (int n = 0; n < 500; n++) {
+        Bytes opus(random() % 1000);
+        for (auto& byte : opus) {
+            byte = random();
+        }
+        uint32_t timestamp = random();
+        uint32_t sequence = random();
+        // Every fourth packet has no headroom, like the packets recorded in audio testing mode
+        FillPacket(packet, opus, timestamp, n % 4 == 0 ? 0 : AUDIO_PACKET_HEADROOM);
+
+        uint8_t* datagram = MqttUdpEncryptPacket(aes, session_nonce.data(), sequence, packet);
+        CHECK(datagram != nullptr);
+        if (datagram == nullptr) {
+            continue;
+        }
+        size_t size = MQTT_AES_NONCE_SIZE + opus.size();
+        CHECK(datagram + size == packet.payload.data() + packet.payload.size());
+        CHECK(opus.size() < 4 || !std::equal(opus.begin(), opus.end(), datagram + MQTT_AES_NONCE_SIZE));
+
+        // Type, flags and ssrc come from the session nonce, the payload size is big-endian
+        CHECK_EQ(datagram[0], MQTT_UDP_PACKET_TYPE_AUDIO);
+        CHECK_EQ(datagram[1], session_nonce[1]);
+        CHECK_EQ((datagram[2] << 8) | datagram[3], opus.size());
+        CHECK(std::equal(session_nonce.begin() + 4, session_nonce.begin() + 8, datagram + 4));
+
+        Bytes received(datagram, datagram + size);
+        uint32_t parsed_timestamp, parsed_sequence;
+        CHECK(MqttUdpParseHeader(received.data(), received.size(), parsed_timestamp, parsed_sequence));
+        CHECK_EQ(parsed_timestamp, timestamp);
+        CHECK_EQ(parsed_sequence, sequence);
+        CHECK(MqttUdpDecryptPayload(aes, received.data(), received.size(), payload));
+        CHECK(payload == opus);
+    }
+
+    uint32_t timestamp, sequence;
+    Bytes short_datagram(MQTT_AES_NONCE_SIZE - 1, MQTT_UDP_PACKET_TYPE_AUDIO);
+    CHECK(!MqttUdpParseHeader(short_datagram.data(), short_datagram.size(), timestamp, sequence));
+    CHECK(!MqttUdpDecryptPayload(aes, short_datagram.data(), short_datagram.size(), payload));
+    Bytes other_type(MQTT_AES_NONCE_SIZE + 10, 0x02);
+    CHECK(!MqttUdpParseHeader(other_type.data(), other_type.size(), timestamp, sequence));
+    // A header alone is an empty payload
+    Bytes header_only = session_nonce;
+    CHECK(MqttUdpParseHeader(header_only.data(), header_only.size(), timestamp, sequence));
+    CHECK(MqttUdpDecryptPayload(aes, header_only.data(), header_only.size(), payload));
+    CHECK(payload.empty());
+}
+
+static void Benchmark(mbedtls_aes_context* aes, const Bytes& session_nonce, long iterations) {
+    AudioStreamPacket packet;
+    std::string send_buffer;
+    Bytes payload;
+    volatile size_t sink = 0;
+    // Opus at the usual uplink bitrate, 20 and 60 ms frames
+    for (size_t opus_size : { 60, 180 }) {
+        Bytes opus(opus_size, 0x5A);
+        uint32_t sequence = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        for (long i = 0; i < iterations; i++) {
+            // Like SendAudio(): a pooled packet with the headroom, encrypted in place and copied into
+            // the string for Udp::Send()
+            FillPacket(packet, opus, i);
+            uint8_t* datagram = MqttUdpEncryptPacket(aes, session_nonce.data(), ++sequence, packet);
+            send_buffer.assign((const char*)datagram, MQTT_AES_NONCE_SIZE + opus_size);
+            sink = sink + send_buffer.size();
+        }
+        auto middle = std::chrono::steady_clock::now();
+        std::string received = send_buffer;
+        for (long i = 0; i < iterations; i++) {
+            // Like the UDP OnMessage handler, minus the sequence bookkeeping
+            uint32_t timestamp;
+            MqttUdpParseHeader((const uint8_t*)received.data(), received.size(), timestamp, sequence);
+            MqttUdpDecryptPayload(aes, (const uint8_t*)received.data(), received.size(), payload);
+            sink = sink + payload.size() + timestamp;
+        }
+        auto end = std::chrono::steady_clock::now();
+        double send_us = std::chrono::duration<double, std::micro>(middle - start).count() / iterations;
+        double receive_us = std::chrono::duration<double, std::micro>(end - middle).count() / iterations;
+        printf("mqtt_udp_crypto_benchmark: %u byte payload: send %.2f us (%.0f packets/s), receive %.2f us (%.0f packets/s)\n",
+            (unsigned)opus_size, send_us, 1e6 / send_us, receive_us, 1e6 / receive_us);
+    }
+}
+
+int main(int argc, char** argv) {
+    long iterations = HostTestIterations(argc, argv, 20000);
+    mbedtls_aes_context aes;
+    mbedtls_aes_init(&aes);
+    CHECK_EQ(mbedtls_aes_setkey_enc(&aes, kKey, 128), 0);
+    // A session nonce as the server hello sends it: type, flags, a zero size, ssrc, zero timestamp and sequence
+    Bytes session_nonce = { 0x01, 0x00, 0x00, 0x00, 0x12, 0x34, 0x56, 0x78, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+    TestKnownAnswer(&aes);
+    TestRoundTrip(&aes, session_nonce);
+    Benchmark(&aes, session_nonce, iterations);
+    mbedtls_aes_free(&aes);
+    return HostTestResult("mqtt_udp_crypto_benchmark");
+}
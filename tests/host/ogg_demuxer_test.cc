@@ -0,0 +1,289 @@
+// OggDemuxer against a plain page walker on the bundled sounds, and on synthetic streams with
+// packets spanning pages and a corrupted page
+
+#include "ogg_demuxer.h"
+#include "host_test.h"
+
+#include <dirent.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define OGG_PAGE_HEADER_SIZE 27
+#define SYNTHETIC_PRE_SKIP 312
+
+typedef std::vector<uint8_t> Bytes;
+
+static uint32_t Crc32(const uint8_t* data, size_t size) {
+    uint32_t crc = 0;
+    for (size_t i = 0; i < size; i++) {
+        crc ^= (uint32_t)data[i] << 24;
+        for (int j = 0; j < 8; j++) {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+static uint64_t ReadLe64(const uint8_t* p) {
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; i--) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+// Reference: every packet of every page in file order, header packets included, no CRC check
+static std::vector<Bytes> ReferencePackets(const std::string& file, int64_t& last_granule) {
+    std::vector<Bytes> packets;
+    Bytes current;
+    size_t offset = 0;
+    while (offset + OGG_PAGE_HEADER_SIZE <= file.size()) {
+        auto page = reinterpret_cast<const uint8_t*>(file.data()) + offset;
+        int segments = page[26];
+        size_t body = offset + OGG_PAGE_HEADER_SIZE + segments;
+        last_granule = (int64_t)ReadLe64(page + 6);
+        for (int i = 0; i < segments; i++) {
+            uint8_t lacing = page[OGG_PAGE_HEADER_SIZE + i];
+            current.insert(current.end(), file.data() + body, file.data() + body + lacing);
+            body += lacing;
+            if (lacing < 255) {
+                packets.push_back(current);
+                current.clear();
+            }
+        }
+        offset = body;
+    }
+    return packets;
+}
+
+struct Demuxed {
+    std::vector<Bytes> packets;
+    int64_t samples = 0;    // After the trims
+    int64_t trim_start = 0;
+    uint32_t crc_errors = 0;
+    int pre_skip = 0;
+};
+
+static Demuxed Demux(const std::string& file) {
+    Demuxed result;
+    OggDemuxer demuxer(file);
+    OggOpusPacket packet;
+    while (demuxer.NextPacket(packet)) {
+        result.packets.emplace_back(packet.data, packet.data + packet.size);
+        CHECK(packet.samples > 0);
+        CHECK(packet.trim_start + packet.trim_end <= packet.samples);
+        result.samples += packet.samples - packet.trim_start - packet.trim_end;
+        result.trim_start += packet.trim_start;
+    }
+    result.crc_errors = demuxer.crc_errors();
+    result.pre_skip = demuxer.pre_skip();
+    return result;
+}
+
+static void CheckAgainstReference(const std::string& name, const std::string& file) {
+    int64_t last_granule = -1;
+    auto reference = ReferencePackets(file, last_granule);
+    auto demuxed = Demux(file);
+    CHECK_EQ(demuxed.crc_errors, 0);
+    CHECK(reference.size() >= 2);
+    // The demuxer hands out the audio packets only
+    CHECK_EQ(demuxed.packets.size(), reference.size() - 2);
+    for (size_t i = 0; i < demuxed.packets.size() && i + 2 < reference.size(); i++) {
+        if (demuxed.packets[i] != reference[i + 2]) {
+            fprintf(stderr, "%s: packet %zu differs\n", name.c_str(), i);
+            CHECK(false);
+            break;
+        }
+    }
+    CHECK_EQ(demuxed.trim_start, demuxed.pre_skip);
+    CHECK_EQ(demuxed.samples, last_granule - demuxed.pre_skip);
+}
+
+static void TestBundledSounds() {
+    std::string locales = XIAOZHI_ASSETS_DIR "/locales";
+    DIR* locales_dir = opendir(locales.c_str());
+    CHECK(locales_dir != nullptr);
+    if (locales_dir == nullptr) {
+        return;
+    }
+    int files = 0;
+    while (auto locale = readdir(locales_dir)) {
+        if (locale->d_name[0] == '.') {
+            continue;
+        }
+        std::string locale_path = locales + "/" + locale->d_name;
+        DIR* dir = opendir(locale_path.c_str());
+        if (dir == nullptr) {
+            continue;
+        }
+        while (auto entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name.size() < 4 || name.compare(name.size() - 4, 4, ".ogg") != 0) {
+                continue;
+            }
+            std::ifstream in(locale_path + "/" + name, std::ios::binary);
+            std::stringstream data;
+            data << in.rdbuf();
+            CheckAgainstReference(locale_path + "/" + name, data.str());
+            files++;
+        }
+        closedir(dir);
+    }
+    closedir(locales_dir);
+    CHECK(files > 0);
+    printf("ogg_demuxer_test: %d bundled sounds\n", files);
+}
+
+static Bytes OpusPacket(size_t size, uint8_t fill) {
+    // TOC config 31 (CELT fullband 20 ms), one frame: 960 samples
+    Bytes packet(size, fill);
+    packet[0] = 31 << 3;
+    return packet;
+}
+
+static Bytes HeaderPacket() {
+    Bytes head = { 'O', 'p', 'u', 's', 'H', 'e', 'a', 'd', 1, 1,
+        SYNTHETIC_PRE_SKIP & 0xFF, SYNTHETIC_PRE_SKIP >> 8, 0x80, 0x3E, 0, 0, 0, 0, 0 };
+    return head;
+}
+
+static Bytes TagsPacket() {
+    Bytes tags = { 'O', 'p', 'u', 's', 'T', 'a', 'g', 's', 0, 0, 0, 0, 0, 0, 0, 0 };
+    return tags;
+}
+
+// Lays the packets out in pages of at most max_segments lacing values, like a muxer with a small
+// page size; the header packets each get their own page
+static std::string WriteOgg(const std::vector<Bytes>& packets, int max_segments, int64_t end_granule) {
+    std::string file;
+    uint32_t page_sequence = 0;
+    int64_t granule = 0;
+    auto flush = [&](const Bytes& lacing, const Bytes& body, bool continued, bool eos, int64_t page_granule) {
+        Bytes page(OGG_PAGE_HEADER_SIZE);
+        memcpy(page.data(), "OggS", 4);
+        page[5] = (continued ? 0x01 : 0) | (page_sequence == 0 ? 0x02 : 0) | (eos ? 0x04 : 0);
+        for (int i = 0; i < 8; i++) {
+            page[6 + i] = (uint8_t)((uint64_t)page_granule >> (8 * i));
+        }
+        page[14] = 0x78;
+        for (int i = 0; i < 4; i++) {
+            page[18 + i] = (uint8_t)(page_sequence >> (8 * i));
+        }
+        page[26] = (uint8_t)lacing.size();
+        page.insert(page.end(), lacing.begin(), lacing.end());
+        page.insert(page.end(), body.begin(), body.end());
+        uint32_t crc = Crc32(page.data(), page.size());
+        for (int i = 0; i < 4; i++) {
+            page[22 + i] = (uint8_t)(crc >> (8 * i));
+        }
+        file.append(page.begin(), page.end());
+        page_sequence++;
+    };
+
+    flush({ (uint8_t)HeaderPacket().size() }, HeaderPacket(), false, false, 0);
+    flush({ (uint8_t)TagsPacket().size() }, TagsPacket(), false, false, 0);
+
+    Bytes lacing, body;
+    bool continued = false;
+    bool packet_open = false;
+    int64_t page_granule = -1;
+    for (size_t p = 0; p < packets.size(); p++) {
+        const Bytes& packet = packets[p];
+        size_t left = packet.size();
+        size_t offset = 0;
+        while (true) {
+            if ((int)lacing.size() == max_segments) {
+                flush(lacing, body, continued, false, page_granule);
+                lacing.clear();
+                body.clear();
+                continued = packet_open;
+                page_granule = -1;
+            }
+            uint8_t value = left >= 255 ? 255 : (uint8_t)left;
+            lacing.push_back(value);
+            body.insert(body.end(), packet.begin() + offset, packet.begin() + offset + value);
+            offset += value;
+            left -= value;
+            packet_open = true;
+            if (value < 255) {
+                packet_open = false;
+                granule += OggDemuxer::GetPacketSamples(packet.data(), packet.size());
+                page_granule = p + 1 == packets.size() ? end_granule : granule;
+                break;
+            }
+        }
+    }
+    flush(lacing, body, continued, true, page_granule);
+    return file;
+}
+
+// Two packets in a row that each start on one page and end on the next
+static void TestConsecutiveSpanningPackets() {
+    std::vector<Bytes> packets;
+    packets.push_back(OpusPacket(100, 1));
+    packets.push_back(OpusPacket(700, 2));     // 3 segments, spans pages with 2 segments each
+    packets.push_back(OpusPacket(600, 3));     // Starts where the last one ended, spans again
+    packets.push_back(OpusPacket(255 * 5 + 10, 4));   // Spans three pages
+    packets.push_back(OpusPacket(80, 5));
+    // The granule position counts the pre-skip, the last packet is cut by 100 samples
+    int64_t end_granule = 5 * 960 - 100;
+    std::string file = WriteOgg(packets, 2, end_granule);
+
+    auto demuxed = Demux(file);
+    CHECK_EQ(demuxed.crc_errors, 0);
+    CHECK_EQ(demuxed.packets.size(), packets.size());
+    for (size_t i = 0; i < demuxed.packets.size() && i < packets.size(); i++) {
+        CHECK_EQ(demuxed.packets[i].size(), packets[i].size());
+        CHECK(demuxed.packets[i] == packets[i]);
+    }
+    CHECK_EQ(demuxed.trim_start, SYNTHETIC_PRE_SKIP);
+    CHECK_EQ(demuxed.samples, end_granule - SYNTHETIC_PRE_SKIP);
+}
+
+// A corrupted page is skipped, the packet continued from it is dropped and the rest is intact
+static void TestCorruptedPage() {
+    std::vector<Bytes> packets;
+    for (int i = 0; i < 6; i++) {
+        packets.push_back(OpusPacket(300, (uint8_t)(10 + i)));
+    }
+    std::string file = WriteOgg(packets, 3, 6 * 960);
+
+    // Pages: OpusHead, OpusTags, then [p0 p0 p1] [p1 p2 p2] [p3 p3 p4] [p4 p5 p5]
+    std::vector<size_t> pages;
+    size_t offset = 0;
+    while (offset < file.size()) {
+        pages.push_back(offset);
+        int segments = (uint8_t)file[offset + 26];
+        size_t body = 0;
+        for (int i = 0; i < segments; i++) {
+            body += (uint8_t)file[offset + OGG_PAGE_HEADER_SIZE + i];
+        }
+        offset += OGG_PAGE_HEADER_SIZE + segments + body;
+    }
+    CHECK_EQ(pages.size(), 6);
+    if (pages.size() != 6) {
+        return;
+    }
+    // Corrupt the body of the page holding the end of p1 and all of p2
+    file[pages[3] + OGG_PAGE_HEADER_SIZE + 3 + 10] ^= 0x55;
+
+    auto demuxed = Demux(file);
+    CHECK_EQ(demuxed.crc_errors, 1);
+    // p1 lost its tail and p2 was on the bad page
+    CHECK_EQ(demuxed.packets.size(), 4);
+    if (demuxed.packets.size() == 4) {
+        CHECK(demuxed.packets[0] == packets[0]);
+        CHECK(demuxed.packets[1] == packets[3]);
+        CHECK(demuxed.packets[2] == packets[4]);
+        CHECK(demuxed.packets[3] == packets[5]);
+    }
+}
+
+int main() {
+    TestBundledSounds();
+    TestConsecutiveSpanningPackets();
+    TestCorruptedPage();
+    return HostTestResult("ogg_demuxer_test");
+}
@@ -0,0 +1,183 @@
+// Output gain and I2S slot conversion kernels of NoAudioCodec / K10AudioCodec: exact match with the
+// previous loops (pow() volume curve, int64 multiply and clamp, shift and clamp) over every 16-bit
+// sample, saturation, odd lengths, and the time per frame against the previous allocating loops
+
+#include "pcm_kernels.h"
+#include "host_test.h"
+
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+#define OUTPUT_RATE 24000
+#define FRAME_MS 60
+#define INPUT_SHIFT 12
+
+// The loops NoAudioCodec::Write / Read had, with the vector they allocated for every frame
+static void ReferenceWrite(const std::vector<int16_t>& data, int volume, std::vector<int32_t>& written) {
+    std::vector<int32_t> buffer(data.size());
+    int32_t volume_factor = pow(double(volume) / 100.0, 2) * 65536;
+    for (size_t i = 0; i < data.size(); i++) {
+        int64_t temp = int64_t(data[i]) * volume_factor;
+        if (temp > INT32_MAX) {
+            buffer[i] = INT32_MAX;
+        } else if (temp < INT32_MIN) {
+            buffer[i] = INT32_MIN;
+        } else {
+            buffer[i] = static_cast<int32_t>(temp);
+        }
+    }
+    written.swap(buffer);
+}
+
+static void ReferenceRead(const std::vector<int32_t>& slots, std::vector<int16_t>& dest) {
+    std::vector<int32_t> bit32_buffer(slots);
+    for (size_t i = 0; i < slots.size(); i++) {
+        int32_t value = bit32_buffer[i] >> INPUT_SHIFT;
+        dest[i] = (value > INT16_MAX) ? INT16_MAX : (value < -INT16_MAX) ? -INT16_MAX : (int16_t)value;
+    }
+}
+
+static int32_t ReferenceScale(int16_t sample, int32_t gain) {
+    int64_t value = (int64_t)sample * gain;
+    return value > INT32_MAX ? INT32_MAX : (value < INT32_MIN ? INT32_MIN : (int32_t)value);
+}
+
+static void TestVolumeToGain() {
+    // pow() rounds some steps just below the exact product, which the integer curve does not
+    for (int volume = 0; volume <= 100; volume++) {
+        int32_t reference = pow(double(volume) / 100.0, 2) * 65536;
+        int32_t gain = PcmVolumeToGain(volume);
+        CHECK(gain >= reference && gain <= reference + 1);
+        CHECK_EQ(gain, (int64_t)volume * volume * 65536 / 10000);
+    }
+    CHECK_EQ(PcmVolumeToGain(100), 65536);
+    CHECK_EQ(PcmVolumeToGain(0), 0);
+    CHECK_EQ(PcmVolumeToGain(-5), 0);
+}
+
+static void TestScale() {
+    std::vector<int16_t> all(65536);
+    for (int i = 0; i < 65536; i++) {
+        all[i] = (int16_t)(i - 32768);
+    }
+    // Both sides of the unity gain fast path, and gains that saturate
+    const int32_t gains[] = { 0, 1, 6553, 32768, 65535, 65536, 65537, 98304, 1 << 17, 1 << 20, INT32_MAX, -1, -65536 };
+    for (int32_t gain : gains) {
+        std::vector<int32_t> dest(all.size() + 1, 0x55555555);
+        PcmScaleToInt32(all.data(), dest.data(), all.size(), gain);
+        std::vector<int32_t> duplicate(all.size() * 2 + 1, 0x55555555);
+        PcmScaleToInt32Duplicate(all.data(), duplicate.data(), all.size(), gain);
+        bool ok = true;
+        for (size_t i = 0; i < all.size(); i++) {
+            int32_t expected = ReferenceScale(all[i], gain);
+            ok = ok && dest[i] == expected && duplicate[2 * i] == expected && duplicate[2 * i + 1] == expected;
+        }
+        CHECK(ok);
+        CHECK_EQ(dest.back(), 0x55555555);
+        CHECK_EQ(duplicate.back(), 0x55555555);
+    }
+
+    // Lengths around the 4-sample unrolling, the samples past the end are not written
+    for (size_t samples = 0; samples < 10; samples++) {
+        std::vector<int32_t> dest(samples + 1, 0x55555555);
+        PcmScaleToInt32(all.data() + 100, dest.data(), samples, 65536);
+        for (size_t i = 0; i < samples; i++) {
+            CHECK_EQ(dest[i], (int32_t)all[100 + i] * 65536);
+        }
+        CHECK_EQ(dest[samples], 0x55555555);
+    }
+
+    // Every volume step against the previous NoAudioCodec::Write loop
+    std::vector<int32_t> written;
+    std::vector<int32_t> dest(all.size());
+    for (int volume = 0; volume <= 100; volume++) {
+        ReferenceWrite(all, volume, written);
+        PcmScaleToInt32(all.data(), dest.data(), all.size(), PcmVolumeToGain(volume));
+        size_t differences = 0;
+        for (size_t i = 0; i < all.size(); i++) {
+            // A gain one step higher than pow() moves a sample by at most its own magnitude
+            if (dest[i] != written[i]) {
+                differences++;
+                CHECK(std::llabs((int64_t)dest[i] - written[i]) <= 32768);
+            }
+        }
+        int32_t reference_gain = pow(double(volume) / 100.0, 2) * 65536;
+        if (reference_gain == PcmVolumeToGain(volume)) {
+            CHECK_EQ(differences, 0);
+        }
+    }
+}
+
+static void TestInt32ToInt16() {
+    // Extremes, values around the clamp and the truncation of negative values by the shift
+    std::vector<int32_t> slots = { 0, 1, -1, 4095, -4095, 4096, -4096, -4097, INT32_MAX, INT32_MIN,
+        32767 << 12, -(32767 << 12), (32767 << 12) + 4095, -(32767 << 12) - 1, -(32768 << 12), 123456789, -987654321 };
+    for (int i = 0; i < 1000; i++) {
+        slots.push_back((int32_t)(i * 2654435761u));
+    }
+    for (size_t samples = 0; samples <= slots.size(); samples += samples < 10 ? 1 : 97) {
+        std::vector<int32_t> src(slots.begin(), slots.begin() + samples);
+        std::vector<int16_t> expected(samples);
+        ReferenceRead(src, expected);
+        std::vector<int16_t> dest(samples + 1, 0x5555);
+        PcmInt32ToInt16(src.data(), dest.data(), samples, INPUT_SHIFT);
+        CHECK(std::equal(expected.begin(), expected.end(), dest.begin()));
+        CHECK_EQ(dest[samples], 0x5555);
+    }
+    int16_t extreme[2];
+    int32_t extreme_slots[2] = { INT32_MAX, INT32_MIN };
+    PcmInt32ToInt16(extreme_slots, extreme, 2, INPUT_SHIFT);
+    CHECK_EQ(extreme[0], INT16_MAX);
+    CHECK_EQ(extreme[1], -INT16_MAX);
+}
+
+template <typename Function>
+static double MicrosecondsPerFrame(long iterations, Function function) {
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; i++) {
+        function();
+    }
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+static void Benchmark(long iterations) {
+    size_t samples = OUTPUT_RATE * FRAME_MS / 1000;
+    std::vector<int16_t> pcm(samples);
+    for (size_t i = 0; i < samples; i++) {
+        pcm[i] = (int16_t)(std::sin(i * 0.05) * 20000);
+    }
+    std::vector<int32_t> slots(samples);
+    std::vector<int16_t> captured(samples);
+    int volume = 70;
+    volatile int32_t sink = 0;
+
+    double old_write = MicrosecondsPerFrame(iterations, [&]() {
+        std::vector<int32_t> written;
+        ReferenceWrite(pcm, volume, written);
+        sink = sink + written[samples / 2];
+    });
+    double new_write = MicrosecondsPerFrame(iterations, [&]() {
+        PcmScaleToInt32(pcm.data(), slots.data(), samples, PcmVolumeToGain(volume));
+        sink = sink + slots[samples / 2];
+    });
+    double old_read = MicrosecondsPerFrame(iterations, [&]() {
+        ReferenceRead(slots, captured);
+        sink = sink + captured[samples / 2];
+    });
+    double new_read = MicrosecondsPerFrame(iterations, [&]() {
+        PcmInt32ToInt16(slots.data(), captured.data(), samples, INPUT_SHIFT);
+        sink = sink + captured[samples / 2];
+    });
+    printf("%d ms frame at %d Hz: write %.2f us (previous loop %.2f us), read %.2f us (previous loop %.2f us)\n",
+        FRAME_MS, OUTPUT_RATE, new_write, old_write, new_read, old_read);
+}
+
+int main(int argc, char** argv) {
+    long iterations = HostTestIterations(argc, argv, 2000);
+    TestVolumeToGain();
+    TestScale();
+    TestInt32ToInt16();
+    Benchmark(iterations);
+    return HostTestResult("pcm_gain_benchmark");
+}
@@ -0,0 +1,168 @@
+// PolyphaseResampler quality and CPU time. The reference is the ideal output: a tone in the passband
+// must come out as the same tone at the output rate, a tone above the output Nyquist frequency must
+// be filtered out. The unsupported ratio fallback must copy the input as it is.
+
+#include "polyphase_resampler.h"
+#include "host_test.h"
+
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+#define TONE_AMPLITUDE 16384.0
+#define TEST_SECONDS 1
+
+struct Ratio {
+    int input_rate;
+    int output_rate;
+};
+
+// The rates AudioService resamples between
+static const Ratio kRatios[] = {
+    { 24000, 16000 }, { 16000, 24000 }, { 24000, 48000 }, { 48000, 16000 }, { 44100, 16000 }, { 16000, 44100 },
+};
+
+static std::vector<int16_t> Tone(double frequency, int sample_rate, int samples) {
+    std::vector<int16_t> pcm(samples);
+    for (int i = 0; i < samples; i++) {
+        pcm[i] = (int16_t)std::lround(TONE_AMPLITUDE * std::sin(2 * M_PI * frequency * i / sample_rate));
+    }
+    return pcm;
+}
+
+// Resamples in 20 ms blocks like the audio tasks, so the state carried between calls is covered
+static std::vector<int16_t> Resample(PolyphaseResampler& resampler, const std::vector<int16_t>& input) {
+    std::vector<int16_t> output;
+    int block = resampler.input_sample_rate() / 50;
+    for (size_t offset = 0; offset < input.size(); offset += block) {
+        int samples = std::min<int>(block, input.size() - offset);
+        size_t start = output.size();
+        output.resize(start + resampler.GetOutputSamples(samples));
+        resampler.Process(input.data() + offset, samples, output.data() + start);
+    }
+    return output;
+}
+
+// Least squares fit of a tone at the given frequency; returns the SNR of the fit in dB and the gain
+static double ToneSnr(const std::vector<int16_t>& pcm, size_t skip, double frequency, int sample_rate, double& gain) {
+    double ss = 0, sc = 0, cc = 0, ys = 0, yc = 0;
+    for (size_t i = skip; i < pcm.size(); i++) {
+        double s = std::sin(2 * M_PI * frequency * i / sample_rate);
+        double c = std::cos(2 * M_PI * frequency * i / sample_rate);
+        ss += s * s;
+        sc += s * c;
+        cc += c * c;
+        ys += pcm[i] * s;
+        yc += pcm[i] * c;
+    }
+    double det = ss * cc - sc * sc;
+    double a = (ys * cc - yc * sc) / det;
+    double b = (yc * ss - ys * sc) / det;
+    double signal = 0, noise = 0;
+    for (size_t i = skip; i < pcm.size(); i++) {
+        double fit = a * std::sin(2 * M_PI * frequency * i / sample_rate) + b * std::cos(2 * M_PI * frequency * i / sample_rate);
+        signal += fit * fit;
+        noise += (pcm[i] - fit) * (pcm[i] - fit);
+    }
+    gain = std::sqrt(a * a + b * b) / TONE_AMPLITUDE;
+    return 10 * std::log10(signal / std::max(noise, 1e-9));
+}
+
+static double RmsDb(const std::vector<int16_t>& pcm, size_t skip) {
+    double sum = 0;
+    for (size_t i = skip; i < pcm.size(); i++) {
+        sum += (double)pcm[i] * pcm[i];
+    }
+    double rms = std::sqrt(sum / std::max<size_t>(1, pcm.size() - skip));
+    return 20 * std::log10(std::max(rms, 1e-3) / (TONE_AMPLITUDE / std::sqrt(2.0)));
+}
+
+static void TestQuality(const Ratio& ratio, ResamplerQuality quality) {
+    PolyphaseResampler resampler;
+    CHECK(resampler.Configure(ratio.input_rate, ratio.output_rate, quality));
+    int lower_rate = std::min(ratio.input_rate, ratio.output_rate);
+    int samples = ratio.input_rate * TEST_SECONDS;
+    size_t skip = (size_t)resampler.delay_us() * ratio.output_rate / 1000000 * 2;
+    const char* name = quality == kResamplerQualityFast ? "fast" : "high";
+
+    // Passband: 1 kHz and 3 kHz, well below the 0.85 * Nyquist edge of the short filter
+    double worst_snr = 1000;
+    for (double frequency : { 1000.0, 3000.0 }) {
+        resampler.Reset();
+        auto output = Resample(resampler, Tone(frequency, ratio.input_rate, samples));
+        CHECK_EQ(output.size(), (size_t)((int64_t)samples * ratio.output_rate / ratio.input_rate));
+        double gain;
+        double snr = ToneSnr(output, skip, frequency, ratio.output_rate, gain);
+        worst_snr = std::min(worst_snr, snr);
+        CHECK(snr > (quality == kResamplerQualityFast ? 55 : 75));
+        CHECK(std::fabs(20 * std::log10(gain)) < 0.1);
+    }
+
+    // Stopband: a tone at 0.7 of the lower rate would alias to 0.3 of it
+    double stopband_db = 0;
+    if (ratio.input_rate > ratio.output_rate) {
+        resampler.Reset();
+        auto output = Resample(resampler, Tone(lower_rate * 0.7, ratio.input_rate, samples));
+        stopband_db = RmsDb(output, skip);
+        CHECK(stopband_db < (quality == kResamplerQualityFast ? -40 : -60));
+    } else {
+        // Upsampling: the images of a 3 kHz tone must not show up above the input Nyquist frequency
+        resampler.Reset();
+        auto output = Resample(resampler, Tone(3000, ratio.input_rate, samples));
+        double gain;
+        double image = ratio.input_rate - 3000.0;
+        ToneSnr(output, skip, image, ratio.output_rate, gain);
+        stopband_db = 20 * std::log10(std::max(gain, 1e-9));
+        CHECK(stopband_db < (quality == kResamplerQualityFast ? -40 : -60));
+    }
+    printf("%5d -> %5d %s: %2d taps, delay %4d us, passband SNR %.1f dB, stopband %.1f dB\n",
+        ratio.input_rate, ratio.output_rate, name, resampler.taps(), resampler.delay_us(), worst_snr, stopband_db);
+}
+
+static void Benchmark(const Ratio& ratio, ResamplerQuality quality, long iterations) {
+    PolyphaseResampler resampler;
+    resampler.Configure(ratio.input_rate, ratio.output_rate, quality);
+    auto input = Tone(1000, ratio.input_rate, ratio.input_rate / 50);
+    std::vector<int16_t> output(resampler.GetOutputSamples(input.size()) + 1);
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; i++) {
+        resampler.Process(input.data(), input.size(), output.data());
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    // CPU time per second of audio, 50 blocks of 20 ms
+    printf("%5d -> %5d %s: %.1f us per second of audio\n", ratio.input_rate, ratio.output_rate,
+        quality == kResamplerQualityFast ? "fast" : "high", seconds / iterations * 50 * 1e6);
+}
+
+static void TestUnsupportedRatio() {
+    // Two prime rates need a table far above the limit
+    PolyphaseResampler resampler;
+    CHECK(!resampler.Configure(48017, 16001));
+    CHECK_EQ(resampler.taps(), 1);
+    CHECK(!resampler.Configure(48017, 16001));
+    for (int samples : { 1, 3, 160, 961 }) {
+        auto input = Tone(1000, 48000, samples);
+        CHECK_EQ(resampler.GetOutputSamples(samples), samples);
+        std::vector<int16_t> output(samples + 1, 0x5555);
+        resampler.Process(input.data(), samples, output.data());
+        CHECK(std::equal(input.begin(), input.end(), output.begin()));
+        CHECK_EQ(output.back(), 0x5555);
+    }
+    // Back to a supported ratio
+    CHECK(resampler.Configure(24000, 16000));
+    CHECK(resampler.taps() > 1);
+}
+
+int main(int argc, char** argv) {
+    long iterations = HostTestIterations(argc, argv, 200);
+    for (auto& ratio : kRatios) {
+        TestQuality(ratio, kResamplerQualityFast);
+        TestQuality(ratio, kResamplerQualityHigh);
+    }
+    for (auto& ratio : kRatios) {
+        Benchmark(ratio, kResamplerQualityFast, iterations);
+        Benchmark(ratio, kResamplerQualityHigh, iterations);
+    }
+    TestUnsupportedRatio();
+    return HostTestResult("polyphase_resampler_test");
+}
@@ -0,0 +1,22 @@
+#ifndef HOST_BOARD_H
+#define HOST_BOARD_H
+
+// The part of Board the audio code uses. A host test that needs it defines create_board(), like
+// DECLARE_BOARD does for a real board
+
+class AudioCodec;
+
+void* create_board();
+
+class Board {
+public:
+    static Board& GetInstance() {
+        static Board* instance = static_cast<Board*>(create_board());
+        return *instance;
+    }
+
+    virtual ~Board() = default;
+    virtual AudioCodec* GetAudioCodec() = 0;
+};
+
+#endif // HOST_BOARD_H
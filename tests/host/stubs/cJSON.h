@@ -0,0 +1,254 @@
+#ifndef HOST_CJSON_H
+#define HOST_CJSON_H
+
+// The cJSON calls of the code built on host: building the latency report, and parsing the small
+// messages of the loopback protocol. Same node layout and type flags as cJSON
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#define cJSON_Invalid 0
+#define cJSON_False (1 << 0)
+#define cJSON_True (1 << 1)
+#define cJSON_NULL (1 << 2)
+#define cJSON_Number (1 << 3)
+#define cJSON_String (1 << 4)
+#define cJSON_Array (1 << 5)
+#define cJSON_Object (1 << 6)
+
+typedef struct cJSON {
+    struct cJSON* next;
+    struct cJSON* prev;
+    struct cJSON* child;
+    int type;
+    char* valuestring;
+    int valueint;
+    double valuedouble;
+    char* string;
+} cJSON;
+
+inline cJSON* cJSON_HostNew(int type) {
+    cJSON* item = (cJSON*)calloc(1, sizeof(cJSON));
+    item->type = type;
+    return item;
+}
+
+inline void cJSON_Delete(cJSON* item) {
+    while (item != nullptr) {
+        cJSON* next = item->next;
+        cJSON_Delete(item->child);
+        free(item->valuestring);
+        free(item->string);
+        free(item);
+        item = next;
+    }
+}
+
+inline cJSON* cJSON_CreateObject() {
+    return cJSON_HostNew(cJSON_Object);
+}
+
+inline cJSON* cJSON_CreateArray() {
+    return cJSON_HostNew(cJSON_Array);
+}
+
+inline cJSON* cJSON_CreateNumber(double number) {
+    cJSON* item = cJSON_HostNew(cJSON_Number);
+    item->valuedouble = number;
+    item->valueint = (int)number;
+    return item;
+}
+
+inline cJSON* cJSON_CreateString(const char* string) {
+    cJSON* item = cJSON_HostNew(cJSON_String);
+    item->valuestring = strdup(string);
+    return item;
+}
+
+inline bool cJSON_AddItemToArray(cJSON* array, cJSON* item) {
+    if (array == nullptr || item == nullptr) {
+        return false;
+    }
+    if (array->child == nullptr) {
+        array->child = item;
+        item->prev = item;
+    } else {
+        // Like cJSON, the first child keeps the last one in prev
+        cJSON* last = array->child->prev;
+        last->next = item;
+        item->prev = last;
+        array->child->prev = item;
+    }
+    return true;
+}
+
+inline bool cJSON_AddItemToObject(cJSON* object, const char* name, cJSON* item) {
+    if (item == nullptr) {
+        return false;
+    }
+    free(item->string);
+    item->string = strdup(name);
+    return cJSON_AddItemToArray(object, item);
+}
+
+inline cJSON* cJSON_AddNumberToObject(cJSON* object, const char* name, double number) {
+    cJSON* item = cJSON_CreateNumber(number);
+    cJSON_AddItemToObject(object, name, item);
+    return item;
+}
+
+inline cJSON* cJSON_AddStringToObject(cJSON* object, const char* name, const char* string) {
+    cJSON* item = cJSON_CreateString(string);
+    cJSON_AddItemToObject(object, name, item);
+    return item;
+}
+
+inline cJSON* cJSON_GetObjectItem(const cJSON* object, const char* name) {
+    for (cJSON* item = object != nullptr ? object->child : nullptr; item != nullptr; item = item->next) {
+        if (item->string != nullptr && strcmp(item->string, name) == 0) {
+            return item;
+        }
+    }
+    return nullptr;
+}
+
+inline bool cJSON_IsString(const cJSON* item) {
+    return item != nullptr && item->type == cJSON_String;
+}
+
+inline bool cJSON_IsNumber(const cJSON* item) {
+    return item != nullptr && item->type == cJSON_Number;
+}
+
+// Returns the value at text, or nullptr; text is left after the value
+inline cJSON* cJSON_HostParseValue(const char*& text);
+
+inline void cJSON_HostSkipSpace(const char*& text) {
+    while (*text == ' ' || *text == '\t' || *text == '\n' || *text == '\r') {
+        text++;
+    }
+}
+
+// Escapes other than \uXXXX are decoded, \uXXXX is only supported for ASCII
+inline bool cJSON_HostParseString(const char*& text, std::string& value) {
+    if (*text != '"') {
+        return false;
+    }
+    for (text++; *text != '"'; text++) {
+        if (*text == '\0') {
+            return false;
+        }
+        if (*text != '\\') {
+            value += *text;
+            continue;
+        }
+        text++;
+        switch (*text) {
+        case 'b': value += '\b'; break;
+        case 'f': value += '\f'; break;
+        case 'n': value += '\n'; break;
+        case 'r': value += '\r'; break;
+        case 't': value += '\t'; break;
+        case 'u': {
+            char digits[5] = {};
+            if (strlen(text) < 5) {
+                return false;
+            }
+            memcpy(digits, text + 1, 4);
+            value += (char)strtol(digits, nullptr, 16);
+            text += 4;
+            break;
+        }
+        case '\0': return false;
+        default: value += *text; break;
+        }
+    }
+    text++;
+    return true;
+}
+
+inline cJSON* cJSON_HostParseValue(const char*& text) {
+    cJSON_HostSkipSpace(text);
+    if (*text == '{' || *text == '[') {
+        bool object = *text == '{';
+        char end = object ? '}' : ']';
+        cJSON* container = cJSON_HostNew(object ? cJSON_Object : cJSON_Array);
+        text++;
+        cJSON_HostSkipSpace(text);
+        if (*text == end) {
+            text++;
+            return container;
+        }
+        while (true) {
+            std::string name;
+            cJSON_HostSkipSpace(text);
+            if (object) {
+                if (!cJSON_HostParseString(text, name)) {
+                    break;
+                }
+                cJSON_HostSkipSpace(text);
+                if (*text++ != ':') {
+                    break;
+                }
+            }
+            cJSON* item = cJSON_HostParseValue(text);
+            if (item == nullptr) {
+                break;
+            }
+            if (object) {
+                item->string = strdup(name.c_str());
+            }
+            cJSON_AddItemToArray(container, item);
+            cJSON_HostSkipSpace(text);
+            if (*text == ',') {
+                text++;
+            } else if (*text == end) {
+                text++;
+                return container;
+            } else {
+                break;
+            }
+        }
+        cJSON_Delete(container);
+        return nullptr;
+    }
+    if (*text == '"') {
+        std::string value;
+        if (!cJSON_HostParseString(text, value)) {
+            return nullptr;
+        }
+        return cJSON_CreateString(value.c_str());
+    }
+    if (strncmp(text, "true", 4) == 0) {
+        text += 4;
+        return cJSON_HostNew(cJSON_True);
+    }
+    if (strncmp(text, "false", 5) == 0) {
+        text += 5;
+        return cJSON_HostNew(cJSON_False);
+    }
+    if (strncmp(text, "null", 4) == 0) {
+        text += 4;
+        return cJSON_HostNew(cJSON_NULL);
+    }
+    char* end;
+    double number = strtod(text, &end);
+    if (end == text) {
+        return nullptr;
+    }
+    text = end;
+    return cJSON_CreateNumber(number);
+}
+
+inline cJSON* cJSON_Parse(const char* text) {
+    cJSON* root = cJSON_HostParseValue(text);
+    cJSON_HostSkipSpace(text);
+    if (root != nullptr && *text != '\0') {
+        cJSON_Delete(root);
+        return nullptr;
+    }
+    return root;
+}
+
+#endif // HOST_CJSON_H
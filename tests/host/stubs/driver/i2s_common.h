@@ -0,0 +1,13 @@
+#ifndef HOST_DRIVER_I2S_COMMON_H
+#define HOST_DRIVER_I2S_COMMON_H
+
+// Host codecs have no I2S channel, AudioCodec::Start() only enables the channels it has
+
+#include "esp_err.h"
+
+typedef struct i2s_channel_obj_t* i2s_chan_handle_t;
+
+inline esp_err_t i2s_channel_enable(i2s_chan_handle_t) { return ESP_OK; }
+inline esp_err_t i2s_channel_disable(i2s_chan_handle_t) { return ESP_OK; }
+
+#endif // HOST_DRIVER_I2S_COMMON_H
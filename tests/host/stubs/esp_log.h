@@ -0,0 +1,15 @@
+#ifndef HOST_ESP_LOG_H
+#define HOST_ESP_LOG_H
+
+// Logs are dropped on host, the tests print their own results.
+// The arguments are still passed to a function so they are type checked and evaluated like on target
+
+static inline void esp_log_discard(const char*, const char*, ...) {}
+
+#define ESP_LOGE(tag, format, ...) esp_log_discard(tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) esp_log_discard(tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) esp_log_discard(tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) esp_log_discard(tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) esp_log_discard(tag, format, ##__VA_ARGS__)
+
+#endif // HOST_ESP_LOG_H
@@ -0,0 +1,70 @@
+#ifndef HOST_FREERTOS_EVENT_GROUPS_H
+#define HOST_FREERTOS_EVENT_GROUPS_H
+
+// Event groups on a mutex and a condition variable, with the FreeRTOS wait semantics. Timeouts follow
+// the clock of host_clock.h
+
+#include "FreeRTOS.h"
+#include "host_clock.h"
+
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+
+typedef uint32_t EventBits_t;
+
+struct HostEventGroup {
+    std::mutex mutex;
+    std::condition_variable condition;
+    EventBits_t bits = 0;
+};
+typedef HostEventGroup* EventGroupHandle_t;
+
+inline EventGroupHandle_t xEventGroupCreate() {
+    return new HostEventGroup();
+}
+
+inline void vEventGroupDelete(EventGroupHandle_t group) {
+    delete group;
+}
+
+inline EventBits_t xEventGroupGetBits(EventGroupHandle_t group) {
+    std::lock_guard<std::mutex> lock(group->mutex);
+    return group->bits;
+}
+
+inline EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+    std::lock_guard<std::mutex> lock(group->mutex);
+    group->bits |= bits;
+    group->condition.notify_all();
+    return group->bits;
+}
+
+// Returns the bits before they were cleared
+inline EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+    std::lock_guard<std::mutex> lock(group->mutex);
+    EventBits_t value = group->bits;
+    group->bits &= ~bits;
+    return value;
+}
+
+// Returns the bits when the wait ended, before they were cleared
+inline EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit,
+    BaseType_t wait_for_all, TickType_t ticks_to_wait) {
+    std::unique_lock<std::mutex> lock(group->mutex);
+    auto ready = [&]() {
+        return wait_for_all ? (group->bits & bits) == bits : (group->bits & bits) != 0;
+    };
+    if (ticks_to_wait == portMAX_DELAY) {
+        group->condition.wait(lock, ready);
+    } else {
+        group->condition.wait_for(lock, HostClockRealDuration(ticks_to_wait), ready);
+    }
+    EventBits_t value = group->bits;
+    if (ready() && clear_on_exit) {
+        group->bits &= ~bits;
+    }
+    return value;
+}
+
+#endif // HOST_FREERTOS_EVENT_GROUPS_H
@@ -0,0 +1,10 @@
+#ifndef HOST_FREERTOS_RINGBUF_H
+#define HOST_FREERTOS_RINGBUF_H
+
+// audio_debugger.h declares ring buffer members, the ring buffer calls are only built with
+// CONFIG_USE_AUDIO_DEBUGGER, which is off on host
+
+typedef struct HostRingbuffer* RingbufHandle_t;
+typedef struct HostStaticRingbuffer StaticRingbuffer_t;
+
+#endif // HOST_FREERTOS_RINGBUF_H
@@ -0,0 +1,166 @@
+#ifndef HOST_FREERTOS_TASK_H
+#define HOST_FREERTOS_TASK_H
+
+// Tasks and task notifications on host threads. A thread that was not created by xTaskCreate() gets
+// its notification value on first use. Delays and timeouts follow the clock of host_clock.h.
+
+#include "FreeRTOS.h"
+#include "host_clock.h"
+
+#include <ctime>
+#include <cstdio>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <pthread.h>
+#include <condition_variable>
+
+#define tskNO_AFFINITY 0x7FFFFFFF
+#define configMAX_TASK_NAME_LEN 16
+
+typedef void (*TaskFunction_t)(void* arg);
+
+struct HostTask {
+    std::mutex mutex;
+    std::condition_variable condition;
+    uint32_t notification = 0;
+    // Created tasks only
+    char name[configMAX_TASK_NAME_LEN] = {};
+    clockid_t cpu_clock = 0;
+};
+typedef HostTask* TaskHandle_t;
+
+// The subset of the FreeRTOS task status filled in on host, the run time counter is the thread CPU time in us
+typedef struct {
+    TaskHandle_t xHandle;
+    const char* pcTaskName;
+    uint32_t ulRunTimeCounter;
+} TaskStatus_t;
+
+inline TaskHandle_t& HostCurrentTask() {
+    thread_local TaskHandle_t current = nullptr;
+    return current;
+}
+
+// The tasks created by xTaskCreate() that have not returned yet
+struct HostTaskList {
+    std::mutex mutex;
+    std::vector<TaskHandle_t> tasks;
+};
+
+inline HostTaskList& HostTasks() {
+    static HostTaskList list;
+    return list;
+}
+
+inline TaskHandle_t xTaskGetCurrentTaskHandle() {
+    auto& current = HostCurrentTask();
+    if (current == nullptr) {
+        thread_local HostTask task;
+        current = &task;
+    }
+    return current;
+}
+
+// The task is gone when its function returns, vTaskDelete(NULL) at the end of it is a no-op. The
+// handle is never freed, so a late notification to a finished task is harmless
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char* name, uint32_t stack_depth,
+    void* arg, UBaseType_t priority, TaskHandle_t* created_task, BaseType_t core_id) {
+    auto task = new HostTask();
+    snprintf(task->name, sizeof(task->name), "%s", name);
+    // The list is locked until the task is in it, so a task that returns at once still finds itself
+    auto& list = HostTasks();
+    std::lock_guard<std::mutex> lock(list.mutex);
+    std::thread thread([task, function, arg]() {
+        HostCurrentTask() = task;
+        function(arg);
+        auto& list = HostTasks();
+        std::lock_guard<std::mutex> lock(list.mutex);
+        for (auto it = list.tasks.begin(); it != list.tasks.end(); ++it) {
+            if (*it == task) {
+                list.tasks.erase(it);
+                break;
+            }
+        }
+    });
+    pthread_getcpuclockid(thread.native_handle(), &task->cpu_clock);
+    thread.detach();
+    list.tasks.push_back(task);
+    if (created_task != nullptr) {
+        *created_task = task;
+    }
+    return pdPASS;
+}
+
+inline BaseType_t xTaskCreate(TaskFunction_t function, const char* name, uint32_t stack_depth,
+    void* arg, UBaseType_t priority, TaskHandle_t* created_task) {
+    return xTaskCreatePinnedToCore(function, name, stack_depth, arg, priority, created_task, tskNO_AFFINITY);
+}
+
+inline void vTaskDelete(TaskHandle_t task) {
+}
+
+inline UBaseType_t uxTaskGetNumberOfTasks() {
+    std::lock_guard<std::mutex> lock(HostTasks().mutex);
+    return HostTasks().tasks.size();
+}
+
+inline UBaseType_t uxTaskGetSystemState(TaskStatus_t* status, UBaseType_t size, uint32_t* total_run_time) {
+    auto& list = HostTasks();
+    std::lock_guard<std::mutex> lock(list.mutex);
+    UBaseType_t count = 0;
+    for (auto task : list.tasks) {
+        if (count == size) {
+            break;
+        }
+        timespec time = {};
+        clock_gettime(task->cpu_clock, &time);
+        status[count].xHandle = task;
+        status[count].pcTaskName = task->name;
+        status[count].ulRunTimeCounter = time.tv_sec * 1000000 + time.tv_nsec / 1000;
+        count++;
+    }
+    if (total_run_time != nullptr) {
+        *total_run_time = HostClockNowUs();
+    }
+    return count;
+}
+
+// The stack of a host thread is not measured
+inline UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+    return 0;
+}
+
+inline TickType_t xTaskGetTickCount() {
+    return HostClockNowUs() / 1000;
+}
+
+inline BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    std::lock_guard<std::mutex> lock(task->mutex);
+    task->notification++;
+    task->condition.notify_one();
+    return pdPASS;
+}
+
+inline uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait) {
+    auto task = xTaskGetCurrentTaskHandle();
+    std::unique_lock<std::mutex> lock(task->mutex);
+    auto ready = [task]() { return task->notification > 0; };
+    if (ticks_to_wait == portMAX_DELAY) {
+        task->condition.wait(lock, ready);
+    } else {
+        task->condition.wait_for(lock, HostClockRealDuration(ticks_to_wait), ready);
+    }
+    uint32_t value = task->notification;
+    if (value > 0) {
+        task->notification = clear_on_exit ? 0 : value - 1;
+    }
+    return value;
+}
+
+inline void vTaskDelay(TickType_t ticks) {
+    std::this_thread::sleep_for(HostClockRealDuration(ticks));
+}
+
+#endif // HOST_FREERTOS_TASK_H
@@ -0,0 +1,34 @@
+#ifndef HOST_CLOCK_H
+#define HOST_CLOCK_H
+
+// Time base of the host stubs. esp_timer, the FreeRTOS delays and the wait timeouts all run on a
+// clock that goes `speed` times faster than the steady clock, so a simulation can play minutes of
+// audio in seconds. The speed is 1 unless a test sets it, and only before it starts any task: the
+// simulated time jumps when the speed changes.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+inline std::atomic<double>& HostClockSpeed() {
+    static std::atomic<double> speed(1.0);
+    return speed;
+}
+
+inline void HostSetClockSpeed(double speed) {
+    HostClockSpeed().store(speed > 0 ? speed : 1.0);
+}
+
+// Simulated microseconds
+inline int64_t HostClockNowUs() {
+    auto now = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    return (int64_t)(now * HostClockSpeed().load());
+}
+
+// The steady clock duration of a simulated number of milliseconds
+inline std::chrono::microseconds HostClockRealDuration(uint32_t ms) {
+    return std::chrono::microseconds((int64_t)(ms * 1000.0 / HostClockSpeed().load()));
+}
+
+#endif // HOST_CLOCK_H
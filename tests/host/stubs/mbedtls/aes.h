@@ -0,0 +1,52 @@
+#ifndef HOST_MBEDTLS_AES_H
+#define HOST_MBEDTLS_AES_H
+
+// The mbedtls AES calls the protocols use, on top of the OpenSSL block cipher of the host. CTR mode
+// follows mbedtls_aes_crypt_ctr(): nc_off and stream_block carry a partial block between calls
+// and nonce_counter is incremented as a 128-bit big-endian counter.
+
+#define OPENSSL_SUPPRESS_DEPRECATED
+#include <openssl/aes.h>
+
+#include <cstddef>
+#include <cstring>
+
+typedef struct {
+    AES_KEY key;
+} mbedtls_aes_context;
+
+inline void mbedtls_aes_init(mbedtls_aes_context* ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+inline void mbedtls_aes_free(mbedtls_aes_context* ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+inline int mbedtls_aes_setkey_enc(mbedtls_aes_context* ctx, const unsigned char* key, unsigned int keybits) {
+    return AES_set_encrypt_key(key, keybits, &ctx->key) == 0 ? 0 : -0x0020;
+}
+
+inline int mbedtls_aes_crypt_ctr(mbedtls_aes_context* ctx, size_t length, size_t* nc_off,
+    unsigned char nonce_counter[16], unsigned char stream_block[16], const unsigned char* input, unsigned char* output) {
+    size_t n = *nc_off;
+    if (n > 0x0F) {
+        return -0x0021;
+    }
+    for (size_t i = 0; i < length; i++) {
+        if (n == 0) {
+            AES_encrypt(nonce_counter, stream_block, &ctx->key);
+            for (int j = 16; j > 0; j--) {
+                if (++nonce_counter[j - 1] != 0) {
+                    break;
+                }
+            }
+        }
+        output[i] = input[i] ^ stream_block[n];
+        n = (n + 1) & 0x0F;
+    }
+    *nc_off = n;
+    return 0;
+}
+
+#endif // HOST_MBEDTLS_AES_H
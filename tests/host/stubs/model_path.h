@@ -0,0 +1,7 @@
+#ifndef HOST_MODEL_PATH_H
+#define HOST_MODEL_PATH_H
+
+// The esp-sr model list is only passed around as a pointer by the code built on host
+typedef struct srmodel_list_t srmodel_list_t;
+
+#endif // HOST_MODEL_PATH_H
@@ -0,0 +1,131 @@
+#ifndef HOST_NVS_FLASH_H
+#define HOST_NVS_FLASH_H
+
+// In-memory NVS for settings.cc: namespaces live as long as the process, a read-only open of a
+// namespace that was never written fails like on target. Only the types Settings uses are kept
+
+#include "esp_err.h"
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <cstdint>
+#include <cstring>
+
+typedef uint32_t nvs_handle_t;
+typedef enum {
+    NVS_READONLY,
+    NVS_READWRITE,
+} nvs_open_mode_t;
+
+struct HostNvs {
+    std::mutex mutex;
+    std::map<std::string, nvs_handle_t> handles;
+    std::map<nvs_handle_t, std::map<std::string, std::string>> values;
+
+    static HostNvs& Get() {
+        static HostNvs nvs;
+        return nvs;
+    }
+
+    // Values are kept as bytes, an integer read with the wrong type is not found like on target
+    esp_err_t Read(nvs_handle_t handle, const char* key, char type, std::string& value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& space = values[handle];
+        auto it = space.find(key);
+        if (it == space.end() || it->second.empty() || it->second[0] != type) {
+            return ESP_ERR_NVS_NOT_FOUND;
+        }
+        value = it->second.substr(1);
+        return ESP_OK;
+    }
+
+    esp_err_t Write(nvs_handle_t handle, const char* key, char type, const std::string& value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        values[handle][key] = type + value;
+        return ESP_OK;
+    }
+};
+
+inline esp_err_t nvs_open(const char* name, nvs_open_mode_t mode, nvs_handle_t* handle) {
+    auto& nvs = HostNvs::Get();
+    std::lock_guard<std::mutex> lock(nvs.mutex);
+    auto it = nvs.handles.find(name);
+    if (it == nvs.handles.end()) {
+        if (mode == NVS_READONLY) {
+            return ESP_ERR_NVS_NOT_FOUND;
+        }
+        it = nvs.handles.emplace(name, (nvs_handle_t)nvs.handles.size() + 1).first;
+    }
+    *handle = it->second;
+    return ESP_OK;
+}
+
+inline void nvs_close(nvs_handle_t) {}
+inline esp_err_t nvs_commit(nvs_handle_t) { return ESP_OK; }
+
+inline esp_err_t nvs_get_str(nvs_handle_t handle, const char* key, char* out, size_t* length) {
+    std::string value;
+    esp_err_t ret = HostNvs::Get().Read(handle, key, 's', value);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    if (out != nullptr) {
+        if (*length < value.size() + 1) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        memcpy(out, value.c_str(), value.size() + 1);
+    }
+    *length = value.size() + 1;
+    return ESP_OK;
+}
+
+inline esp_err_t nvs_set_str(nvs_handle_t handle, const char* key, const char* value) {
+    return HostNvs::Get().Write(handle, key, 's', value);
+}
+
+template <typename T, char Type>
+inline esp_err_t host_nvs_get_int(nvs_handle_t handle, const char* key, T* out) {
+    std::string value;
+    esp_err_t ret = HostNvs::Get().Read(handle, key, Type, value);
+    if (ret == ESP_OK) {
+        memcpy(out, value.data(), sizeof(T));
+    }
+    return ret;
+}
+
+template <typename T, char Type>
+inline esp_err_t host_nvs_set_int(nvs_handle_t handle, const char* key, T value) {
+    return HostNvs::Get().Write(handle, key, Type, std::string((const char*)&value, sizeof(T)));
+}
+
+inline esp_err_t nvs_get_i32(nvs_handle_t handle, const char* key, int32_t* out) {
+    return host_nvs_get_int<int32_t, 'i'>(handle, key, out);
+}
+
+inline esp_err_t nvs_set_i32(nvs_handle_t handle, const char* key, int32_t value) {
+    return host_nvs_set_int<int32_t, 'i'>(handle, key, value);
+}
+
+inline esp_err_t nvs_get_u8(nvs_handle_t handle, const char* key, uint8_t* out) {
+    return host_nvs_get_int<uint8_t, 'u'>(handle, key, out);
+}
+
+inline esp_err_t nvs_set_u8(nvs_handle_t handle, const char* key, uint8_t value) {
+    return host_nvs_set_int<uint8_t, 'u'>(handle, key, value);
+}
+
+inline esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key) {
+    auto& nvs = HostNvs::Get();
+    std::lock_guard<std::mutex> lock(nvs.mutex);
+    return nvs.values[handle].erase(key) > 0 ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+inline esp_err_t nvs_erase_all(nvs_handle_t handle) {
+    auto& nvs = HostNvs::Get();
+    std::lock_guard<std::mutex> lock(nvs.mutex);
+    nvs.values[handle].clear();
+    return ESP_OK;
+}
+
+#endif // HOST_NVS_FLASH_H
@@ -0,0 +1,6 @@
+#ifndef HOST_SDKCONFIG_H
+#define HOST_SDKCONFIG_H
+
+// No Kconfig on host: every CONFIG_ option takes the default of the code that reads it
+
+#endif // HOST_SDKCONFIG_H